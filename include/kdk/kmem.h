@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef KRX_KDK_KMEM_H
+#define KRX_KDK_KMEM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kdk/port.h"
+#include "kdk/queue.h"
+
+/*! Maximum number of zones, including the kmem_alloc() size classes. */
+#define KMEM_MAX_ZONES 32
+/*! Objects held by each per-CPU magazine at most. */
+#define KMEM_MAGAZINE_SIZE 16
+/*! Alignment of objects allocated from zones. */
+#define KMEM_ALIGNMENT 16
+
+struct kmem_magazine;
+
+/*!
+ * A zone (object cache) of fixed-size objects, carved out of page-sized
+ * slabs. Each simulated CPU keeps a magazine of free objects per zone, so that
+ * most allocations and frees take no shared lock. Define zones with
+ * KMEM_ZONE_INITIALISER; they are registered on first use.
+ */
+typedef struct kmem_zone {
+	/*! Name, for statistics. */
+	const char *name;
+	/*! Object size, rounded up to KMEM_ALIGNMENT. */
+	size_t size;
+	/*! One more than the index of this zone's magazines; 0 if unused. */
+	unsigned index;
+	/*! Linkage in the list of zones; kmem_zones_lock protects. */
+	TAILQ_ENTRY(kmem_zone) queue_entry;
+	/*! Magazines of each CPU; kmem_zones_lock protects. */
+	TAILQ_HEAD(, kmem_magazine) magazines;
+	/*! Protects the slab lists and the statistics below. */
+	kspinlock_t lock;
+	/*! Slabs with some, no, or all of their objects free. */
+	TAILQ_HEAD(kmem_slab_list, vm_page) partial, full, empty;
+	/*! Number of slabs, and of objects taken out of them. */
+	size_t nslabs, nslaballocated;
+	/*! Slabs added, and empty slabs given back to the VM. */
+	uint64_t ngrows, nreaped;
+} kmem_zone_t;
+
+#define KMEM_ZONE_INITIALISER(ZONE, NAME, SIZE)                      \
+	{                                                             \
+		.name = NAME, .size = ROUNDUP(SIZE, KMEM_ALIGNMENT),  \
+		.magazines = TAILQ_HEAD_INITIALIZER((ZONE).magazines), \
+		.lock = KSPINLOCK_NAMED_INITIALISER("kmem zone"),      \
+		.partial = TAILQ_HEAD_INITIALIZER((ZONE).partial),    \
+		.full = TAILQ_HEAD_INITIALIZER((ZONE).full),          \
+		.empty = TAILQ_HEAD_INITIALIZER((ZONE).empty),        \
+	}
+
+/*!
+ * Statistics of a zone.
+ */
+struct kmem_zone_stats {
+	const char *name;
+	/*! object size and objects per slab */
+	size_t size, nperslab;
+	/*! slabs, objects in use by clients, and objects in magazines */
+	size_t nslabs, ninuse, nmagazine;
+	/*! allocations and frees, and those a magazine satisfied */
+	uint64_t nallocs, nfrees, nallochits, nfreehits;
+	/*! slabs added, and empty slabs given back to the VM */
+	uint64_t ngrows, nreaped;
+};
+
+/*!
+ * @brief Allocate an object from a zone.
+ *
+ * @returns NULL if no memory could be had.
+ * @pre PFNDB lock not held.
+ */
+void *kmem_zonealloc(kmem_zone_t *zone);
+
+/*!
+ * @brief Free an object to the zone it was allocated from.
+ *
+ * Never needs the PFNDB lock, so may be called with or without it held.
+ */
+void kmem_zonefree(kmem_zone_t *zone, void *ptr);
+
+/*!
+ * @brief Allocate \p size bytes of memory.
+ *
+ * Sizes up to a page are served by power-of-two size class zones; anything
+ * larger comes from the host allocator, the soft port having no kernel
+ * virtual address space to map multi-page allocations into.
+ *
+ * @pre PFNDB lock not held.
+ */
+void *kmem_alloc(size_t size);
+
+/*! @brief Free memory from kmem_alloc(); \p size must match. */
+void kmem_free(void *ptr, size_t size);
+
+/*! @brief Get the statistics of a zone. */
+void kmem_zone_get_stats(kmem_zone_t *zone, struct kmem_zone_stats *stats);
+
+/*! @brief Print statistics of all zones in use. */
+void kmem_dump(void);
+
+#endif /* KRX_KDK_KMEM_H */
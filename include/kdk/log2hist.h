@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file log2hist.h
+ * @brief Histograms with power-of-two buckets.
+ *
+ * Bucket 0 counts values of 0, and bucket i values in [2^(i-1), 2^i); the
+ * last bucket also takes everything larger. Used for lock and fault latency.
+ */
+
+#ifndef KRX_KDK_LOG2HIST_H
+#define KRX_KDK_LOG2HIST_H
+
+#include <stdint.h>
+
+/*! @brief Get the bucket of \p value in a histogram of \p nbuckets. */
+static inline unsigned
+log2hist_bucket(uint64_t value, unsigned nbuckets)
+{
+	unsigned bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+
+	if (bucket >= nbuckets)
+		bucket = nbuckets - 1;
+	return bucket;
+}
+
+/*!
+ * @brief Get the upper bound of the \p pct'th percentile of a histogram of
+ * \p nbuckets; 0 if it is empty.
+ */
+static inline uint64_t
+log2hist_percentile(const uint64_t *hist, unsigned nbuckets, double pct)
+{
+	uint64_t total = 0, sum = 0;
+	unsigned i;
+
+	for (i = 0; i < nbuckets; i++)
+		total += hist[i];
+	if (total == 0)
+		return 0;
+
+	for (i = 0; i < nbuckets - 1; i++) {
+		sum += hist[i];
+		if (sum * 100.0 >= total * pct)
+			break;
+	}
+
+	return (uint64_t)1 << i;
+}
+
+#endif /* KRX_KDK_LOG2HIST_H */
@@ -1,17 +1,86 @@
 #ifndef KRX_KDK_SOFT_H
 #define KRX_KDK_SOFT_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #include "soft_compat.h"
 
 #define KRX_PORT_BITS 64
-#define PGSIZE 128
 
-uintptr_t P2V(uintptr_t paddr);
-uintptr_t V2P(uintptr_t vaddr);
+/*
+ * Geometry is chosen at build time by the soft_page_shift and soft_pmem_kib
+ * meson options. Each pagetable fills one page, so every level indexes
+ * PGSHIFT - 3 bits; 4KiB pages thus give the familiar 9/9/9 split.
+ */
+#ifndef KRX_SOFT_PAGE_SHIFT
+#define KRX_SOFT_PAGE_SHIFT 7
+#endif
+#ifndef KRX_SOFT_PMEM_KIB
+#define KRX_SOFT_PMEM_KIB 16
+#endif
 
-#define PADDR_TO_PFN(PADDR) ((uintptr_t)PADDR >> 7)
-#define PFN_TO_PADDR(PFN) ((uintptr_t)PFN << 7)
+#define PGSHIFT KRX_SOFT_PAGE_SHIFT
+#define PGSIZE (1UL << PGSHIFT)
+
+#define CACHE_LINE_SIZE 64
+
+/*! Simulated physical memory; physical address 0 is its first byte. */
+extern uint8_t *soft_pmem;
+
+static inline uintptr_t
+P2V(uintptr_t paddr)
+{
+	return paddr + (uintptr_t)soft_pmem;
+}
+
+static inline uintptr_t
+V2P(uintptr_t vaddr)
+{
+	return vaddr - (uintptr_t)soft_pmem;
+}
+
+/*!
+ * @brief Set up simulated physical memory and give it to the VMM.
+ *
+ * @param size Size in bytes of the fast tier, or 0 for the build-time default
+ * plus a page for the wired zero page.
+ * It is backed by an anonymous host mapping, so is only committed as it is
+ * touched.
+ * @param slow_size Size in bytes of a slow tier, following the fast tier in
+ * physical memory; 0 for none.
+ */
+void soft_pmem_init(size_t size, size_t slow_size);
+
+/*!
+ * @brief Set up a simulated pagefile of \p size bytes and give it to the VMM.
+ */
+void soft_pagefile_init(size_t size);
+
+/*!
+ * Simulated latency of each pagefile I/O, however many pages it moves; 0 by
+ * default. It is slept out, as a real I/O would be waited for.
+ */
+extern uint64_t soft_pagefile_latency_ns;
+/*! Physical address at which the slow memory tier begins; its end if none. */
+extern uintptr_t soft_slow_tier_base;
+/*!
+ * Simulated extra latency of each access to the slow memory tier, beyond what
+ * an access to the fast tier takes; 0 by default.
+ */
+extern uint64_t soft_slow_tier_latency_ns;
+
+/*!
+ * @brief Save the VM trace rings to the file at \p path.
+ *
+ * The format is that of kdk/vm_trace.h; kernel/tools/vmtrace decodes it.
+ * Tracing should be disabled, or the VM quiescent, while saving.
+ *
+ * @returns 0, or -1 with errno set.
+ */
+int soft_trace_save(const char *path);
+
+#define PADDR_TO_PFN(PADDR) ((uintptr_t)PADDR >> PGSHIFT)
+#define PFN_TO_PADDR(PFN) ((uintptr_t)PFN << PGSHIFT)
 
 #endif /* KRX_KDK_SOFT_H */
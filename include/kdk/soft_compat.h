@@ -3,10 +3,19 @@
 
 #include <assert.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "kdk/log2hist.h"
 
 #define elementsof(x) (sizeof(x) / sizeof((x)[0]))
 #define ROUNDUP(addr, align) (((addr) + align - 1) & ~(align - 1))
@@ -16,17 +25,59 @@
 
 typedef enum ipl { kIPL0, kIPLDPC } ipl_t;
 
-extern __thread ipl_t	 SIM_ipl;
-extern __thread uint64_t SIM_cr3;
-extern __thread void	*SIM_vmps;
+/*!
+ * Number of simulated CPUs given per-CPU data of their own. Host threads are
+ * numbered as they first ask; any beyond this share numbers, so per-CPU data
+ * must tolerate concurrent updates.
+ */
+#define KRX_MAX_CPUS 32
 
-static inline ipl_t
-splget()
-{
-	return SIM_ipl;
-}
+/*! Buckets of the lock wait and hold time histograms. */
+#define SOFT_LOCK_HIST_BUCKETS 24
+/*! Maximum number of distinct lock names. */
+#define SOFT_LOCK_MAX_CLASSES 16
+/*! Times a contended spinlock spins before sleeping. */
+#define SOFT_LOCK_SPINS 64
+
+/*!
+ * Statistics of a lock class, i.e. of all locks sharing a name. Each simulated
+ * CPU keeps its own and updates them only while holding the lock concerned;
+ * soft_lock_get_stats() sums them. Contended means the lock was not
+ * immediately available. Times are in nanoseconds; histogram bucket 0 counts
+ * times of 0, and bucket i times in [2^(i-1), 2^i), the last being open-ended.
+ */
+struct soft_lock_stats {
+	const char *name;
+	uint64_t    acquires, contended;
+	uint64_t    wait_ns, hold_ns;
+	uint64_t    wait_hist[SOFT_LOCK_HIST_BUCKETS];
+	uint64_t    hold_hist[SOFT_LOCK_HIST_BUCKETS];
+};
+
+/*! Bookkeeping common to spinlocks and mutexes. */
+struct soft_lock_info {
+	/*! Name, for statistics; NULL groups the lock with other unnamed ones. */
+	const char *name;
+	/*! One more than the lock's class index; 0 until first acquired. */
+	unsigned class;
+	/*! Holding thread, or 0. */
+	uintptr_t owner;
+	/*! When the holder acquired it. */
+	uint64_t acquired_ns;
+};
+
+extern __thread ipl_t			 SIM_ipl;
+extern __thread uint64_t		 SIM_cr3;
+extern __thread void			*SIM_vmps;
+extern __thread struct soft_lock_stats *SIM_lockstats;
+extern __thread unsigned		 SIM_nspinlocks;
+extern __thread unsigned		 SIM_cpu_num;
+/*! Whether to time lock waits and holds; costs two clock reads per lock. */
+extern bool soft_lock_timing;
 
 #define kprintf(...) printf(__VA_ARGS__)
+#define ksnprintf(...) snprintf(__VA_ARGS__)
+#define kvsnprintf(...) vsnprintf(__VA_ARGS__)
 #define kassert(...) assert(__VA_ARGS__)
 #define kfatal(...)                                  \
 	({                                           \
@@ -36,29 +87,240 @@ splget()
 			;                            \
 	})
 
-#define KSPINLOCK_INITIALISER PTHREAD_MUTEX_INITIALIZER
-typedef pthread_mutex_t kspinlock_t;
+static inline ipl_t
+splget()
+{
+	return SIM_ipl;
+}
+
+/*! @brief Raise the IPL to \p ipl, returning the previous IPL. */
+static inline ipl_t
+splraise(ipl_t ipl)
+{
+	ipl_t old = SIM_ipl;
+	kassert(ipl >= old);
+	SIM_ipl = ipl;
+	return old;
+}
+
+/*! @brief Lower the IPL to \p ipl, as returned by splraise(). */
+static inline void
+splx(ipl_t ipl)
+{
+	kassert(ipl <= SIM_ipl);
+	kassert(ipl >= kIPLDPC || SIM_nspinlocks == 0);
+	SIM_ipl = ipl;
+}
+
+/*! @brief Look up (or create) the class of locks named \p name. */
+unsigned soft_lock_class_lookup(const char *name);
+/*! @brief Allocate the calling thread's lock statistics. */
+struct soft_lock_stats *soft_lock_cpu_init(void);
+/*!
+ * @brief Get lock statistics summed over all simulated CPUs.
+ *
+ * @returns Number of classes; the first \p max of them are written out.
+ */
+size_t soft_lock_get_stats(struct soft_lock_stats *stats, size_t max);
+/*! @brief Get the upper bound of the \p pct'th percentile of a histogram. */
+uint64_t soft_lock_hist_percentile(const uint64_t *hist, double pct);
+/*! @brief Print lock statistics and histograms. */
+void soft_lock_dump_stats(void);
+
+/*! @brief Number the calling thread as a simulated CPU. */
+unsigned soft_cpu_num_assign(void);
+
+/*! @brief Get the current CPU's number, which is below KRX_MAX_CPUS. */
+static inline unsigned
+ke_cpu_num(void)
+{
+	unsigned num = SIM_cpu_num;
+	if (num == 0)
+		num = soft_cpu_num_assign();
+	return num - 1;
+}
+
+static inline uintptr_t
+soft_cpu_self(void)
+{
+	return (uintptr_t)pthread_self();
+}
+
+static inline uint64_t
+soft_nanotime(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*! @brief Get a monotonic time, in nanoseconds. */
+static inline uint64_t
+ke_nanotime(void)
+{
+	return soft_nanotime();
+}
+
+static inline void
+soft_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+/*!
+ * Sleep until \p word might no longer be \p val. Host threads, unlike CPUs,
+ * get preempted, and spinning on a ticket behind a preempted waiter only
+ * stalls the whole queue; so waiters spin briefly, then sleep.
+ */
+static inline void
+soft_futex_wait(uint32_t *word, uint32_t val)
+{
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+#else
+	sched_yield();
+#endif
+}
+
+static inline void
+soft_futex_wake_all(uint32_t *word)
+{
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+#endif
+}
+
+static inline void
+soft_lock_hist_add(uint64_t *hist, uint64_t ns)
+{
+	hist[log2hist_bucket(ns, SOFT_LOCK_HIST_BUCKETS)]++;
+}
+
+/*!
+ * Note that the calling thread got a lock, having started waiting for it at
+ * \p wait_start if it was contended, or 0 if not.
+ */
+static inline void
+soft_lock_acquired(struct soft_lock_info *info, uint64_t wait_start)
+{
+	struct soft_lock_stats *stats;
+	uint64_t		now = 0;
+
+	if (soft_lock_timing || wait_start != 0)
+		now = soft_nanotime();
+	__atomic_store_n(&info->owner, soft_cpu_self(), __ATOMIC_RELAXED);
+	info->acquired_ns = now;
+
+	if (info->class == 0)
+		info->class = soft_lock_class_lookup(info->name);
+	if (SIM_lockstats == NULL)
+		SIM_lockstats = soft_lock_cpu_init();
+	stats = &SIM_lockstats[info->class - 1];
+
+	stats->acquires++;
+	if (wait_start != 0) {
+		stats->contended++;
+		stats->wait_ns += now - wait_start;
+		soft_lock_hist_add(stats->wait_hist, now - wait_start);
+	} else if (soft_lock_timing)
+		soft_lock_hist_add(stats->wait_hist, 0);
+}
+
+/*! Note that the calling thread is about to release a lock. */
+static inline void
+soft_lock_releasing(struct soft_lock_info *info)
+{
+	struct soft_lock_stats *stats = &SIM_lockstats[info->class - 1];
+
+	kassert(info->owner == soft_cpu_self());
+	if (soft_lock_timing && info->acquired_ns != 0) {
+		uint64_t held = soft_nanotime() - info->acquired_ns;
+		stats->hold_ns += held;
+		soft_lock_hist_add(stats->hold_hist, held);
+	}
+	__atomic_store_n(&info->owner, 0, __ATOMIC_RELAXED);
+}
+
+/*!
+ * A ticket spinlock: waiters are served in the order they arrived. Acquiring
+ * it raises the IPL to kIPLDPC.
+ */
+typedef struct kspinlock {
+	uint32_t	      next_ticket, now_serving;
+	/*! Number of waiters asleep on now_serving. */
+	uint32_t	      nsleepers;
+	struct soft_lock_info info;
+} kspinlock_t;
+
+#define KSPINLOCK_INITIALISER \
+	{                     \
+		0             \
+	}
+#define KSPINLOCK_NAMED_INITIALISER(NAME) \
+	{                                 \
+		.info.name = (NAME)       \
+	}
 
 static inline ipl_t
 ke_spinlock_acquire(kspinlock_t *lock)
 {
-	ipl_t ipl = SIM_ipl;
-	pthread_mutex_lock(lock);
+	ipl_t	 ipl = splraise(kIPLDPC);
+	uint32_t ticket;
+	uint64_t wait_start = 0;
+
+	kassert(__atomic_load_n(&lock->info.owner, __ATOMIC_RELAXED) !=
+	    soft_cpu_self());
+
+	ticket = __atomic_fetch_add(&lock->next_ticket, 1, __ATOMIC_RELAXED);
+	if (__atomic_load_n(&lock->now_serving, __ATOMIC_ACQUIRE) != ticket) {
+		wait_start = soft_nanotime();
+		for (unsigned spins = 0;; spins++) {
+			uint32_t serving = __atomic_load_n(&lock->now_serving,
+			    __ATOMIC_ACQUIRE);
+
+			if (serving == ticket)
+				break;
+			else if (spins < SOFT_LOCK_SPINS) {
+				soft_cpu_relax();
+				continue;
+			}
+
+			__atomic_fetch_add(&lock->nsleepers, 1,
+			    __ATOMIC_SEQ_CST);
+			soft_futex_wait(&lock->now_serving, serving);
+			__atomic_fetch_sub(&lock->nsleepers, 1,
+			    __ATOMIC_SEQ_CST);
+		}
+	}
+
+	SIM_nspinlocks++;
+	soft_lock_acquired(&lock->info, wait_start);
 	return ipl;
 }
 
 static inline ipl_t
 ke_spinlock_release(kspinlock_t *lock, ipl_t ipl)
 {
-	pthread_mutex_unlock(lock);
-	SIM_ipl = ipl;
+	soft_lock_releasing(&lock->info);
+	SIM_nspinlocks--;
+	/* seq-cst, lest the store pass the load of nsleepers */
+	__atomic_store_n(&lock->now_serving, lock->now_serving + 1,
+	    __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&lock->nsleepers, __ATOMIC_SEQ_CST) != 0)
+		soft_futex_wake_all(&lock->now_serving);
+	splx(ipl);
 	return ipl;
 }
 
 static inline bool
 ke_spinlock_held(kspinlock_t *lock)
 {
-	return true;
+	return __atomic_load_n(&lock->info.owner, __ATOMIC_RELAXED) ==
+	    soft_cpu_self();
 }
 
 typedef enum kwaitstatus {
@@ -68,8 +330,20 @@ typedef enum kwaitstatus {
 	kKernWaitStatusTimedOut,
 } kwaitstatus_t;
 
-#define KMUTEX_INITIALISER PTHREAD_MUTEX_INITIALIZER
-typedef pthread_mutex_t kmutex_t;
+/*! A sleeping mutex; may only be waited on below kIPLDPC. */
+typedef struct kmutex {
+	pthread_mutex_t	      mutex;
+	struct soft_lock_info info;
+} kmutex_t;
+
+#define KMUTEX_INITIALISER                   \
+	{                                    \
+		.mutex = PTHREAD_MUTEX_INITIALIZER \
+	}
+#define KMUTEX_NAMED_INITIALISER(NAME)                              \
+	{                                                           \
+		.mutex = PTHREAD_MUTEX_INITIALIZER, .info.name = (NAME) \
+	}
 
 typedef struct {
 	pthread_mutex_t mutex;
@@ -148,27 +422,34 @@ static inline int
 ke_wait(kmutex_t *mutex, const char *reason, bool isuserwait, bool alertable,
     int64_t timeout)
 {
-	int r;
-	if (timeout == -1) {
-		pthread_mutex_lock(mutex);
-		return kKernWaitStatusOK;
-	} else if (timeout == 0) {
-		r = pthread_mutex_trylock(mutex);
-	} else {
+	uint64_t wait_start = 0;
+	int	 r;
+
+	kassert(splget() < kIPLDPC);
+
+	r = pthread_mutex_trylock(&mutex->mutex);
+	if (r != 0 && timeout == -1) {
+		wait_start = soft_nanotime();
+		r = pthread_mutex_lock(&mutex->mutex);
+	} else if (r != 0 && timeout != 0) {
 		struct timespec ts;
 		nanosecs_to_timespec(&ts, timeout);
-		r = pthread_mutex_timedlock(mutex, &ts);
+		wait_start = soft_nanotime();
+		r = pthread_mutex_timedlock(&mutex->mutex, &ts);
 	}
-	return r == 0 ? kKernWaitStatusOK : kKernWaitStatusTimedOut;
+
+	if (r != 0)
+		return kKernWaitStatusTimedOut;
+
+	soft_lock_acquired(&mutex->info, wait_start);
+	return kKernWaitStatusOK;
 }
 
 static inline void
 ke_mutex_release(kmutex_t *mutex)
 {
-	pthread_mutex_unlock(mutex);
+	soft_lock_releasing(&mutex->info);
+	pthread_mutex_unlock(&mutex->mutex);
 }
 
-#define kmem_alloc(SIZE) malloc(SIZE)
-#define kmem_free(PTR, SIZE) free(PTR)
-
 #endif /* KRX_KDK_SOFT_COMPAT_H */
@@ -27,6 +27,8 @@ typedef uintptr_t	     vaddr_t, paddr_t, pfn_t;
 typedef struct vmp_procstate vmp_procstate_t;
 typedef struct vm_section    vm_section_t;
 
+struct vm_trace_event;
+
 /*!
  * Protection flags.
  */
@@ -38,15 +40,91 @@ typedef enum vm_protection {
 } vm_protection_t;
 
 /*!
- * Global VM statistics.
+ * Global VM statistics. Each CPU keeps its own deltas, which vm_stat_get()
+ * folds together; so every member must be a size_t.
  */
 struct vm_stat {
-	/*! memory by state */
-	size_t npwired, nactive, nfree, nmodified, nstandby;
+	/*! memory by state; nptcached are empty pagetables kept for reuse */
+	size_t npwired, nactive, nfree, nmodified, nstandby, nptcached;
 
 	/*! memory by use; nfree still counts free. */
 	size_t ndeleted, nanonprivate, nanonfork, nfile, nanonshare,
-	    nprocpgtable, nprotopgtable, nkwired;
+	    nprocpgtable, nprotopgtable, nkwired, nzcache, nmerged;
+
+	/*!
+	 * faults by kind; collided faults found the work already done, zero
+	 * page faults mapped the shared zero page for reading, and cow faults
+	 * made a private copy of a copy-on-write or merged page
+	 */
+	size_t nfaultzero, nfaultwrite, nfaulttrans, nfaultpagein,
+	    nfaultcollided, nfaultzeropage, nfaultzcache, nfaultcow;
+
+	/*! pages written to the pagefile, and standby pages reclaimed */
+	size_t npageout, nreclaimed;
+
+	/*! pages brought in by prefetching, and the pagefile reads doing so */
+	size_t nprefetch, nprefetchread;
+
+	/*! pagetable cache hits and misses, and pages drained under pressure */
+	size_t nptcachehit, nptcachemiss, nptcachedrain;
+
+	/*!
+	 * leaf tables promoted to large pages, large pages demoted, and
+	 * promotions given up for want of contiguous memory
+	 */
+	size_t nlargepromote, nlargedemote, nlargenocontig;
+
+	/*! pages made resident up front by populating new mappings */
+	size_t npopulated;
+
+	/*!
+	 * pages read ahead of hard faults or on will-need advice, and evicted
+	 * behind faults in mappings advised sequential
+	 */
+	size_t nreadahead, nfreebehind;
+};
+
+/*! Kinds of page fault, by how each was resolved. */
+enum vm_fault_kind {
+	/*! a demand-zeroed page was allocated, perhaps replacing the zero page */
+	kVMFaultZero,
+	/*! the shared zero page was mapped for reading */
+	kVMFaultZeroPage,
+	/*! a valid read-only mapping was made writeable */
+	kVMFaultWrite,
+	/*! soft fault: a transition page was mapped back in */
+	kVMFaultTrans,
+	/*! hard fault: a page was read back from the pagefile */
+	kVMFaultPagein,
+	/*! another thread had already done the work */
+	kVMFaultCollided,
+	/*! a private copy was made of a copy-on-write page */
+	kVMFaultCOW,
+	/*! a page was decompressed out of the compressed cache */
+	kVMFaultZCache,
+	kVMFaultKindMax,
+};
+
+/*! Buckets of fault latency histograms. */
+#define VM_FAULT_HIST_BUCKETS 24
+
+/*!
+ * Fault counts and latencies by kind, of one process or of the system.
+ * Histograms are log2: bucket 0 counts latencies of 0ns, and bucket i of
+ * [2^(i-1), 2^i) ns, the last bucket taking everything beyond.
+ */
+struct vm_fault_stats {
+	uint64_t count[kVMFaultKindMax];
+	/*! summed latency, in ns */
+	uint64_t total_ns[kVMFaultKindMax];
+	uint64_t hist[kVMFaultKindMax][VM_FAULT_HIST_BUCKETS];
+};
+
+/*! Tiers of physical memory, fastest first. */
+enum vm_mem_tier {
+	kVMTierFast,
+	kVMTierSlow,
+	kVMTierMax,
 };
 
 enum vm_page_use {
@@ -63,6 +141,14 @@ enum vm_page_use {
 	kPageUsePML2,
 	/*! leaf pagetable */
 	kPageUsePML1,
+	/*! the shared zero page */
+	kPageUseZero,
+	/*! a kmem slab */
+	kPageUseKMem,
+	/*! a page of the compressed cache's pool */
+	kPageUseZCache,
+	/*! a read-only page shared by same-page merging */
+	kPageUseMerged,
 };
 
 /*!
@@ -75,7 +161,8 @@ typedef struct __attribute__((packed)) vm_page {
 	enum vm_page_use use : 4;
 	bool		 dirty : 1;
 	bool		 busy : 1;
-	uintptr_t	 padding : 6;
+	enum vm_mem_tier tier : 2;
+	uintptr_t	 padding : 4;
 
 	/* second word */
 	union __attribute__((packed)) {
@@ -100,15 +187,27 @@ typedef struct __attribute__((packed)) vm_page {
 	uintptr_t swap_descriptor;
 } vm_page_t;
 
-typedef struct vm_account {
+/*! One CPU's deltas to an account, on a cache line of its own. */
+struct vm_account_cpu {
 	size_t nalloced;
 	size_t nwires;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+/*!
+ * Pages allocated to and wired by some owner. Each CPU keeps its own deltas;
+ * read the totals with vm_account_get().
+ */
+typedef struct vm_account {
+	struct vm_account_cpu cpu[KRX_MAX_CPUS];
 } vm_account_t;
 
 /*!
- * @brief Add a region of memory to the VMM's management.
+ * @brief Add a region of memory of tier \p tier to the VMM's management.
+ *
+ * Pages are allocated from the fast tier while it has any free, and from the
+ * slow tier after; vm_ps_tier_migrate() moves pages between them by use.
  */
-void vm_region_add(paddr_t base, size_t length);
+void vm_region_add(paddr_t base, size_t length, enum vm_mem_tier tier);
 
 /*!
  * @brief Allocate a physical page frame.
@@ -161,20 +260,390 @@ vm_page_t *vm_page_retain(vm_page_t *page, vm_account_t *account);
  */
 void vm_page_release(vm_page_t *page, vm_account_t *account);
 
+/*!
+ * @brief Give the VMM a pagefile of \p nslots page-sized slots.
+ *
+ * Once one exists, modified anonymous pages can be written out and their
+ * frames reclaimed when the free page queue runs dry.
+ */
+void vm_pagefile_add(size_t nslots);
+
+/*!
+ * Statistics of the compressed cache. Byte totals cover every page stored, so
+ * their ratio is the compression ratio achieved.
+ */
+struct vm_zcache_stats {
+	/*! pages stored; of them, decompressed back, and freed unread */
+	uint64_t nstored, nloaded, nfreed;
+	/*! pages turned away as incompressible, or as the pool was full */
+	uint64_t nincompressible, nfull;
+	/*! bytes of pages stored, and of their compressed forms */
+	uint64_t bytes_in, bytes_out;
+	/*! time spent decompressing, in ns */
+	uint64_t decompress_ns;
+	/*! pages held now, and pool pages holding them */
+	size_t nobjects, npages;
+};
+
+/*!
+ * @brief Give the VMM a compressed cache of up to \p max_pages pool pages.
+ *
+ * Once one exists, modified anonymous pages are compressed into the pool in
+ * preference to being written to the pagefile, which they spill to when they
+ * prove incompressible or the pool is full. One pool page is allocated at
+ * once, so that the pool can start filling even when memory is short.
+ *
+ * @pre PFNDB lock must not be held.
+ */
+void vm_zcache_enable(size_t max_pages);
+
+/*! @brief Get the statistics of the compressed cache. */
+void vm_zcache_get_stats(struct vm_zcache_stats *stats);
+
+/*!
+ * Statistics of same-page merging. Pages saved are those mapping a shared page
+ * beyond the first of each, nsharing - npages, plus the pages merged into the
+ * zero page, which are not tracked once merged.
+ */
+struct vm_merge_stats {
+	/*! private pages hashed, and passes completed over processes */
+	uint64_t nscanned, npasses;
+	/*! private pages merged away into shared pages, or the zero page */
+	uint64_t nmerged, nmergedzero;
+	/*! time spent scanning, in ns */
+	uint64_t scan_ns;
+	/*! shared pages now, and mappings of them */
+	size_t npages, nsharing;
+};
+
+/*!
+ * @brief Scan up to \p npages pages of a process' private anonymous memory
+ * for pages to merge.
+ *
+ * Scanning carries on from where the last call left off, and wraps around at
+ * the end of the address space. A page must be seen unchanged on two passes
+ * before it is merged, so a caller wanting pages merged steadily but cheaply
+ * calls this now and then, with a small batch.
+ *
+ * @returns Number of private pages merged away.
+ * @pre PFNDB lock must not be held.
+ */
+size_t vm_ps_merge_scan(vmp_procstate_t *vmps, size_t npages);
+
+/*! @brief Get the statistics of same-page merging. */
+void vm_merge_get_stats(struct vm_merge_stats *stats);
+
+/*! Statistics of migration between memory tiers. */
+struct vm_tier_stats {
+	/*! aging passes over working sets */
+	uint64_t npasses;
+	/*! pages moved down to the slow tier, and up to the fast tier */
+	uint64_t ndemoted, npromoted;
+	/*! hot pages left in the slow tier for want of free fast memory */
+	uint64_t nnoroom;
+	/*! time spent aging and migrating, in ns */
+	uint64_t migrate_ns;
+	/*! pages of each tier, and of them free */
+	size_t npages[kVMTierMax], nfree[kVMTierMax];
+};
+
+/*!
+ * @brief Age the working set of a process and migrate up to \p npages pages
+ * of it in each direction between memory tiers.
+ *
+ * Each call is an aging pass: a working set page accessed since the last pass
+ * has its age reset to 0, and any other page ages by one. Pages of the slow
+ * tier found accessed by this pass and the last are promoted into fast memory.
+ * Pages of the fast tier aged vm_tier_cold_age or more are demoted, coldest
+ * first, but only as many as the promotions need for want of free fast
+ * memory. A migrated page is copied and its PTE rewritten in place; the
+ * process sees no fault. Only private anonymous pages mapped by nothing else
+ * are moved, and never pages of large pages.
+ *
+ * @returns Number of pages migrated.
+ * @pre PFNDB lock must not be held.
+ */
+size_t vm_ps_tier_migrate(vmp_procstate_t *vmps, size_t npages);
+
+/*! @brief Get the statistics of migration between memory tiers. */
+void vm_tier_get_stats(struct vm_tier_stats *stats);
+
+/*! Statistics of memory compaction. */
+struct vm_compact_stats {
+	/*! compaction passes, and those run on demand by an allocation */
+	uint64_t npasses, ndemand;
+	/*! blocks in use that passes came to, and of them emptied */
+	uint64_t nblocks, nblocksfreed;
+	/*! of those, blocks left for holding a page that can't be moved */
+	uint64_t nunmovable;
+	/*! pages migrated */
+	uint64_t nmigrated;
+	/*! time spent compacting, in ns */
+	uint64_t compact_ns;
+};
+
+/*!
+ * @brief Compact physical memory, emptying aligned blocks of \p block_pages
+ * pages by migrating the pages in them to free pages higher up the same
+ * region.
+ *
+ * Only blocks that every page of is free or movable are emptied, and only by
+ * filling blocks already partly in use, so that each block emptied is one more
+ * run free for vmp_page_alloc_contig_locked(). Movable pages are private
+ * anonymous pages that are either mapped by their PTE alone or on the standby
+ * or modified queues; a mapped page's PTE is rewritten in place, so its
+ * process sees no fault. A pass stops once it has migrated \p max_pages pages.
+ *
+ * @returns Number of blocks emptied.
+ * @pre PFNDB lock must not be held. \p block_pages is a power of two.
+ */
+size_t vm_compact(size_t block_pages, size_t max_pages);
+
+/*! @brief Get the statistics of memory compaction. */
+void vm_compact_get_stats(struct vm_compact_stats *stats);
+
 /*!
  * @brief Get the page frame structure for a given physical address.
  */
 vm_page_t *vm_paddr_to_page(paddr_t paddr);
 
-/*! Allocate anonymous memory in a process. */
+/*!
+ * @brief Get VM statistics, summed over all CPUs.
+ *
+ * This takes no lock, so may catch some CPU part-way through a change of
+ * several counters; use vm_stat_get_exact() for a consistent snapshot.
+ */
+void vm_stat_get(struct vm_stat *stat);
+
+/*!
+ * @brief Get a consistent snapshot of VM statistics.
+ *
+ * Counters change together with the page state they describe, which is under
+ * the PFNDB lock; so summing them under it gives an exact snapshot.
+ *
+ * @pre PFNDB lock must not be held.
+ */
+void vm_stat_get_exact(struct vm_stat *stat);
+
+/*! @brief Initialise an account with nothing charged to it. */
+void vm_account_init(vm_account_t *account);
+
+/*!
+ * @brief Get the pages allocated to and wired by an account.
+ *
+ * Exact if the PFNDB lock is held; either pointer may be NULL.
+ */
+void vm_account_get(vm_account_t *account, size_t *nalloced, size_t *nwires);
+
+/*! Initialise a process' VM state. */
+int vm_ps_init(vmp_procstate_t *vmps);
+
+/*!
+ * @brief Destroy a process' VM state, freeing everything it holds.
+ *
+ * This is a fast path for process exit: the pagetables are swept once, with no
+ * per-PTE bookkeeping, and the account is credited once at the end.
+ *
+ * @pre No thread is running in the process.
+ */
+int vm_ps_destroy(vmp_procstate_t *vmps);
+
+/*!
+ * @brief Allocate anonymous memory in a process.
+ *
+ * If \p populate, the memory is made resident up front, as by
+ * vm_ps_map_section_view().
+ */
 int vm_ps_allocate(vmp_procstate_t *vmps, vaddr_t *vaddrp, size_t size,
-    bool exact);
+    bool exact, bool populate);
 
-/*! Map a section view into a process. */
+/*! Deallocate all VADs within [start, start + size) of a process. */
+int vm_ps_deallocate(vmp_procstate_t *vmps, vaddr_t start, size_t size);
+
+/*!
+ * @brief Map a section view into a process.
+ *
+ * If \p populate, the view is made resident before returning, in bulk, rather
+ * than faulted in a page at a time as it is first touched. That is as much of
+ * it as memory allows; the rest is faulted in as usual.
+ */
 int vm_ps_map_section_view(vmp_procstate_t *vmps, void *section,
     vaddr_t *vaddrp, size_t size, off_t offset,
     vm_protection_t initial_protection, vm_protection_t max_protection,
-    bool inherit_shared, bool cow, bool exact);
+    bool inherit_shared, bool cow, bool exact, bool populate);
+
+/*! Advice on how a range of a process' memory is to be accessed. */
+enum vm_advice {
+	/*! no particular pattern; hard faults read a little ahead */
+	kVMAdviceNormal,
+	/*!
+	 * read in order; hard faults read further ahead, and pages a window
+	 * behind each fault are evicted from the working set early
+	 */
+	kVMAdviceSequential,
+	/*! read in no order; hard faults read the faulting page alone */
+	kVMAdviceRandom,
+	/*! needed soon: bring the range in now */
+	kVMAdviceWillNeed,
+	/*! not needed: discard the contents, which then read as zero */
+	kVMAdviceDontNeed,
+	/*! not needed soon: evict and reclaim the range before anything else */
+	kVMAdviceCold,
+};
+
+/*!
+ * @brief Advise the VM how [vaddr, vaddr + length) of a process is to be
+ * accessed.
+ *
+ * Normal, sequential and random advice is kept by each mapping the range
+ * touches, for the whole of the mapping, and governs its faults from then on.
+ * The rest is acted on at once and not kept: will-need brings in what memory
+ * allows without reclaiming for pages in the pagefile, making untouched
+ * anonymous pages resident as vm_ps_map_section_view() populates them and
+ * leaving paged-out ones on the standby queue; don't-need frees the range's
+ * pages and pagefile slots, writing nothing back; cold moves its working set
+ * pages to be evicted next, and its standby and modified pages to be
+ * reclaimed next.
+ *
+ * @returns 0, or -1 if part of the range isn't mapped, in which case the
+ * advice is still applied to the parts that are.
+ */
+int vm_ps_advise(vmp_procstate_t *vmps, vaddr_t vaddr, size_t length,
+    enum vm_advice advice);
+
+/*!
+ * @brief Copy out a CPU's ring of VM trace events, oldest first.
+ *
+ * Events being recorded meanwhile may be torn, so disable tracing first.
+ *
+ * @param events Space for VM_TRACE_RING_SIZE events.
+ * @param nlost Set to the number of events overwritten before this call.
+ * @returns Number of events copied.
+ */
+size_t vm_trace_read_ring(unsigned cpu, struct vm_trace_event *events,
+    uint64_t *nlost);
+
+/*!
+ * @brief Get the fault statistics of a process, or of the system if \p vmps
+ * is NULL.
+ *
+ * The system-wide statistics are gathered without a lock, so may catch some
+ * CPU part-way through recording a fault.
+ */
+void vm_ps_query_stats(vmp_procstate_t *vmps, struct vm_fault_stats *stats);
+
+/*!
+ * @brief Print fault statistics of a process, or of the system if \p vmps is
+ * NULL.
+ */
+void vm_ps_dump_stats(vmp_procstate_t *vmps);
+
+/*!
+ * @brief Get an upper bound on the \p pct'th percentile of a fault latency
+ * histogram; 0 if it is empty.
+ */
+uint64_t vm_fault_hist_percentile(const uint64_t *hist, double pct);
+
+enum vm_snapshot_format {
+	kVMSnapshotJSON,
+	/*! one row per metric: scope,process,start,end,metric,value */
+	kVMSnapshotCSV,
+};
+
+/*! Receives the text of a snapshot, piece by piece. */
+typedef void (*vm_snapshot_writer_t)(void *context, const char *text,
+    size_t len);
+
+/*!
+ * @brief Write a snapshot of memory use.
+ *
+ * This covers the global page counts by state and by use, and for each of
+ * \p procs its resident, dirty, transition, swapped and compressed pages,
+ * working set, pagetable and account totals, and the same page counts for each
+ * of its VADs. Each process' pagetables are walked just once. \p writer is
+ * called with no VM lock held.
+ *
+ * @returns 0, or -1 if memory for the snapshot ran out.
+ * @pre PFNDB lock not held.
+ */
+int vm_snapshot(vmp_procstate_t **procs, size_t nprocs,
+    enum vm_snapshot_format format, vm_snapshot_writer_t writer,
+    void *context);
+
+/*! Longest key of a prefetch record, including the NUL. */
+#define VM_PREFETCH_KEY_MAX 32
+/*! Most faults a prefetch record holds. */
+#define VM_PREFETCH_MAX_PAGES 1024
+
+/*!
+ * @brief Record the first \p npages faults of a process, to be saved as the
+ * prefetch record of \p key (typically the image it runs).
+ *
+ * The record is saved once \p npages faults are recorded, or earlier by
+ * vm_ps_prefetch_save(), replacing any earlier record of the same key.
+ *
+ * @returns 0, or -1 if memory ran out or \p npages exceeds
+ * VM_PREFETCH_MAX_PAGES.
+ */
+int vm_ps_prefetch_record(vmp_procstate_t *vmps, const char *key,
+    size_t npages);
+
+/*!
+ * @brief Stop recording a process' faults, and save what was recorded so far;
+ * does nothing if none are being recorded.
+ */
+void vm_ps_prefetch_save(vmp_procstate_t *vmps);
+
+/*!
+ * @brief Bring in the pages of the prefetch record of \p key, ahead of the
+ * process faulting on them.
+ *
+ * This is done in one pass under the process' mutex. Pages in the pagefile
+ * are read back in clusters of consecutive slots; untouched anonymous pages
+ * are zero-filled, or get the zero page if they were only read. Pages enter
+ * the working set while it has room; those read in beyond that are left on
+ * the standby queue, so that faulting on them is soft.
+ *
+ * @returns Number of pages brought in, or -1 if \p key has no record.
+ * @pre PFNDB lock not held.
+ */
+int vm_ps_prefetch(vmp_procstate_t *vmps, const char *key);
+
+/*!
+ * Memory descriptor list: the pages backing a range of a process' memory,
+ * each wired with a reference, so that I/O can go directly to or from them.
+ */
+typedef struct vm_mdl {
+	/*! the process, whose account is charged the wires */
+	vmp_procstate_t *vmps;
+	/*! offset of the range into its first page, and its length in bytes */
+	size_t offset, length;
+	/*! whether the I/O writes to the pages */
+	bool write;
+	/*! number of pages, and the pages in order */
+	size_t	   npages;
+	vm_page_t *pages[0];
+} vm_mdl_t;
+
+/*!
+ * @brief Wire the pages of [vaddr, vaddr + length) of a process, faulting in
+ * any not resident, and describe them in an MDL.
+ *
+ * This is done in one pass under the process' mutex. If \p write, each page
+ * is faulted in writeable, so that it is private to the process, and is marked
+ * dirty on release. A wired page stays resident, and keeps its frame, even if
+ * it leaves the working set; it is unwired by vm_mdl_release(), which must be
+ * called before the process is destroyed.
+ *
+ * @returns The MDL, or NULL if memory ran out, the range is empty, or any of it
+ * is not private anonymous memory allowing the access.
+ * @pre PFNDB lock not held.
+ */
+vm_mdl_t *vm_mdl_build(vmp_procstate_t *vmps, vaddr_t vaddr, size_t length,
+    bool write);
+
+/*! @brief Unwire the pages of an MDL, and free it. */
+void vm_mdl_release(vm_mdl_t *mdl);
 
 /*! Dump the VAD tree of a process.*/
 int vm_ps_dump_vadtree(vmp_procstate_t *vmps);
@@ -191,7 +660,21 @@ vm_page_direct_map_addr(vm_page_t *page)
 	return P2V(vm_page_paddr(page));
 }
 
-extern struct vm_stat vmstat;
-extern vm_account_t   general_account, deleted_account;
+/*! @brief Physical address of byte \p offset of the range an MDL describes. */
+static inline paddr_t
+vm_mdl_paddr(vm_mdl_t *mdl, size_t offset)
+{
+	offset += mdl->offset;
+	return vm_page_paddr(mdl->pages[offset / PGSIZE]) + offset % PGSIZE;
+}
+
+extern vm_account_t general_account, deleted_account;
+/*! Aging passes unaccessed before a page of the fast tier counts as cold. */
+extern unsigned vm_tier_cold_age;
+/*!
+ * Whether VM events are recorded into the trace rings. Has no effect unless
+ * the kernel was built with KRX_VM_TRACE.
+ */
+extern bool vm_trace_enabled;
 
 #endif /* KRX_KDK_VM_H */
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file vm_trace.h
+ * @brief Binary format of VM trace events and trace files.
+ *
+ * This is shared between the kernel, which records events into per-CPU rings,
+ * and the host-side decoder, so it depends on nothing port-specific.
+ */
+
+#ifndef KRX_KDK_VM_TRACE_H
+#define KRX_KDK_VM_TRACE_H
+
+#include <stdint.h>
+
+/*! Events each CPU's ring holds; a power of two. */
+#define VM_TRACE_RING_SIZE 4096
+
+/*! "KRXVMTR1" read as a little-endian integer. */
+#define VM_TRACE_MAGIC 0x3152544d5658524bULL
+#define VM_TRACE_VERSION 1
+
+enum vm_trace_type {
+	/*! detail is 1 for a write fault */
+	kVMTraceFaultBegin,
+	/*! detail is the vm_fault_kind, arg the latency in ns */
+	kVMTraceFaultEnd,
+	/*! addr is the PFN, detail the new vm_page_use */
+	kVMTracePageAlloc,
+	/*! addr is the PFN, detail the vm_page_use it had */
+	kVMTracePageFree,
+	kVMTraceWSInsert,
+	kVMTraceWSEvict,
+	/*! addr is the start and arg the end of the range unmapped */
+	kVMTraceUnmap,
+	kVMTraceMax,
+};
+
+struct vm_trace_event {
+	/*! monotonic time, in ns */
+	uint64_t timestamp;
+	/*! process' identity (its vmp_procstate_t address), or 0 */
+	uint64_t proc;
+	/*! virtual address or PFN, as per type */
+	uint64_t addr;
+	/*! as per type */
+	uint64_t arg;
+	uint16_t type;
+	uint16_t cpu;
+	uint32_t detail;
+};
+
+/*!
+ * A trace file is this header, then for each of nrings rings a struct
+ * vm_trace_file_ring followed by its nevents events, oldest first.
+ */
+struct vm_trace_file_header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t event_size;
+	uint32_t nrings;
+	uint32_t ring_size;
+};
+
+struct vm_trace_file_ring {
+	uint32_t cpu;
+	uint32_t nevents;
+	/*! events overwritten before they could be saved */
+	uint64_t nlost;
+};
+
+#endif /* KRX_KDK_VM_TRACE_H */
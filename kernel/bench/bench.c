@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+uint64_t
+bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+bench_begin(struct bench *bench, const char *name)
+{
+	memset(bench, 0x0, sizeof(*bench));
+	bench->name = name;
+}
+
+void
+bench_sample(struct bench *bench, uint64_t ns, size_t nops)
+{
+	if (bench->nsamples == bench->capacity) {
+		bench->capacity = bench->capacity == 0 ? 1024 :
+							 bench->capacity * 2;
+		bench->samples = realloc(bench->samples,
+		    sizeof(*bench->samples) * bench->capacity);
+		if (bench->samples == NULL)
+			kfatal("Failed to allocate benchmark samples\n");
+	}
+
+	bench->samples[bench->nsamples++] = (double)ns / nops;
+	bench->nops += nops;
+	bench->total_ns += ns;
+}
+
+static int
+sample_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double
+percentile(struct bench *bench, double pct)
+{
+	size_t i = (size_t)(bench->nsamples * pct / 100);
+
+	if (i >= bench->nsamples)
+		i = bench->nsamples - 1;
+	return bench->samples[i];
+}
+
+void
+bench_end(struct bench *bench)
+{
+	kassert(bench->nsamples > 0);
+
+	qsort(bench->samples, bench->nsamples, sizeof(*bench->samples),
+	    sample_cmp);
+
+	fprintf(stderr,
+	    "bench %-22s ops %-9" PRIu64 " ops/s %-12.0f p50 %-9.1f p99 %.1f\n",
+	    bench->name, bench->nops, bench->nops * 1e9 / bench->total_ns,
+	    percentile(bench, 50), percentile(bench, 99));
+
+	free(bench->samples);
+	bench->samples = NULL;
+}
+
+uint64_t
+bench_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+void
+bench_setup(size_t pmem_kib, vmp_procstate_t *vmps)
+{
+	soft_pmem_init(pmem_kib * 1024, 0);
+	vm_ps_init(vmps);
+	SIM_vmps = vmps;
+	SIM_cr3 = vm_page_paddr(vmps->md.top);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file bench.h
+ * @brief Measurement harness shared by the benchmark suites.
+ *
+ * A benchmark records samples, each the time taken by some number of
+ * operations; operations too cheap to time one at a time are timed in
+ * batches, a sample then giving their mean. bench_end() reports one line:
+ *
+ *	bench <name> ops <n> ops/s <rate> p50 <ns> p99 <ns>
+ *
+ * on stderr, percentiles being of the per-operation time of the samples.
+ */
+
+#ifndef KRX_BENCH_BENCH_H
+#define KRX_BENCH_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kdk/vm.h"
+
+struct bench {
+	const char *name;
+	/*! per-operation time of each sample, in ns */
+	double *samples;
+	size_t	nsamples, capacity;
+	/*! operations, and the time they took in all, in ns */
+	uint64_t nops, total_ns;
+};
+
+/*! @brief Get a monotonic time, in nanoseconds. */
+uint64_t bench_now(void);
+
+/*! @brief Start a benchmark. */
+void bench_begin(struct bench *bench, const char *name);
+
+/*! @brief Record \p nops operations as having taken \p ns all together. */
+void bench_sample(struct bench *bench, uint64_t ns, size_t nops);
+
+/*! @brief Report a benchmark's results and free its samples. */
+void bench_end(struct bench *bench);
+
+/*! @brief Advance an xorshift64* generator and return its next value. */
+uint64_t bench_rand(uint64_t *state);
+
+/*!
+ * @brief Set up simulated memory and a process to run in on this thread.
+ *
+ * @param pmem_kib KiB of simulated physical memory.
+ */
+void bench_setup(size_t pmem_kib, vmp_procstate_t *vmps);
+
+#endif /* KRX_BENCH_BENCH_H */
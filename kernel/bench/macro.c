@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file macro.c
+ * @brief Macrobenchmarks of whole VM paths through the simulated MMU.
+ *
+ * - first-touch-seq and first-touch-rand: write every page of a fresh region,
+ *   in order or in a fixed-seed random order, each access being a demand-zero
+ *   fault.
+ * - map-unmap-churn: allocate a small region, write all of it and deallocate
+ *   it, over and over.
+ * - ws-thrash: cycle through a region four times the size of the working set,
+ *   so that every access evicts a page and soft-faults another back in.
+ *
+ * Every access or cycle is timed on its own.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+static vmp_procstate_t ps;
+static size_t	       region_pages = 1024, nrounds = 8, churn_pages = 16;
+static vaddr_t	       region_base = PGSIZE;
+static uint64_t	       seed = 0x5eed;
+
+static void
+bench_first_touch(const char *name, bool random)
+{
+	struct bench bench;
+	size_t	    *order = calloc(region_pages, sizeof(*order));
+	uint64_t     rng = seed;
+
+	kassert(order != NULL);
+	for (size_t i = 0; i < region_pages; i++)
+		order[i] = i;
+	if (random) {
+		for (size_t i = region_pages - 1; i > 0; i--) {
+			size_t j = bench_rand(&rng) % (i + 1), tmp = order[i];
+			order[i] = order[j];
+			order[j] = tmp;
+		}
+	}
+
+	bench_begin(&bench, name);
+	for (size_t round = 0; round < nrounds; round++) {
+		vaddr_t vaddr = region_base;
+
+		vm_ps_allocate(&ps, &vaddr, region_pages * PGSIZE, true, false);
+		for (size_t i = 0; i < region_pages; i++) {
+			uint64_t start = bench_now();
+
+			soft_mmu_access(region_base + order[i] * PGSIZE, true);
+			bench_sample(&bench, bench_now() - start, 1);
+		}
+		vm_ps_deallocate(&ps, region_base, region_pages * PGSIZE);
+	}
+	bench_end(&bench);
+
+	free(order);
+}
+
+static void
+bench_map_unmap_churn(void)
+{
+	struct bench bench;
+
+	bench_begin(&bench, "map-unmap-churn");
+	for (size_t i = 0; i < nrounds * region_pages / churn_pages; i++) {
+		uint64_t start = bench_now();
+		vaddr_t	 vaddr = region_base;
+
+		vm_ps_allocate(&ps, &vaddr, churn_pages * PGSIZE, true, false);
+		for (size_t pg = 0; pg < churn_pages; pg++)
+			soft_mmu_access(region_base + pg * PGSIZE, true);
+		vm_ps_deallocate(&ps, region_base, churn_pages * PGSIZE);
+		bench_sample(&bench, bench_now() - start, 1);
+	}
+	bench_end(&bench);
+}
+
+static void
+bench_ws_thrash(void)
+{
+	struct bench bench;
+	size_t	     ws_max = ps.ws_max_count;
+	vaddr_t	     vaddr = region_base;
+
+	vm_ps_allocate(&ps, &vaddr, region_pages * PGSIZE, true, false);
+	ps.ws_max_count = region_pages / 4;
+	/* fault everything in once, so that the timed passes are soft faults */
+	for (size_t pg = 0; pg < region_pages; pg++)
+		soft_mmu_access(region_base + pg * PGSIZE, true);
+
+	bench_begin(&bench, "ws-thrash");
+	for (size_t round = 0; round < nrounds; round++) {
+		for (size_t pg = 0; pg < region_pages; pg++) {
+			uint64_t start = bench_now();
+
+			soft_mmu_access(region_base + pg * PGSIZE, false);
+			bench_sample(&bench, bench_now() - start, 1);
+		}
+	}
+	bench_end(&bench);
+
+	vm_ps_deallocate(&ps, region_base, region_pages * PGSIZE);
+	ps.ws_max_count = ws_max;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-r region pages] [-n rounds] [-c churn pages] "
+	    "[-S seed]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "r:n:c:S:")) != -1) {
+		switch (c) {
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			nrounds = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			churn_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (region_pages < 4 || nrounds == 0 || churn_pages == 0 ||
+	    churn_pages > region_pages)
+		usage(argv[0]);
+
+	/*
+	 * room for the region, its pagetables, working set entries and the PFN
+	 * database
+	 */
+	bench_setup((region_pages * 3 * PGSIZE) / 1024 + 64, &ps);
+	ps.ws_max_count = region_pages;
+
+	bench_first_touch("first-touch-seq", false);
+	bench_first_touch("first-touch-rand", true);
+	bench_map_unmap_churn();
+	bench_ws_thrash();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file mdl.c
+ * @brief Wiring throughput benchmark for memory descriptor lists.
+ *
+ * Wires an anonymous buffer for I/O, and unwires it, over and over until a
+ * total of 1 GiB (by default) has been wired: once a page at a time through
+ * vmp_fault() (wire-fault), and once with vm_mdl_build() (wire-mdl). The soft
+ * port's address space is far smaller than that, hence the repetition. Each
+ * pass is a sample and each page an operation; the first pass faults the
+ * buffer in, so is reported apart from the rest as the -first benchmark.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+static vmp_procstate_t ps;
+static size_t	       buffer_pages = 2048, total_mib = 1024;
+static vaddr_t	       buffer_base = PGSIZE;
+
+/* wire and unwire the buffer a page at a time */
+static void
+wire_by_fault(vm_page_t **pages)
+{
+	ipl_t ipl;
+
+	for (size_t pg = 0; pg < buffer_pages; pg++)
+		vmp_fault(buffer_base + pg * PGSIZE, true, &ps.account,
+		    &pages[pg]);
+
+	ipl = vmp_acquire_pfn_lock();
+	for (size_t pg = 0; pg < buffer_pages; pg++)
+		vmp_page_release_locked(pages[pg], &ps.account);
+	vmp_release_pfn_lock(ipl);
+}
+
+static void
+wire_by_mdl(vm_page_t **pages)
+{
+	vm_mdl_t *mdl = vm_mdl_build(&ps, buffer_base, buffer_pages * PGSIZE,
+	    true);
+
+	kassert(mdl != NULL);
+	vm_mdl_release(mdl);
+}
+
+static void
+bench_wire(const char *first_name, const char *name,
+    void (*wire)(vm_page_t **))
+{
+	struct bench bench;
+	vm_page_t  **pages = calloc(buffer_pages, sizeof(*pages));
+	vaddr_t	     vaddr = buffer_base;
+	size_t	     npasses;
+	uint64_t     start;
+
+	kassert(pages != NULL);
+	vm_ps_allocate(&ps, &vaddr, buffer_pages * PGSIZE, true, false);
+
+	npasses = (total_mib << 20) / (buffer_pages * PGSIZE);
+	if (npasses < 2)
+		npasses = 2;
+
+	bench_begin(&bench, first_name);
+	start = bench_now();
+	wire(pages);
+	bench_sample(&bench, bench_now() - start, buffer_pages);
+	bench_end(&bench);
+
+	bench_begin(&bench, name);
+	for (size_t i = 1; i < npasses; i++) {
+		start = bench_now();
+		wire(pages);
+		bench_sample(&bench, bench_now() - start, buffer_pages);
+	}
+	bench_end(&bench);
+
+	vm_ps_deallocate(&ps, buffer_base, buffer_pages * PGSIZE);
+	free(pages);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-r buffer pages] [-t total MiB wired] [-m pmem KiB]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t pmem_kib = 0;
+	int    c;
+
+	while ((c = getopt(argc, argv, "r:t:m:")) != -1) {
+		switch (c) {
+		case 'r':
+			buffer_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			total_mib = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (buffer_pages == 0 || buffer_base + buffer_pages * PGSIZE >
+	    (1UL << (PGSHIFT + 3 * SOFT_LEVEL_BITS)))
+		usage(argv[0]);
+
+	/*
+	 * room for the buffer, its pagetables, working set entries and the PFN
+	 * database
+	 */
+	if (pmem_kib == 0)
+		pmem_kib = (buffer_pages * 3 * PGSIZE) / 1024 + 64;
+
+	bench_setup(pmem_kib, &ps);
+	/* keep everything resident; eviction isn't what's measured */
+	ps.ws_max_count = buffer_pages;
+
+	bench_wire("wire-fault-first", "wire-fault", wire_by_fault);
+	bench_wire("wire-mdl-first", "wire-mdl", wire_by_mdl);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file micro.c
+ * @brief Microbenchmarks of VM primitives.
+ *
+ * Each primitive is called directly, with the locks it expects, on state set
+ * up beforehand: page allocation and freeing, PFN database lookup, PTE
+ * fetching, VAD lookup, working set insertion and removal, insertion into a
+ * full working set and so eviction, and unmapping of a populated range. Cheap operations are timed in batches. Addresses and
+ * PFNs come from a fixed-seed generator, so runs are comparable.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+#define BATCH 64
+
+static vmp_procstate_t ps;
+static vm_account_t    account;
+static size_t	       niters = 20000, region_pages = 256, nvads = 256;
+static vaddr_t	       region_base = PGSIZE;
+static uint64_t	       seed = 0x5eed;
+
+static void
+populate(vaddr_t base, size_t npages)
+{
+	vaddr_t vaddr = base;
+
+	vm_ps_allocate(&ps, &vaddr, npages * PGSIZE, true, false);
+	for (size_t pg = 0; pg < npages; pg++)
+		soft_mmu_access(base + pg * PGSIZE, true);
+}
+
+static void
+bench_page_alloc_free(void)
+{
+	struct bench bench;
+
+	vm_account_init(&account);
+
+	bench_begin(&bench, "page-alloc-free");
+	for (size_t i = 0; i < niters; i += BATCH) {
+		uint64_t start = bench_now();
+		ipl_t	 ipl = vmp_acquire_pfn_lock();
+
+		for (size_t j = 0; j < BATCH; j++) {
+			vm_page_t *page;
+			int	   r;
+
+			r = vmp_page_alloc_locked(&page, &account,
+			    kPageUseAnonPrivate, false);
+			kassert(r == 0);
+			vmp_page_delete_locked(page, &account, true);
+		}
+		vmp_release_pfn_lock(ipl);
+		bench_sample(&bench, bench_now() - start, BATCH);
+	}
+	bench_end(&bench);
+}
+
+static void
+bench_paddr_to_page(void)
+{
+	struct bench	   bench;
+	struct vm_stat	   stat;
+	uint64_t	   rng = seed;
+	size_t		   npages;
+	volatile uintptr_t sink = 0;
+
+	vm_stat_get(&stat);
+	npages = stat.npwired + stat.nactive + stat.nfree + stat.nmodified +
+	    stat.nstandby + stat.nptcached;
+
+	bench_begin(&bench, "paddr-to-page");
+	for (size_t i = 0; i < niters * 4; i += BATCH) {
+		uint64_t start = bench_now();
+
+		for (size_t j = 0; j < BATCH; j++)
+			sink += (uintptr_t)vm_paddr_to_page(
+			    PFN_TO_PADDR(bench_rand(&rng) % npages));
+		bench_sample(&bench, bench_now() - start, BATCH);
+	}
+	bench_end(&bench);
+}
+
+static void
+bench_pte_fetch(void)
+{
+	struct bench bench;
+	uint64_t     rng = seed;
+
+	populate(region_base, region_pages);
+
+	bench_begin(&bench, "pte-fetch");
+	for (size_t i = 0; i < niters * 4; i += BATCH) {
+		uint64_t start = bench_now();
+		ipl_t	 ipl = vmp_acquire_pfn_lock();
+
+		for (size_t j = 0; j < BATCH; j++) {
+			vaddr_t vaddr = region_base +
+			    (bench_rand(&rng) % region_pages) * PGSIZE;
+			pte_t  *pte;
+			int	r;
+
+			r = vmp_mp_fetch_pte(&ps, vaddr, &pte, NULL);
+			kassert(r == 0);
+		}
+		vmp_release_pfn_lock(ipl);
+		bench_sample(&bench, bench_now() - start, BATCH);
+	}
+	bench_end(&bench);
+
+	vm_ps_deallocate(&ps, region_base, region_pages * PGSIZE);
+}
+
+static void
+bench_vad_find(void)
+{
+	struct bench bench;
+	uint64_t     rng = seed;
+
+	/* one-page VADs with a page's gap between each */
+	for (size_t i = 0; i < nvads; i++) {
+		vaddr_t vaddr = region_base + i * 2 * PGSIZE;
+		vm_ps_allocate(&ps, &vaddr, PGSIZE, true, false);
+	}
+
+	bench_begin(&bench, "vad-find");
+	for (size_t i = 0; i < niters * 4; i += BATCH) {
+		uint64_t start = bench_now();
+
+		ke_wait(&ps.mutex, "bench:ps.mutex", false, false, -1);
+		for (size_t j = 0; j < BATCH; j++) {
+			vaddr_t vaddr = region_base +
+			    (bench_rand(&rng) % nvads) * 2 * PGSIZE;
+
+			kassert(vmp_ps_vad_find(&ps, vaddr) != NULL);
+		}
+		ke_mutex_release(&ps.mutex);
+		bench_sample(&bench, bench_now() - start, BATCH);
+	}
+	bench_end(&bench);
+
+	vm_ps_deallocate(&ps, region_base, nvads * 2 * PGSIZE);
+}
+
+static void
+bench_ws_insert_remove(void)
+{
+	struct bench bench;
+
+	bench_begin(&bench, "ws-insert-remove");
+	for (size_t i = 0; i < niters; i += BATCH) {
+		uint64_t start = bench_now();
+		ipl_t	 ipl;
+
+		ke_wait(&ps.mutex, "bench:ps.mutex", false, false, -1);
+		ipl = vmp_acquire_pfn_lock();
+		for (size_t j = 0; j < BATCH; j++)
+			vmp_wsl_insert(&ps, region_base + j * PGSIZE);
+		for (size_t j = 0; j < BATCH; j++)
+			vmp_wsl_remove(&ps, region_base + j * PGSIZE);
+		vmp_release_pfn_lock(ipl);
+		ke_mutex_release(&ps.mutex);
+		bench_sample(&bench, bench_now() - start, BATCH);
+	}
+	bench_end(&bench);
+}
+
+/*
+ * Make pages evicted from the working set valid again, as a soft fault
+ * would, but without putting them back in it.
+ * \pre PFN lock held
+ */
+static void
+restore_evicted(vaddr_t base, size_t npages)
+{
+	for (size_t pg = 0; pg < npages; pg++) {
+		vm_page_t *page;
+		pte_t	  *pte;
+		int	   r;
+
+		r = vmp_mp_fetch_pte(&ps, base + pg * PGSIZE, &pte, NULL);
+		kassert(r == 0 && vmp_md_pte_is_trans(pte));
+		page = vmp_md_pte_page(pte);
+		vmp_page_retain_locked(page, &ps.account);
+		vmp_md_pte_make_hw(pte, page->pfn, false);
+	}
+}
+
+static void
+bench_ws_insert_evict(void)
+{
+	struct bench bench;
+	size_t	     ws_max = ps.ws_max_count;
+	vaddr_t	     half[2] = { region_base, region_base + BATCH * PGSIZE };
+	ipl_t	     ipl;
+
+	/*
+	 * a full working set of BATCH pages, and BATCH more mapped but outside
+	 * it; each insertion of one of those evicts one of the others. the
+	 * halves then swap places, the evicted half being made valid again
+	 * untimed.
+	 */
+	populate(region_base, BATCH * 2);
+	ps.ws_max_count = BATCH;
+	ke_wait(&ps.mutex, "bench:ps.mutex", false, false, -1);
+	ipl = vmp_acquire_pfn_lock();
+	vmp_wsl_remove_range(&ps, half[1], half[1] + BATCH * PGSIZE);
+	vmp_release_pfn_lock(ipl);
+	ke_mutex_release(&ps.mutex);
+
+	bench_begin(&bench, "ws-insert-evict");
+	for (size_t i = 0; i < niters; i += BATCH) {
+		vaddr_t	 in = half[(i / BATCH + 1) % 2];
+		vaddr_t	 out = half[i / BATCH % 2];
+		uint64_t start;
+
+		ke_wait(&ps.mutex, "bench:ps.mutex", false, false, -1);
+		ipl = vmp_acquire_pfn_lock();
+		start = bench_now();
+		for (size_t j = 0; j < BATCH; j++)
+			vmp_wsl_insert(&ps, in + j * PGSIZE);
+		bench_sample(&bench, bench_now() - start, BATCH);
+		restore_evicted(out, BATCH);
+		vmp_release_pfn_lock(ipl);
+		ke_mutex_release(&ps.mutex);
+	}
+	bench_end(&bench);
+
+	vm_ps_deallocate(&ps, region_base, BATCH * 2 * PGSIZE);
+	ps.ws_max_count = ws_max;
+}
+
+static void
+bench_range_unmap(void)
+{
+	struct bench bench;
+	size_t	     npages = 16;
+
+	bench_begin(&bench, "range-unmap-16");
+	for (size_t i = 0; i < niters / 16; i++) {
+		uint64_t start;
+
+		populate(region_base, npages);
+		start = bench_now();
+		vm_ps_deallocate(&ps, region_base, npages * PGSIZE);
+		bench_sample(&bench, bench_now() - start, 1);
+	}
+	bench_end(&bench);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-n iterations] [-r region pages] [-v VADs] "
+	    "[-S seed]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "n:r:v:S:")) != -1) {
+		switch (c) {
+		case 'n':
+			niters = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			nvads = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (niters < BATCH || region_pages < BATCH || nvads == 0)
+		usage(argv[0]);
+
+	/* room for the region or VADs, their pagetables, and the PFN database */
+	bench_setup(((region_pages + nvads * 2) * 3 * PGSIZE) / 1024 + 64,
+	    &ps);
+	/* keep everything resident; only ws-insert-evict measures eviction */
+	ps.ws_max_count = region_pages + nvads * 2;
+
+	bench_page_alloc_free();
+	bench_paddr_to_page();
+	bench_pte_fetch();
+	bench_vad_find();
+	bench_ws_insert_remove();
+	bench_ws_insert_evict();
+	bench_range_unmap();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file populate.c
+ * @brief Benchmark of populating anonymous memory as it is mapped.
+ *
+ * Maps an anonymous region and makes it resident, then unmaps it, over and
+ * over: once by writing each page, faulting it in (map-touch), and once by
+ * mapping it with the populate flag (map-populate). Each round is a sample and
+ * each page an operation. With -H, full leaf tables are promoted to large
+ * pages, or populated as them. The last region made resident is swept to
+ * check that no faults are left to take.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+static vmp_procstate_t ps;
+static size_t	       region_pages = 2048, nrounds = 200;
+static vaddr_t	       region_base = PGSIZE;
+
+static size_t
+nfaults(void)
+{
+	struct vm_stat stat;
+
+	vm_stat_get_exact(&stat);
+	return stat.nfaultzero + stat.nfaultwrite + stat.nfaulttrans +
+	    stat.nfaultpagein + stat.nfaultcollided + stat.nfaultzeropage +
+	    stat.nfaultzcache + stat.nfaultcow;
+}
+
+static void
+bench_map(const char *name, bool populate)
+{
+	struct bench bench;
+	size_t	     faults;
+
+	bench_begin(&bench, name);
+	for (size_t round = 0; round < nrounds; round++) {
+		vaddr_t	 vaddr = region_base;
+		uint64_t start;
+
+		if (round != 0)
+			vm_ps_deallocate(&ps, region_base,
+			    region_pages * PGSIZE);
+
+		/* only mapping and making resident is timed */
+		start = bench_now();
+		vm_ps_allocate(&ps, &vaddr, region_pages * PGSIZE, true,
+		    populate);
+		if (!populate)
+			for (size_t pg = 0; pg < region_pages; pg++)
+				soft_mmu_access(region_base + pg * PGSIZE,
+				    true);
+		bench_sample(&bench, bench_now() - start, region_pages);
+	}
+	bench_end(&bench);
+
+	faults = nfaults();
+	for (size_t pg = 0; pg < region_pages; pg++)
+		soft_mmu_access(region_base + pg * PGSIZE, true);
+	if (nfaults() != faults)
+		kfatal("%s: %zu faults on sweeping the last region\n", name,
+		    nfaults() - faults);
+
+	vm_ps_deallocate(&ps, region_base, region_pages * PGSIZE);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-r region pages] [-n rounds] [-m pmem KiB] [-H]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t pmem_kib = 0;
+	int    c;
+
+	while ((c = getopt(argc, argv, "r:n:m:H")) != -1) {
+		switch (c) {
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			nrounds = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		case 'H':
+			soft_large_pages_enabled = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (region_pages == 0 || nrounds == 0 ||
+	    region_base + region_pages * PGSIZE >
+		(1UL << (PGSHIFT + 3 * SOFT_LEVEL_BITS)))
+		usage(argv[0]);
+
+	/*
+	 * room for the region, its pagetables, working set entries and the PFN
+	 * database
+	 */
+	if (pmem_kib == 0)
+		pmem_kib = (region_pages * 3 * PGSIZE) / 1024 + 64;
+
+	bench_setup(pmem_kib, &ps);
+	/* keep everything resident; eviction isn't what's measured */
+	ps.ws_max_count = region_pages;
+
+	bench_map("map-touch", false);
+	bench_map("map-populate", true);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file ptcache.c
+ * @brief Map/unmap churn benchmark for the pagetable page cache.
+ *
+ * Repeatedly allocates an anonymous region, writes to it, and deallocates it,
+ * so that every cycle empties and refills the same pagetables. This is run
+ * once with the pagetable cache disabled (ptcache-uncached) and once with it
+ * enabled (ptcache-cached); each cycle is timed as one operation.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+static vmp_procstate_t ps;
+static size_t	       ncycles = 1000, region_pages = 64, stride = 1;
+static vaddr_t	       region_base = PGSIZE;
+
+static void
+bench_cycle(const char *name, size_t ptcache_max)
+{
+	struct bench bench;
+	ipl_t	     ipl;
+
+	ipl = vmp_acquire_pfn_lock();
+	vmp_ptcache_max = ptcache_max;
+	vmp_release_pfn_lock(ipl);
+
+	bench_begin(&bench, name);
+	for (size_t i = 0; i < ncycles; i++) {
+		uint64_t start = bench_now();
+		vaddr_t	 vaddr = region_base;
+
+		vm_ps_allocate(&ps, &vaddr, region_pages * PGSIZE, true, false);
+		for (size_t pg = 0; pg < region_pages; pg += stride)
+			soft_mmu_access(region_base + pg * PGSIZE, true);
+		vm_ps_deallocate(&ps, region_base, region_pages * PGSIZE);
+		bench_sample(&bench, bench_now() - start, 1);
+	}
+	bench_end(&bench);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-n cycles] [-r region pages] [-s stride pages] "
+	    "[-m pmem KiB]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t pmem_kib = 0;
+	int    c;
+
+	while ((c = getopt(argc, argv, "n:r:s:m:")) != -1) {
+		switch (c) {
+		case 'n':
+			ncycles = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			stride = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (ncycles == 0 || region_pages == 0 || stride == 0)
+		usage(argv[0]);
+
+	/*
+	 * room for the region, its pagetables, working set entries and the PFN
+	 * database
+	 */
+	if (pmem_kib == 0)
+		pmem_kib = (region_pages * 3 * PGSIZE) / 1024 + 64;
+
+	bench_setup(pmem_kib, &ps);
+	/* keep the whole region resident; eviction isn't what's measured */
+	ps.ws_max_count = region_pages;
+
+	bench_cycle("ptcache-uncached", 0);
+	bench_cycle("ptcache-cached", VMP_PTCACHE_DEFAULT_MAX);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file pwc.c
+ * @brief Pagetable walk benchmark for the paging-structure cache.
+ *
+ * Populates an anonymous region, then repeatedly looks up the PTE of every
+ * page in it with vmp_mp_fetch_pte(), as working set eviction and the fault
+ * path do. This is run once with the paging-structure cache disabled
+ * (pwc-uncached) and once with it enabled (pwc-cached); each pass over the
+ * region is a sample, each lookup an operation.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+static vmp_procstate_t ps;
+static size_t	       npasses = 1000, region_pages = 256;
+static vaddr_t	       region_base = PGSIZE;
+
+static void
+bench_walk(const char *name, bool enabled)
+{
+	struct bench bench;
+	ipl_t	     ipl;
+
+	ke_wait(&ps.mutex, "bench:ps.mutex", false, false, -1);
+	ipl = vmp_acquire_pfn_lock();
+	soft_pwc_enabled = enabled;
+
+	bench_begin(&bench, name);
+	for (size_t i = 0; i < npasses; i++) {
+		uint64_t start = bench_now();
+
+		for (size_t pg = 0; pg < region_pages; pg++) {
+			pte_t *pte;
+			int    r;
+
+			r = vmp_mp_fetch_pte(&ps, region_base + pg * PGSIZE,
+			    &pte, NULL);
+			kassert(r == 0 && vmp_md_pte_is_valid(pte));
+		}
+		bench_sample(&bench, bench_now() - start, region_pages);
+	}
+
+	vmp_release_pfn_lock(ipl);
+	ke_mutex_release(&ps.mutex);
+	bench_end(&bench);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-n passes] [-r region pages] [-m pmem KiB]\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t pmem_kib = 0;
+	int    c;
+
+	while ((c = getopt(argc, argv, "n:r:m:")) != -1) {
+		switch (c) {
+		case 'n':
+			npasses = strtoull(optarg, NULL, 0);
+			break;
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (npasses == 0 || region_pages == 0)
+		usage(argv[0]);
+
+	/*
+	 * room for the region, its pagetables, working set entries and the PFN
+	 * database
+	 */
+	if (pmem_kib == 0)
+		pmem_kib = (region_pages * 3 * PGSIZE) / 1024 + 64;
+
+	bench_setup(pmem_kib, &ps);
+	/* keep the whole region resident, so every PTE stays valid */
+	ps.ws_max_count = region_pages;
+
+	vm_ps_allocate(&ps, &region_base, region_pages * PGSIZE, true, false);
+	for (size_t pg = 0; pg < region_pages; pg++)
+		soft_mmu_access(region_base + pg * PGSIZE, false);
+
+	bench_walk("pwc-uncached", false);
+	bench_walk("pwc-cached", true);
+
+	return EXIT_SUCCESS;
+}
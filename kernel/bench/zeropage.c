@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file zeropage.c
+ * @brief Sparse-read benchmark for the shared zero page.
+ *
+ * Reads every stride'th page of a fresh anonymous region, then writes to a
+ * fraction of them, as a mostly-read calloc'd table might see. This is run
+ * once with read faults allocating private pages (zeropage-off-read and
+ * -write) and once with them mapping the zero page (zeropage-on-read and
+ * -write). Every access is timed on its own.
+ */
+
+#include <getopt.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+#include "bench.h"
+
+static vmp_procstate_t ps;
+static size_t	       region_pages = 1024, stride = 1, write_every = 16;
+static vaddr_t	       region_base = PGSIZE;
+
+/* touch every step'th page of the region, timing each access */
+static void
+bench_touch(const char *name, size_t step, bool write)
+{
+	struct bench bench;
+
+	bench_begin(&bench, name);
+	for (size_t pg = 0; pg < region_pages; pg += step) {
+		uint64_t start = bench_now();
+
+		soft_mmu_access(region_base + pg * PGSIZE, write);
+		bench_sample(&bench, bench_now() - start, 1);
+	}
+	bench_end(&bench);
+}
+
+static void
+bench_sparse(const char *read_name, const char *write_name, bool enabled)
+{
+	vaddr_t vaddr = region_base;
+
+	vmp_zero_page_enabled = enabled;
+	vm_ps_allocate(&ps, &vaddr, region_pages * PGSIZE, true, false);
+
+	bench_touch(read_name, stride, false);
+	bench_touch(write_name, stride * write_every, true);
+
+	vm_ps_deallocate(&ps, region_base, region_pages * PGSIZE);
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-r region pages] [-s stride pages] "
+	    "[-w write every nth read page] [-m pmem KiB]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t pmem_kib = 0;
+	int    c;
+
+	while ((c = getopt(argc, argv, "r:s:w:m:")) != -1) {
+		switch (c) {
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			stride = strtoull(optarg, NULL, 0);
+			break;
+		case 'w':
+			write_every = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (region_pages == 0 || stride == 0 || write_every == 0)
+		usage(argv[0]);
+
+	/*
+	 * room for the region, its pagetables, working set entries and the PFN
+	 * database
+	 */
+	if (pmem_kib == 0)
+		pmem_kib = (region_pages * 3 * PGSIZE) / 1024 + 64;
+
+	bench_setup(pmem_kib, &ps);
+	/* keep everything resident; eviction isn't what's measured */
+	ps.ws_max_count = region_pages;
+
+	bench_sparse("zeropage-off-read", "zeropage-off-write", false);
+	bench_sparse("zeropage-on-read", "zeropage-on-write", true);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file replay.c
+ * @brief Replays memory access traces through the soft port.
+ *
+ * Traces are either text, in the format of valgrind's lackey tool
+ * (--trace-mem=yes), of which lines other than " L", " S", " M" and "I"
+ * records are ignored:
+ *
+ *	I  04016ea4,3
+ *	 S 7ff000390,8
+ *
+ * or binary: the 8 bytes "KRXATRC1", then a little-endian uint64_t per access,
+ * being its address with bit 0 set for a write.
+ *
+ * The simulated address space is far smaller than the traced one, so traced
+ * addresses are mapped onto it by segment: the first access within each
+ * aligned segment of the trace gets the segment a VAD of its own, and offsets
+ * within segments are kept, so spatial locality within them is preserved.
+ * Each page of the trace (-p, 4KiB by default) becomes one simulated page.
+ *
+ * A file is memory-mapped and the parts already replayed dropped as replay
+ * goes on; "-" reads from stdin. Either way, a trace is never held in memory
+ * whole. At the end, fault counts by kind, the peak working set and the time
+ * taken are reported on stderr.
+ */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <endian.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+
+#define TRACE_MAGIC "KRXATRC1"
+/*! Bytes of a mapped trace replayed before they are dropped. */
+#define TRACE_DROP_CHUNK (64UL * 1024 * 1024)
+
+struct trace {
+	bool binary;
+	/*! for a mapped file: the mapping, read position, and end */
+	const char *base, *pos, *end;
+	/*! for a mapped file: how much of the mapping has been dropped */
+	size_t dropped;
+	/*! for a stream */
+	FILE  *stream;
+	char  *line;
+	size_t linecap;
+};
+
+struct segment {
+	/*! trace segment number plus 1; 0 if the slot is unused */
+	uint64_t key;
+	vaddr_t	 base;
+};
+
+static vmp_procstate_t ps;
+static size_t	       trace_page_shift = 12, segment_pages = 64,
+		 ws_max = VMP_WS_DEFAULT_MAX;
+static uint64_t	       max_accesses = UINT64_MAX;
+
+static struct segment *segments;
+static size_t	       nsegments, segments_capacity;
+static vaddr_t	       next_segment_base;
+
+static int
+trace_open(struct trace *trace, const char *path)
+{
+	struct stat st;
+	int	    fd;
+
+	memset(trace, 0x0, sizeof(*trace));
+
+	if (strcmp(path, "-") == 0) {
+		char magic[sizeof(TRACE_MAGIC) - 1];
+		int  c;
+
+		trace->stream = stdin;
+		c = getc(stdin);
+		if (c == TRACE_MAGIC[0]) {
+			if (fread(magic + 1, 1, sizeof(magic) - 1, stdin) !=
+			    sizeof(magic) - 1)
+				return -1;
+			magic[0] = c;
+			if (memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+				return -1;
+			trace->binary = true;
+		} else if (c != EOF) {
+			ungetc(c, stdin);
+		}
+		return 0;
+	}
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	trace->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (trace->base == MAP_FAILED)
+		return -1;
+	madvise((void *)trace->base, st.st_size, MADV_SEQUENTIAL);
+	trace->pos = trace->base;
+	trace->end = trace->base + st.st_size;
+
+	if (st.st_size >= sizeof(TRACE_MAGIC) - 1 &&
+	    memcmp(trace->base, TRACE_MAGIC, sizeof(TRACE_MAGIC) - 1) == 0) {
+		trace->binary = true;
+		trace->pos += sizeof(TRACE_MAGIC) - 1;
+	}
+
+	return 0;
+}
+
+/* give back the pages of the mapping which have been replayed */
+static void
+trace_drop(struct trace *trace)
+{
+	size_t done = trace->pos - trace->base;
+
+	if (done - trace->dropped < TRACE_DROP_CHUNK)
+		return;
+
+	done = done & ~(TRACE_DROP_CHUNK - 1);
+	madvise((void *)(trace->base + trace->dropped), done - trace->dropped,
+	    MADV_DONTNEED);
+	trace->dropped = done;
+}
+
+/*
+ * Parse a lackey line, returning whether it was an access. Modifies are
+ * reported as writes, which entail the read.
+ */
+static bool
+parse_lackey(const char *line, const char *end, uint64_t *addr, bool *write)
+{
+	const char *p = line;
+	uint64_t    value = 0;
+
+	while (p < end && *p == ' ')
+		p++;
+	if (p == end)
+		return false;
+
+	switch (*p) {
+	case 'I':
+	case 'L':
+		*write = false;
+		break;
+	case 'S':
+	case 'M':
+		*write = true;
+		break;
+	default:
+		return false;
+	}
+
+	for (p++; p < end && *p == ' '; p++)
+		;
+	if (p == end || *p == ',')
+		return false;
+
+	for (; p < end && *p != ','; p++) {
+		int digit;
+
+		if (*p >= '0' && *p <= '9')
+			digit = *p - '0';
+		else if (*p >= 'a' && *p <= 'f')
+			digit = *p - 'a' + 10;
+		else if (*p >= 'A' && *p <= 'F')
+			digit = *p - 'A' + 10;
+		else
+			return false;
+		value = value << 4 | digit;
+	}
+
+	*addr = value;
+	return true;
+}
+
+/* get the next access; returns false at the end of the trace */
+static bool
+trace_next(struct trace *trace, uint64_t *addr, bool *write)
+{
+	if (trace->binary) {
+		uint64_t record;
+
+		if (trace->stream != NULL) {
+			if (fread(&record, sizeof(record), 1, trace->stream) !=
+			    1)
+				return false;
+		} else {
+			if (trace->end - trace->pos < sizeof(record))
+				return false;
+			memcpy(&record, trace->pos, sizeof(record));
+			trace->pos += sizeof(record);
+			trace_drop(trace);
+		}
+
+		record = le64toh(record);
+		*addr = record & ~(uint64_t)1;
+		*write = record & 1;
+		return true;
+	}
+
+	for (;;) {
+		const char *line, *eol;
+
+		if (trace->stream != NULL) {
+			ssize_t len = getline(&trace->line, &trace->linecap,
+			    trace->stream);
+
+			if (len < 0)
+				return false;
+			line = trace->line;
+			eol = line + len;
+		} else {
+			if (trace->pos == trace->end)
+				return false;
+			line = trace->pos;
+			eol = memchr(line, '\n', trace->end - line);
+			if (eol == NULL)
+				eol = trace->end;
+			trace->pos = eol == trace->end ? eol : eol + 1;
+			trace_drop(trace);
+		}
+
+		if (parse_lackey(line, eol, addr, write))
+			return true;
+	}
+}
+
+/* find, or give a VAD to, the segment of the trace containing addr */
+static vaddr_t
+segment_base(uint64_t segment)
+{
+	size_t	mask = segments_capacity - 1, i;
+	vaddr_t base;
+	int	r;
+
+	for (i = (segment * 0x9E3779B97F4A7C15ULL) >> 32 & mask;
+	     segments[i].key != 0; i = (i + 1) & mask)
+		if (segments[i].key == segment + 1)
+			return segments[i].base;
+
+	base = next_segment_base;
+	if (base + segment_pages * PGSIZE >
+	    (1UL << (PGSHIFT + 3 * SOFT_LEVEL_BITS))) {
+		fprintf(stderr,
+		    "replay: %zu segments exhaust the simulated address "
+		    "space; use larger pages (soft_page_shift)\n",
+		    nsegments);
+		exit(EXIT_FAILURE);
+	}
+	r = vm_ps_allocate(&ps, &base, segment_pages * PGSIZE, true, false);
+	kassert(r == 0);
+	next_segment_base += segment_pages * PGSIZE;
+
+	segments[i].key = segment + 1;
+	segments[i].base = base;
+
+	/* keep the table at most half full */
+	if (++nsegments * 2 > segments_capacity) {
+		struct segment *old = segments;
+		size_t		old_capacity = segments_capacity;
+
+		segments_capacity *= 2;
+		segments = calloc(segments_capacity, sizeof(*segments));
+		if (segments == NULL)
+			kfatal("Failed to grow the segment table\n");
+		mask = segments_capacity - 1;
+		for (size_t j = 0; j < old_capacity; j++) {
+			size_t k;
+
+			if (old[j].key == 0)
+				continue;
+			for (k = ((old[j].key - 1) * 0x9E3779B97F4A7C15ULL) >>
+				    32 & mask;
+			     segments[k].key != 0; k = (k + 1) & mask)
+				;
+			segments[k] = old[j];
+		}
+		free(old);
+	}
+
+	return base;
+}
+
+static double
+timespec_diff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+	    (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-p trace page bytes] [-s segment pages]\n"
+	    "\t[-W working set max] [-m pmem KiB] [-f pagefile KiB]\n"
+	    "\t[-n max accesses] trace-file|-\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct trace	      trace;
+	struct timespec	      start, end;
+	struct vm_fault_stats faults;
+	struct vm_stat	      stat;
+	size_t		      pmem_kib = 0, pagefile_kib = 0, page_size,
+			  peak_ws = 0;
+	uint64_t	      naccesses = 0, nwrites = 0;
+	double		      elapsed;
+	int		      c;
+
+	while ((c = getopt(argc, argv, "p:s:W:m:f:n:")) != -1) {
+		switch (c) {
+		case 'p':
+			page_size = strtoull(optarg, NULL, 0);
+			if (page_size == 0 || (page_size & (page_size - 1)))
+				usage(argv[0]);
+			trace_page_shift = __builtin_ctzll(page_size);
+			break;
+		case 's':
+			segment_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'W':
+			ws_max = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			pagefile_kib = strtoull(optarg, NULL, 0);
+			break;
+		case 'n':
+			max_accesses = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || segment_pages == 0 || ws_max == 0)
+		usage(argv[0]);
+
+	if (trace_open(&trace, argv[optind]) != 0) {
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+
+	segments_capacity = 64;
+	segments = calloc(segments_capacity, sizeof(*segments));
+	next_segment_base = segment_pages * PGSIZE;
+
+	soft_pmem_init(pmem_kib * 1024, 0);
+	if (pagefile_kib != 0)
+		soft_pagefile_init(pagefile_kib * 1024);
+	vm_ps_init(&ps);
+	ps.ws_max_count = ws_max;
+	SIM_vmps = &ps;
+	SIM_cr3 = vm_page_paddr(ps.md.top);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (naccesses < max_accesses) {
+		uint64_t addr, page;
+		bool	 write;
+
+		if (!trace_next(&trace, &addr, &write))
+			break;
+
+		page = addr >> trace_page_shift;
+		soft_mmu_access(segment_base(page / segment_pages) +
+			(page % segment_pages) * PGSIZE,
+		    write);
+
+		naccesses++;
+		nwrites += write;
+		if (ps.ws_current_count > peak_ws)
+			peak_ws = ps.ws_current_count;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = timespec_diff(&start, &end);
+	soft_mmu_thread_exit();
+
+	vm_ps_query_stats(&ps, &faults);
+	vm_stat_get_exact(&stat);
+
+	fprintf(stderr,
+	    "replay: %" PRIu64 " accesses (%" PRIu64 " writes) in %.3fs "
+	    "(%.0f/s), %zu segments of %zu pages\n",
+	    naccesses, nwrites, elapsed, naccesses / elapsed, nsegments,
+	    segment_pages);
+	fprintf(stderr,
+	    "replay: faults: demand-zero %" PRIu64 ", zero-page %" PRIu64
+	    ", write %" PRIu64 ", soft %" PRIu64 ", hard %" PRIu64
+	    ", collided %" PRIu64 "\n",
+	    faults.count[kVMFaultZero], faults.count[kVMFaultZeroPage],
+	    faults.count[kVMFaultWrite], faults.count[kVMFaultTrans],
+	    faults.count[kVMFaultPagein], faults.count[kVMFaultCollided]);
+	fprintf(stderr,
+	    "replay: peak working set %zu pages (%zu KiB of the trace)\n",
+	    peak_ws, (peak_ws << trace_page_shift) / 1024);
+	fprintf(stderr, "replay: %zu pageouts, %zu pages reclaimed\n",
+	    stat.npageout, stat.nreclaimed);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,793 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file sim.c
+ * @brief Multi-threaded driver for the soft port.
+ *
+ * Spawns N threads spread round-robin across M processes. Each process has a
+ * single anonymous region, and each thread replays an access pattern over its
+ * process' region through the simulated MMU. At the end, fault rates, fault
+ * kinds, TLB and per-lock contention statistics are reported on stderr (stdout
+ * carries the VM's own chatter). With -T, VM events are traced and saved to a
+ * file for kernel/tools/vmtrace to decode; with -M, a snapshot of memory use is
+ * saved after the run.
+ *
+ * With -R, the run is repeated as further starts of the processes, each with
+ * fresh address spaces and the same access sequence; with -F too, the first
+ * faults of the first start are recorded, and later starts prefetch them.
+ *
+ * With -K, a further thread scans the processes for pages to merge, a batch
+ * of pages per process each millisecond, while the access threads run. -C
+ * first gives each region's pages one of a few distinct contents, which are
+ * otherwise all zero.
+ *
+ * With -H, full leaf tables of the regions are promoted to large pages; the
+ * pagetable memory and TLB misses reported show the difference it makes.
+ *
+ * -X adds a slow tier of memory, accesses to which take -Y ns longer. With -G,
+ * the scanning thread also runs a tier migration pass over each process each
+ * millisecond; the share of accesses reaching the slow tier, and the time the
+ * run takes, measure how well pages are placed.
+ *
+ * With -A, the scanning thread also compacts memory each millisecond, a batch
+ * of pages at a time, into runs the size of a large page. Promotions to large
+ * pages compact on demand too, when they find no run free.
+ *
+ * With -O, each region is populated as it is mapped, so that the run starts
+ * with it resident rather than faulting it in.
+ *
+ * -V gives each region access-pattern advice as it is mapped: sequential
+ * widens the read-ahead of hard faults and frees pages behind them, random
+ * reads the faulting page alone.
+ *
+ * Without -m, physical memory is sized to hold every region resident. Without
+ * -f or -Z there is nowhere to page out to, so a smaller -m is refused.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <time.h>
+
+#include "kdk/kmem.h"
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+#include "vm/vmp.h"
+
+enum pattern {
+	kPatternSequential,
+	kPatternRandom,
+	kPatternZipf,
+	kPatternStrided,
+	/*! zipf, with ranks scattered so popularity is unrelated to address */
+	kPatternZipfScattered,
+};
+
+struct sim_thread {
+	pthread_t	 thread;
+	unsigned	 id;
+	vmp_procstate_t *vmps;
+	uint64_t	 rng;
+};
+
+static const char *pattern_names[] = {
+	[kPatternSequential] = "sequential",
+	[kPatternRandom] = "random",
+	[kPatternZipf] = "zipf",
+	[kPatternStrided] = "strided",
+	[kPatternZipfScattered] = "zipf-scattered",
+};
+
+static const char *advice_names[] = {
+	[kVMAdviceNormal] = "normal",
+	[kVMAdviceSequential] = "sequential",
+	[kVMAdviceRandom] = "random",
+};
+
+static const char *fault_kind_names[] = {
+	[kVMFaultZero] = "demand-zero",
+	[kVMFaultZeroPage] = "zero-page",
+	[kVMFaultWrite] = "write",
+	[kVMFaultTrans] = "soft",
+	[kVMFaultPagein] = "hard",
+	[kVMFaultCollided] = "collided",
+	[kVMFaultCOW] = "cow",
+	[kVMFaultZCache] = "zcache",
+};
+
+static unsigned	    nthreads = 1, nprocs = 1;
+static size_t	    naccesses = 10000, region_pages = 64, stride = 1,
+		 ws_max = VMP_WS_DEFAULT_MAX;
+static unsigned	    write_pct = 50, nstarts = 1;
+static size_t	    prefetch_pages, zcache_pages, merge_batch, fill_contents,
+		 migrate_batch, compact_batch;
+static double	    zipf_s = 1.0;
+static enum pattern pattern = kPatternSequential;
+static vaddr_t	    region_base = PGSIZE;
+static bool	    populate;
+/*! advice given each region as it is mapped */
+static enum vm_advice advice = kVMAdviceNormal;
+
+static vmp_procstate_t	 *procs;
+static struct sim_thread *threads;
+/*! whether the scanning thread should keep scanning */
+static bool scanning;
+
+static inline uint64_t
+xorshift64s(uint64_t *state)
+{
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double
+rand_double(uint64_t *state)
+{
+	return (xorshift64s(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Zipf sampling by rejection-inversion (Hörmann & Derflinger, 1996); O(1)
+ * per sample with no tables, so it scales to regions of any size.
+ */
+static double
+zipf_helper1(double x)
+{
+	return fabs(x) > 1e-8 ? log1p(x) / x : 1 - x * (0.5 - x * (1. / 3 - 0.25 * x));
+}
+
+static double
+zipf_helper2(double x)
+{
+	return fabs(x) > 1e-8 ? expm1(x) / x :
+				1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double
+zipf_h(double x)
+{
+	return exp(-zipf_s * log(x));
+}
+
+static double
+zipf_hintegral(double x)
+{
+	double logx = log(x);
+	return zipf_helper2((1 - zipf_s) * logx) * logx;
+}
+
+static double
+zipf_hintegral_inverse(double x)
+{
+	double t = x * (1 - zipf_s);
+	if (t < -1)
+		t = -1;
+	return exp(zipf_helper1(t) * x);
+}
+
+static size_t
+zipf_sample(uint64_t *rng, size_t n)
+{
+	double hx1 = zipf_hintegral(1.5) - 1,
+	       hn = zipf_hintegral(n + 0.5),
+	       s = 2 - zipf_hintegral_inverse(zipf_hintegral(2.5) - zipf_h(2));
+
+	for (;;) {
+		double u = hn + rand_double(rng) * (hx1 - hn);
+		double x = zipf_hintegral_inverse(u);
+		size_t k = (size_t)(x + 0.5);
+
+		if (k < 1)
+			k = 1;
+		else if (k > n)
+			k = n;
+
+		if (k - x <= s || u >= zipf_hintegral(k + 0.5) - zipf_h(k))
+			return k - 1;
+	}
+}
+
+static size_t
+next_page(struct sim_thread *thread, size_t i)
+{
+	switch (pattern) {
+	case kPatternSequential:
+		return i % region_pages;
+	case kPatternRandom:
+		return xorshift64s(&thread->rng) % region_pages;
+	case kPatternZipf:
+		return zipf_sample(&thread->rng, region_pages);
+	case kPatternStrided:
+		return (i * stride) % region_pages;
+	case kPatternZipfScattered:
+		/* a prime multiplier permutes any region smaller than itself */
+		return zipf_sample(&thread->rng, region_pages) * 2654435761ULL %
+		    region_pages;
+	}
+
+	kfatal("bad pattern\n");
+}
+
+static void *
+sim_thread_main(void *arg)
+{
+	struct sim_thread *thread = arg;
+
+	SIM_vmps = thread->vmps;
+	SIM_cr3 = vm_page_paddr(thread->vmps->md.top);
+
+	for (size_t i = 0; i < naccesses; i++) {
+		size_t page = next_page(thread, i);
+		bool   write = xorshift64s(&thread->rng) % 100 < write_pct;
+		vaddr_t addr = region_base + page * PGSIZE +
+		    (xorshift64s(&thread->rng) % (PGSIZE / 8)) * 8;
+
+		soft_mmu_access(addr, write);
+	}
+
+	soft_mmu_thread_exit();
+	return NULL;
+}
+
+static void *
+scan_thread_main(void *arg)
+{
+	struct timespec interval = { 0, 1000000 };
+
+	while (__atomic_load_n(&scanning, __ATOMIC_RELAXED)) {
+		for (unsigned i = 0; i < nprocs; i++) {
+			if (merge_batch != 0)
+				vm_ps_merge_scan(&procs[i], merge_batch);
+			if (migrate_batch != 0)
+				vm_ps_tier_migrate(&procs[i], migrate_batch);
+		}
+		if (compact_batch != 0)
+			vm_compact(SOFT_PTES_PER_TABLE, compact_batch);
+		nanosleep(&interval, NULL);
+	}
+
+	return NULL;
+}
+
+/* stamp each page of a process' region with one of fill_contents values */
+static void
+fill_region(vmp_procstate_t *vmps)
+{
+	SIM_vmps = vmps;
+	SIM_cr3 = vm_page_paddr(vmps->md.top);
+
+	for (size_t i = 0; i < region_pages; i++) {
+		paddr_t paddr = soft_mmu_access(region_base + i * PGSIZE, true);
+
+		*(uint64_t *)P2V(paddr) = i % fill_contents + 1;
+	}
+}
+
+static double
+timespec_diff(struct timespec *start, struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) +
+	    (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static double
+pct(uint64_t part, uint64_t whole)
+{
+	return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+static void
+report(double elapsed)
+{
+	struct soft_lock_stats	locks[SOFT_LOCK_MAX_CLASSES];
+	struct soft_tlb_stats	tlb;
+	struct vm_stat		stat;
+	struct vm_fault_stats	faults;
+	struct vm_zcache_stats	zcache;
+	struct vm_merge_stats	merge;
+	struct vm_tier_stats	tier;
+	struct vm_compact_stats	compact;
+	uint64_t		nfaults, naccesses_total;
+	uint64_t		pwc_hits = 0, pwc_misses = 0;
+	size_t			merge_saved;
+	size_t			nlocks;
+	ipl_t			ipl;
+
+	vm_stat_get_exact(&stat);
+	vm_ps_query_stats(NULL, &faults);
+	vm_zcache_get_stats(&zcache);
+	vm_merge_get_stats(&merge);
+	vm_tier_get_stats(&tier);
+	vm_compact_get_stats(&compact);
+	merge_saved = merge.nsharing - merge.npages + merge.nmergedzero;
+	ipl = vmp_acquire_pfn_lock();
+	for (unsigned i = 0; i < nprocs; i++) {
+		pwc_hits += procs[i].md.pwc_hits;
+		pwc_misses += procs[i].md.pwc_misses;
+	}
+	vmp_release_pfn_lock(ipl);
+	soft_tlb_get_stats(&tlb);
+	nlocks = soft_lock_get_stats(locks, elementsof(locks));
+
+	naccesses_total = (uint64_t)naccesses * nthreads * nstarts;
+	nfaults = stat.nfaultzero + stat.nfaultwrite + stat.nfaulttrans +
+	    stat.nfaultpagein + stat.nfaultcollided + stat.nfaultzeropage +
+	    stat.nfaultzcache + stat.nfaultcow;
+
+	fprintf(stderr,
+	    "sim: %u threads, %u processes, %s pattern, %zu pages/process, "
+	    "ws max %zu\n",
+	    nthreads, nprocs, pattern_names[pattern], region_pages, ws_max);
+	fprintf(stderr, "sim: %" PRIu64 " accesses in %.3fs (%.0f/s)\n",
+	    naccesses_total, elapsed, naccesses_total / elapsed);
+	fprintf(stderr, "sim: %" PRIu64 " faults (%.0f/s)\n", nfaults,
+	    nfaults / elapsed);
+	fprintf(stderr,
+	    "sim:   demand-zero %zu, zero-page %zu, write %zu, soft %zu, "
+	    "hard %zu, collided %zu, zcache %zu, cow %zu\n",
+	    stat.nfaultzero, stat.nfaultzeropage, stat.nfaultwrite,
+	    stat.nfaulttrans, stat.nfaultpagein, stat.nfaultcollided,
+	    stat.nfaultzcache, stat.nfaultcow);
+	for (int kind = 0; kind < kVMFaultKindMax; kind++) {
+		if (faults.count[kind] == 0)
+			continue;
+		fprintf(stderr,
+		    "sim:   %-11s latency mean %" PRIu64 "ns, p50 <%" PRIu64
+		    "ns, p99 <%" PRIu64 "ns\n",
+		    fault_kind_names[kind],
+		    faults.total_ns[kind] / faults.count[kind],
+		    vm_fault_hist_percentile(faults.hist[kind], 50),
+		    vm_fault_hist_percentile(faults.hist[kind], 99));
+	}
+	fprintf(stderr, "sim:   soft %.1f%%, hard %.1f%% of soft+hard\n",
+	    pct(stat.nfaulttrans, stat.nfaulttrans + stat.nfaultpagein),
+	    pct(stat.nfaultpagein, stat.nfaulttrans + stat.nfaultpagein));
+	fprintf(stderr, "sim: %zu pageouts, %zu pages reclaimed\n",
+	    stat.npageout, stat.nreclaimed);
+	fprintf(stderr, "sim: %zu pages prefetched in %zu pagefile reads\n",
+	    stat.nprefetch, stat.nprefetchread);
+	fprintf(stderr,
+	    "sim: %zu pages read ahead, %zu freed behind (%s advice)\n",
+	    stat.nreadahead, stat.nfreebehind, advice_names[advice]);
+	if (zcache_pages != 0)
+		fprintf(stderr,
+		    "sim: zcache %" PRIu64 " stored, %" PRIu64
+		    " loaded, ratio %.2f, decompress mean %" PRIu64
+		    "ns; %zu pages; %" PRIu64 " incompressible, %" PRIu64
+		    " rejected full\n",
+		    zcache.nstored, zcache.nloaded,
+		    zcache.bytes_out == 0 ?
+			0.0 :
+			(double)zcache.bytes_in / zcache.bytes_out,
+		    zcache.nloaded == 0 ? 0 :
+					  zcache.decompress_ns / zcache.nloaded,
+		    zcache.npages, zcache.nincompressible, zcache.nfull);
+	if (merge_batch != 0)
+		fprintf(stderr,
+		    "sim: merging scanned %" PRIu64 " pages in %" PRIu64
+		    " passes, %.3fms; merged %" PRIu64 " (%" PRIu64
+		    " into the zero page); %zu shared pages mapped %zu times, "
+		    "%zu pages saved (%.1f/ms of scanning)\n",
+		    merge.nscanned, merge.npasses, merge.scan_ns / 1e6,
+		    merge.nmerged, merge.nmergedzero, merge.npages,
+		    merge.nsharing, merge_saved,
+		    merge.scan_ns == 0 ? 0.0 :
+					 merge_saved / (merge.scan_ns / 1e6));
+	fprintf(stderr,
+	    "sim: pagetables %zu pages (%zu KiB); large pages %zu promoted, "
+	    "%zu demoted, %zu promotions without contiguous memory\n",
+	    stat.nprocpgtable, stat.nprocpgtable * PGSIZE / 1024,
+	    stat.nlargepromote, stat.nlargedemote, stat.nlargenocontig);
+	if (populate)
+		fprintf(stderr, "sim: %zu pages populated as mapped\n",
+		    stat.npopulated);
+	if (compact.npasses != 0)
+		fprintf(stderr,
+		    "sim: compaction %" PRIu64 " passes (%" PRIu64
+		    " on demand), %.3fms; %" PRIu64 " of %" PRIu64
+		    " movable blocks emptied (%.1f%%), %" PRIu64
+		    " pages migrated; %" PRIu64 " blocks unmovable\n",
+		    compact.npasses, compact.ndemand, compact.compact_ns / 1e6,
+		    compact.nblocksfreed, compact.nblocks - compact.nunmovable,
+		    pct(compact.nblocksfreed,
+			compact.nblocks - compact.nunmovable),
+		    compact.nmigrated, compact.nunmovable);
+	fprintf(stderr,
+	    "sim: pagetable cache %zu hits, %zu misses, %zu drained\n",
+	    stat.nptcachehit, stat.nptcachemiss, stat.nptcachedrain);
+	fprintf(stderr,
+	    "sim: paging-structure cache %" PRIu64 " hits, %" PRIu64
+	    " misses (%.1f%% hit)\n",
+	    pwc_hits, pwc_misses, pct(pwc_hits, pwc_hits + pwc_misses));
+	fprintf(stderr,
+	    "sim: TLB %" PRIu64 " hits, %" PRIu64 " misses (%.1f%% hit); %"
+	    PRIu64 " fills, %" PRIu64 " of large pages\n",
+	    tlb.hits, tlb.misses, pct(tlb.hits, tlb.hits + tlb.misses),
+	    tlb.fills, tlb.large_fills);
+	if (tier.npages[kVMTierSlow] != 0)
+		fprintf(stderr,
+		    "sim: tiers fast %zu of %zu pages free, slow %zu of %zu; "
+		    "%" PRIu64 " accesses (%.1f%%) to the slow tier\n",
+		    tier.nfree[kVMTierFast], tier.npages[kVMTierFast],
+		    tier.nfree[kVMTierSlow], tier.npages[kVMTierSlow],
+		    tlb.slow_accesses, pct(tlb.slow_accesses, naccesses_total));
+	if (migrate_batch != 0)
+		fprintf(stderr,
+		    "sim: tier migration %" PRIu64 " passes, %.3fms; %" PRIu64
+		    " pages demoted, %" PRIu64 " promoted, %" PRIu64
+		    " left for want of fast memory\n",
+		    tier.npasses, tier.migrate_ns / 1e6, tier.ndemoted,
+		    tier.npromoted, tier.nnoroom);
+	for (size_t i = 0; i < nlocks; i++)
+		fprintf(stderr,
+		    "sim: lock %-15s %" PRIu64 " acquired, %" PRIu64
+		    " contended (%.2f%%); wait p99 <%" PRIu64
+		    "ns, hold p50 <%" PRIu64 "ns, p99 <%" PRIu64 "ns\n",
+		    locks[i].name, locks[i].acquires, locks[i].contended,
+		    pct(locks[i].contended, locks[i].acquires),
+		    soft_lock_hist_percentile(locks[i].wait_hist, 99),
+		    soft_lock_hist_percentile(locks[i].hold_hist, 50),
+		    soft_lock_hist_percentile(locks[i].hold_hist, 99));
+}
+
+static void
+snapshot_write(void *context, const char *text, size_t len)
+{
+	fwrite(text, 1, len, context);
+}
+
+/* write a snapshot of every process, as CSV if the path ends in .csv */
+static int
+save_snapshot(const char *path)
+{
+	vmp_procstate_t **ps = calloc(nprocs, sizeof(*ps));
+	size_t		  len = strlen(path);
+	FILE		 *file;
+	int		  r;
+
+	if (ps == NULL)
+		return -1;
+	for (unsigned i = 0; i < nprocs; i++)
+		ps[i] = &procs[i];
+
+	file = fopen(path, "w");
+	if (file == NULL) {
+		free(ps);
+		return -1;
+	}
+	r = vm_snapshot(ps, nprocs,
+	    len > 4 && strcmp(path + len - 4, ".csv") == 0 ? kVMSnapshotCSV :
+							     kVMSnapshotJSON,
+	    snapshot_write, file);
+	if (fclose(file) != 0)
+		r = -1;
+	free(ps);
+
+	return r;
+}
+
+/*! slabs holding \p nobjs objects of \p size bytes */
+static size_t
+slab_pages(size_t nobjs, size_t size)
+{
+	size_t nperslab = PGSIZE / ROUNDUP(size, KMEM_ALIGNMENT);
+
+	return (nobjs + nperslab - 1) / nperslab;
+}
+
+/*! pages the run keeps resident when there's nowhere to page out to */
+static size_t
+resident_pages(void)
+{
+	size_t nwsles = ws_max < region_pages ? ws_max : region_pages;
+	/* every thread started takes a CPU number; so do main and scanning */
+	size_t ncpus = (size_t)nthreads * nstarts + 2;
+
+	if (ncpus > KRX_MAX_CPUS)
+		ncpus = KRX_MAX_CPUS;
+
+	/*
+	 * each region, with its leaf tables and the levels above them, and its
+	 * working set entries; a full magazine of entries and of VADs on each
+	 * CPU; and some over for partial slabs and pagetable caches
+	 */
+	return nprocs * (region_pages + region_pages / SOFT_PTES_PER_TABLE +
+			    slab_pages(nwsles, sizeof(struct vmp_wsle)) + 8) +
+	    ncpus * (slab_pages(KMEM_MAGAZINE_SIZE, sizeof(struct vmp_wsle)) +
+			slab_pages(KMEM_MAGAZINE_SIZE, sizeof(vm_vad_t))) +
+	    16;
+}
+
+/*! fast tier size to hold the run, or 0 if the build default does */
+static size_t
+default_pmem_size(void)
+{
+	size_t need = resident_pages(), npages = need, pfndb;
+
+	/* the PFN database and the wired zero page come out of it too */
+	for (;;) {
+		pfndb = ROUNDUP(sizeof(struct vmp_pregion) +
+			sizeof(vm_page_t) * npages,
+		    PGSIZE) / PGSIZE;
+		if (npages - pfndb - 1 >= need)
+			break;
+		npages++;
+	}
+
+	if (npages * PGSIZE <= (size_t)KRX_SOFT_PMEM_KIB * 1024)
+		return 0;
+	return npages * PGSIZE;
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr,
+	    "usage: %s [-t threads] [-p processes] [-n accesses/thread]\n"
+	    "\t[-P sequential|random|zipf|strided|zipf-scattered]\n"
+	    "\t[-r region pages] [-s stride pages]\n"
+	    "\t[-z zipf exponent] [-w write %%]\n"
+	    "\t[-W working set max] [-m pmem KiB] [-f pagefile KiB]\n"
+	    "\t[-S seed] [-L (don't time lock waits and holds)]\n"
+	    "\t[-T trace file] [-M snapshot file (.json or .csv)]\n"
+	    "\t[-R starts] [-F prefetch pages] [-D pagefile latency ns]\n"
+	    "\t[-Z compressed cache pages] [-K merge batch pages]\n"
+	    "\t[-C distinct page contents] [-H (promote to large pages)]\n"
+	    "\t[-X slow tier KiB] [-Y slow tier latency ns]\n"
+	    "\t[-G tier migration batch pages] [-A compaction batch pages]\n"
+	    "\t[-O (populate regions as mapped)]\n"
+	    "\t[-V normal|sequential|random (advice)]\n",
+	    argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t		pmem_kib = 0, slow_kib = 0, pagefile_kib = 0;
+	uint64_t	seed = 0x5eed;
+	const char     *trace_path = NULL, *snapshot_path = NULL;
+	struct timespec start, end;
+	pthread_t	scan_thread;
+	double		elapsed = 0;
+	int		c;
+
+	while ((c = getopt(argc, argv,
+		    "t:p:n:P:r:s:z:w:W:m:f:S:LT:M:R:F:D:Z:K:C:HX:Y:G:A:OV:")) !=
+	    -1) {
+		switch (c) {
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			nprocs = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			naccesses = strtoull(optarg, NULL, 0);
+			break;
+		case 'P':
+			for (c = 0; c < elementsof(pattern_names); c++)
+				if (strcmp(optarg, pattern_names[c]) == 0)
+					break;
+			if (c == elementsof(pattern_names))
+				usage(argv[0]);
+			pattern = c;
+			break;
+		case 'r':
+			region_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			stride = strtoull(optarg, NULL, 0);
+			break;
+		case 'z':
+			zipf_s = strtod(optarg, NULL);
+			break;
+		case 'w':
+			write_pct = strtoul(optarg, NULL, 0);
+			break;
+		case 'W':
+			ws_max = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			pmem_kib = strtoull(optarg, NULL, 0);
+			break;
+		case 'f':
+			pagefile_kib = strtoull(optarg, NULL, 0);
+			break;
+		case 'S':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'L':
+			soft_lock_timing = false;
+			break;
+		case 'T':
+			trace_path = optarg;
+			break;
+		case 'M':
+			snapshot_path = optarg;
+			break;
+		case 'R':
+			nstarts = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			prefetch_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'D':
+			soft_pagefile_latency_ns = strtoull(optarg, NULL, 0);
+			break;
+		case 'Z':
+			zcache_pages = strtoull(optarg, NULL, 0);
+			break;
+		case 'K':
+			merge_batch = strtoull(optarg, NULL, 0);
+			break;
+		case 'C':
+			fill_contents = strtoull(optarg, NULL, 0);
+			break;
+		case 'H':
+			soft_large_pages_enabled = true;
+			break;
+		case 'X':
+			slow_kib = strtoull(optarg, NULL, 0);
+			break;
+		case 'Y':
+			soft_slow_tier_latency_ns = strtoull(optarg, NULL, 0);
+			break;
+		case 'G':
+			migrate_batch = strtoull(optarg, NULL, 0);
+			break;
+		case 'A':
+			compact_batch = strtoull(optarg, NULL, 0);
+			break;
+		case 'O':
+			populate = true;
+			break;
+		case 'V':
+			for (c = 0; c < elementsof(advice_names); c++)
+				if (strcmp(optarg, advice_names[c]) == 0)
+					break;
+			if (c == elementsof(advice_names))
+				usage(argv[0]);
+			advice = c;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (nthreads == 0 || nprocs == 0 || region_pages == 0 || ws_max == 0 ||
+	    nstarts == 0 || nprocs > nthreads ||
+	    prefetch_pages > VM_PREFETCH_MAX_PAGES)
+		usage(argv[0]);
+	if (region_base + region_pages * PGSIZE >
+	    (1UL << (PGSHIFT + 3 * SOFT_LEVEL_BITS))) {
+		fprintf(stderr, "sim: region exceeds the address space\n");
+		return EXIT_FAILURE;
+	}
+
+#if !KRX_VM_TRACE
+	if (trace_path != NULL)
+		fprintf(stderr, "sim: VM tracing was not compiled in\n");
+#endif
+	vm_trace_enabled = trace_path != NULL;
+
+	soft_pmem_init(pmem_kib != 0 ? pmem_kib * 1024 : default_pmem_size(),
+	    slow_kib * 1024);
+	if (pagefile_kib != 0)
+		soft_pagefile_init(pagefile_kib * 1024);
+	if (zcache_pages != 0)
+		vm_zcache_enable(zcache_pages);
+
+	if (pagefile_kib == 0 && zcache_pages == 0) {
+		struct vm_stat stat;
+
+		vm_stat_get(&stat);
+		if (stat.nfree < resident_pages()) {
+			fprintf(stderr,
+			    "sim: %zu pages must stay resident but only %zu "
+			    "are free; raise -m or give a pagefile with -f\n",
+			    resident_pages(), stat.nfree);
+			return EXIT_FAILURE;
+		}
+	}
+
+	procs = calloc(nprocs, sizeof(*procs));
+	threads = calloc(nthreads, sizeof(*threads));
+
+	for (unsigned run = 0; run < nstarts; run++) {
+		int nprefetched = 0;
+
+		for (unsigned i = 0; i < nprocs; i++) {
+			vaddr_t vaddr = region_base;
+
+			if (run != 0)
+				vm_ps_destroy(&procs[i]);
+			vm_ps_init(&procs[i]);
+			procs[i].ws_max_count = ws_max;
+			vm_ps_allocate(&procs[i], &vaddr,
+			    region_pages * PGSIZE, true, populate);
+			vm_ps_advise(&procs[i], vaddr, region_pages * PGSIZE,
+			    advice);
+			if (prefetch_pages != 0 && run == 0)
+				vm_ps_prefetch_record(&procs[i], "sim",
+				    prefetch_pages);
+			if (fill_contents != 0)
+				fill_region(&procs[i]);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned i = 0; i < nprocs; i++) {
+			int r = 0;
+
+			if (prefetch_pages != 0 && run != 0)
+				r = vm_ps_prefetch(&procs[i], "sim");
+			if (r > 0)
+				nprefetched += r;
+		}
+		for (unsigned i = 0; i < nthreads; i++) {
+			threads[i].id = i;
+			threads[i].vmps = &procs[i % nprocs];
+			threads[i].rng = seed + i * 0x9E3779B97F4A7C15ULL;
+			pthread_create(&threads[i].thread, NULL,
+			    sim_thread_main, &threads[i]);
+		}
+		if (merge_batch != 0 || migrate_batch != 0 ||
+		    compact_batch != 0) {
+			scanning = true;
+			pthread_create(&scan_thread, NULL, scan_thread_main,
+			    NULL);
+		}
+		for (unsigned i = 0; i < nthreads; i++)
+			pthread_join(threads[i].thread, NULL);
+		if (merge_batch != 0 || migrate_batch != 0 ||
+		    compact_batch != 0) {
+			__atomic_store_n(&scanning, false, __ATOMIC_RELAXED);
+			pthread_join(scan_thread, NULL);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed += timespec_diff(&start, &end);
+
+		for (unsigned i = 0; i < nprocs; i++)
+			vm_ps_prefetch_save(&procs[i]);
+		if (nstarts > 1)
+			fprintf(stderr,
+			    "sim: start %u took %.3fms, %d pages prefetched\n",
+			    run, timespec_diff(&start, &end) * 1000,
+			    nprefetched);
+	}
+
+	report(elapsed);
+	if (snapshot_path != NULL && save_snapshot(snapshot_path) != 0) {
+		perror("sim: saving snapshot");
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned i = 0; i < nprocs; i++)
+		vm_ps_destroy(&procs[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "sim: %u processes destroyed in %.3fms\n", nprocs,
+	    timespec_diff(&start, &end) * 1000);
+
+	vm_trace_enabled = false;
+	if (trace_path != NULL && soft_trace_save(trace_path) != 0) {
+		perror("sim: saving trace");
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
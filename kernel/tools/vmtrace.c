@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file vmtrace.c
+ * @brief Host-side decoder for VM trace files.
+ *
+ * Reads a file saved by soft_trace_save(), merges the events of every CPU's
+ * ring in time order, and prints them as text, or as CSV with -c. Processes
+ * are named p0, p1, ... in order of first appearance, and times are relative
+ * to the first event.
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kdk/vm_trace.h"
+
+static const char *type_names[] = {
+	[kVMTraceFaultBegin] = "fault-begin",
+	[kVMTraceFaultEnd] = "fault-end",
+	[kVMTracePageAlloc] = "page-alloc",
+	[kVMTracePageFree] = "page-free",
+	[kVMTraceWSInsert] = "ws-insert",
+	[kVMTraceWSEvict] = "ws-evict",
+	[kVMTraceUnmap] = "unmap",
+};
+
+/* as enum vm_fault_kind of kdk/vm.h */
+static const char *fault_kind_names[] = {
+	"zero",
+	"zeropage",
+	"write",
+	"trans",
+	"pagein",
+	"collided",
+	"cow",
+	"zcache",
+};
+
+/* as enum vm_page_use of kdk/vm.h */
+static const char *page_use_names[] = {
+	"invalid",
+	"pfndb",
+	"free",
+	"deleted",
+	"anonprivate",
+	"pml4",
+	"pml3",
+	"pml2",
+	"pml1",
+	"zero",
+	"kmem",
+	"zcache",
+	"merged",
+};
+
+static struct vm_trace_event *events;
+static size_t		      nevents;
+static uint64_t		     *procs;
+static size_t		      nprocs;
+
+static const char *
+name(const char **names, size_t count, uint32_t value)
+{
+	if (value >= count || names[value] == NULL)
+		return "?";
+	return names[value];
+}
+
+static long
+proc_index(uint64_t proc)
+{
+	size_t i;
+
+	if (proc == 0)
+		return -1;
+
+	for (i = 0; i < nprocs; i++)
+		if (procs[i] == proc)
+			return i;
+
+	procs = realloc(procs, sizeof(*procs) * (nprocs + 1));
+	if (procs == NULL) {
+		perror("vmtrace");
+		exit(EXIT_FAILURE);
+	}
+	procs[nprocs++] = proc;
+
+	return i;
+}
+
+static int
+event_cmp(const void *a, const void *b)
+{
+	const struct vm_trace_event *x = a, *y = b;
+
+	if (x->timestamp != y->timestamp)
+		return x->timestamp < y->timestamp ? -1 : 1;
+	return (int)x->cpu - (int)y->cpu;
+}
+
+static int
+load(const char *path)
+{
+	struct vm_trace_file_header header;
+	FILE			   *file;
+
+	file = fopen(path, "rb");
+	if (file == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    header.magic != VM_TRACE_MAGIC) {
+		fprintf(stderr, "%s: not a VM trace file\n", path);
+		goto fail;
+	} else if (header.version != VM_TRACE_VERSION ||
+	    header.event_size != sizeof(struct vm_trace_event)) {
+		fprintf(stderr, "%s: unsupported version %" PRIu32 "\n", path,
+		    header.version);
+		goto fail;
+	}
+
+	for (uint32_t i = 0; i < header.nrings; i++) {
+		struct vm_trace_file_ring ring;
+
+		if (fread(&ring, sizeof(ring), 1, file) != 1)
+			goto truncated;
+
+		events = realloc(events,
+		    sizeof(*events) * (nevents + ring.nevents));
+		if (events == NULL) {
+			perror("vmtrace");
+			goto fail;
+		}
+		if (fread(events + nevents, sizeof(*events), ring.nevents,
+			file) != ring.nevents)
+			goto truncated;
+		nevents += ring.nevents;
+
+		if (ring.nlost != 0)
+			fprintf(stderr,
+			    "vmtrace: cpu %" PRIu32 " lost %" PRIu64
+			    " events\n",
+			    ring.cpu, ring.nlost);
+	}
+
+	fclose(file);
+	qsort(events, nevents, sizeof(*events), event_cmp);
+	return 0;
+
+truncated:
+	fprintf(stderr, "%s: truncated\n", path);
+fail:
+	fclose(file);
+	return -1;
+}
+
+/* print the type-specific part of an event */
+static void
+print_detail(struct vm_trace_event *ev, bool csv)
+{
+	switch (ev->type) {
+	case kVMTraceFaultBegin:
+		printf(csv ? "%s" : "%s fault",
+		    ev->detail ? "write" : "read");
+		break;
+
+	case kVMTraceFaultEnd:
+		printf(csv ? "%s" : "%s in %" PRIu64 "ns",
+		    name(fault_kind_names,
+			sizeof(fault_kind_names) / sizeof(*fault_kind_names),
+			ev->detail),
+		    ev->arg);
+		break;
+
+	case kVMTracePageAlloc:
+	case kVMTracePageFree:
+		printf("%s",
+		    name(page_use_names,
+			sizeof(page_use_names) / sizeof(*page_use_names),
+			ev->detail));
+		break;
+
+	case kVMTraceUnmap:
+		if (!csv)
+			printf("to 0x%" PRIx64, ev->arg);
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void
+print_text(void)
+{
+	uint64_t base = nevents > 0 ? events[0].timestamp : 0;
+
+	for (size_t i = 0; i < nevents; i++) {
+		struct vm_trace_event *ev = &events[i];
+		long		       proc = proc_index(ev->proc);
+		bool		       is_pfn = ev->type == kVMTracePageAlloc ||
+		    ev->type == kVMTracePageFree;
+
+		printf("%12.3fus cpu%-3u ", (ev->timestamp - base) / 1e3,
+		    ev->cpu);
+		if (proc < 0)
+			printf("%-5s", "-");
+		else
+			printf("p%-4ld", proc);
+		printf("%-12s%s0x%-12" PRIx64 " ",
+		    name(type_names, kVMTraceMax, ev->type),
+		    is_pfn ? "pfn " : "", ev->addr);
+		print_detail(ev, false);
+		printf("\n");
+	}
+}
+
+static void
+print_csv(void)
+{
+	uint64_t base = nevents > 0 ? events[0].timestamp : 0;
+
+	printf("time_ns,cpu,proc,event,addr,arg,detail\n");
+	for (size_t i = 0; i < nevents; i++) {
+		struct vm_trace_event *ev = &events[i];
+		long		       proc = proc_index(ev->proc);
+
+		printf("%" PRIu64 ",%u,", ev->timestamp - base, ev->cpu);
+		if (proc >= 0)
+			printf("p%ld", proc);
+		printf(",%s,0x%" PRIx64 ",%" PRIu64 ",",
+		    name(type_names, kVMTraceMax, ev->type), ev->addr,
+		    ev->arg);
+		print_detail(ev, true);
+		printf("\n");
+	}
+}
+
+static void
+usage(const char *argv0)
+{
+	fprintf(stderr, "usage: %s [-c (CSV output)] trace-file\n", argv0);
+	exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+	bool csv = false;
+	int  c;
+
+	while ((c = getopt(argc, argv, "c")) != -1) {
+		switch (c) {
+		case 'c':
+			csv = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(argv[0]);
+
+	if (load(argv[optind]) != 0)
+		return EXIT_FAILURE;
+
+	if (csv)
+		print_csv();
+	else
+		print_text();
+
+	return EXIT_SUCCESS;
+}
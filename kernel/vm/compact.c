@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file compact.c
+ * @brief Compaction of physical memory.
+ *
+ * Free pages are handed out first in, first out, so once memory has been in
+ * use a while the free pages are scattered, and aligned runs of them, as large
+ * pages need, are rare. Compaction makes them again by migrating pages out of
+ * the way.
+ *
+ * Each region is compacted by two scanners. The block scanner walks up from
+ * the bottom a block at a time, looking for blocks whose pages are all either
+ * free or movable; each it finds has its movable pages migrated to free pages
+ * taken by the free scanner, which walks down from the top. The free scanner
+ * passes over blocks that are wholly free, which are what compaction is for.
+ * A region is done once the scanners meet.
+ *
+ * Everything is done under the PFN lock, which is also what keeps the pages
+ * of other processes from changing under a migration.
+ */
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+struct compact_scan {
+	struct vmp_pregion *preg;
+	size_t		    block_pages;
+	/*! index of the first page of the first whole block */
+	size_t first;
+	/*! the free scanner's position; pages from here up are used */
+	size_t free_cursor;
+	/*! pages still to migrate before the pass stops */
+	size_t budget;
+};
+
+static struct vm_compact_stats compact_stats;
+
+static bool
+block_is_free(vm_page_t *run, size_t npages)
+{
+	for (size_t i = 0; i < npages; i++)
+		if (run[i].use != kPageUseFree)
+			return false;
+	return true;
+}
+
+/* find a free page at or above \p limit to migrate to, outside free blocks */
+static vm_page_t *
+free_scan(struct compact_scan *scan, size_t limit)
+{
+	struct vmp_pregion *preg = scan->preg;
+	size_t		    bp = scan->block_pages;
+
+	while (scan->free_cursor > limit) {
+		size_t i = scan->free_cursor - 1;
+
+		/* on entering a whole block, skip it if it's free */
+		if (i >= scan->first && (i - scan->first) % bp == bp - 1 &&
+		    block_is_free(&preg->pages[i + 1 - bp], bp)) {
+			scan->free_cursor = i + 1 - bp;
+			continue;
+		}
+
+		scan->free_cursor = i;
+		if (preg->pages[i].use == kPageUseFree)
+			return &preg->pages[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Empty the block at \p b if all its pages are free or movable. Returns false
+ * if the free scanner has too few pages left to migrate them to.
+ */
+static bool
+block_evacuate(struct compact_scan *scan, size_t b, size_t *nfreed)
+{
+	vm_page_t *run = &scan->preg->pages[b];
+	size_t	   nmovable = 0, cursor;
+
+	if (block_is_free(run, scan->block_pages))
+		return true;
+
+	compact_stats.nblocks++;
+	for (size_t i = 0; i < scan->block_pages; i++) {
+		if (run[i].use == kPageUseFree)
+			continue;
+		if (!vmp_page_is_movable(&run[i])) {
+			compact_stats.nunmovable++;
+			return true;
+		}
+		nmovable++;
+	}
+
+	if (nmovable > scan->budget)
+		return true;
+
+	/* moving only some of them would gain nothing */
+	cursor = scan->free_cursor;
+	for (size_t i = 0; i < nmovable; i++)
+		if (free_scan(scan, b + scan->block_pages) == NULL)
+			return false;
+	scan->free_cursor = cursor;
+
+	for (size_t i = 0; i < scan->block_pages; i++) {
+		vm_page_t *to;
+		int	   r;
+
+		if (run[i].use == kPageUseFree)
+			continue;
+
+		to = free_scan(scan, b + scan->block_pages);
+		r = vmp_page_migrate_locked(&run[i], to);
+		kassert(r == 0);
+		compact_stats.nmigrated++;
+		scan->budget--;
+	}
+
+	compact_stats.nblocksfreed++;
+	(*nfreed)++;
+	return true;
+}
+
+static size_t
+compact(size_t block_pages, size_t max_pages)
+{
+	struct vmp_pregion *preg;
+	struct compact_scan scan;
+	size_t		    nfreed = 0;
+	uint64_t	    begin = ke_nanotime();
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(block_pages != 0 && (block_pages & (block_pages - 1)) == 0);
+
+	scan.block_pages = block_pages;
+	scan.budget = max_pages;
+
+	TAILQ_FOREACH (preg, &vmp_pregion_queue, queue_entry) {
+		scan.preg = preg;
+		scan.first = (block_pages -
+				 PADDR_TO_PFN(preg->base) % block_pages) %
+		    block_pages;
+		scan.free_cursor = preg->npages;
+
+		for (size_t b = scan.first; scan.budget > 0 &&
+		     b + block_pages <= scan.free_cursor;
+		     b += block_pages)
+			if (!block_evacuate(&scan, b, &nfreed))
+				break;
+	}
+
+	compact_stats.npasses++;
+	compact_stats.compact_ns += ke_nanotime() - begin;
+
+	return nfreed;
+}
+
+size_t
+vm_compact(size_t block_pages, size_t max_pages)
+{
+	ipl_t  ipl = vmp_acquire_pfn_lock();
+	size_t nfreed = compact(block_pages, max_pages);
+
+	vmp_release_pfn_lock(ipl);
+
+	return nfreed;
+}
+
+size_t
+vmp_compact_locked(size_t block_pages, size_t max_pages)
+{
+	compact_stats.ndemand++;
+	return compact(block_pages, max_pages);
+}
+
+void
+vm_compact_get_stats(struct vm_compact_stats *stats)
+{
+	ipl_t ipl = vmp_acquire_pfn_lock();
+	*stats = compact_stats;
+	vmp_release_pfn_lock(ipl);
+}
@@ -1,7 +1,34 @@
+#include <inttypes.h>
+
 #include "kdk/libkern.h"
+#include "kdk/log2hist.h"
 #include "kdk/vm.h"
 #include "vmp.h"
 
+/*
+ * Count a fault of \p kind that took \p ns. A CPU's statistics may be shared
+ * with other CPUs, so are updated atomically; a process' are protected by its
+ * mutex.
+ */
+static void
+fault_stats_add(struct vm_fault_stats *stats, enum vm_fault_kind kind,
+    uint64_t ns, bool atomic)
+{
+	unsigned  bucket = log2hist_bucket(ns, VM_FAULT_HIST_BUCKETS);
+	uint64_t *hist = &stats->hist[kind][bucket];
+
+	if (atomic) {
+		__atomic_fetch_add(&stats->count[kind], 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&stats->total_ns[kind], ns,
+		    __ATOMIC_RELAXED);
+		__atomic_fetch_add(hist, 1, __ATOMIC_RELAXED);
+	} else {
+		stats->count[kind]++;
+		stats->total_ns[kind] += ns;
+		(*hist)++;
+	}
+}
+
 int
 vm_do_write_fault(vm_vad_t *vad, struct vmp_md_fault_state *state,
     vaddr_t vaddr, vm_account_t *out_account, vm_page_t **out)
@@ -10,43 +37,161 @@ vm_do_write_fault(vm_vad_t *vad, struct vmp_md_fault_state *state,
 	if (vad->flags.cow) {
 		kfatal("implement cow\n");
 	} else {
+		vm_page_t *page = vmp_md_pte_page(state->pte);
+
 		/* ...AND MARK PAGE DIRTY */
 		state->pte->hw.writeable = 1;
-		if (out) {
-			vm_page_t *page = vmp_md_pte_page(state->pte);
-			*out = vmp_page_retain_locked(page, out_account);
+
+		/* any copy in the pagefile is about to become stale */
+		if (page->swap_descriptor != 0) {
+			vmp_pagefile_slot_free(page->swap_descriptor);
+			page->swap_descriptor = 0;
 		}
+
+		if (out)
+			*out = vmp_page_retain_locked(page, out_account);
 		return kVMFaultRetOK;
 	}
 }
 
-int
-vm_do_fault(struct vmp_md_fault_state *state, vaddr_t vaddr, bool write,
-    bool *made_writeable, vm_account_t *out_account, vm_page_t **out)
+/*
+ * Replace a read-only mapping of the zero page with a private zeroed page.
+ */
+static int
+vm_do_zero_page_write_fault(vmp_procstate_t *vmps,
+    struct vmp_md_fault_state *state, vaddr_t vaddr,
+    vm_account_t *out_account, vm_page_t **out)
 {
-	vmp_procstate_t	 *vmps = SIM_vmps;
-	vm_fault_return_t r;
-	vm_vad_t	 *vad;
-	ipl_t		  ipl;
-
-	printf("vm_fault(0x%zx, %d)\n", vaddr, write);
+	vm_page_t *new_page;
+	int	   r;
 
-	kassert(splget() < kIPLDPC);
+	r = vmp_page_alloc_locked(&new_page, &vmps->account,
+	    kPageUseAnonPrivate, false);
+	if (r != 0)
+		return r;
+	new_page->owner = vmps;
+	new_page->referent_pte = V2P((vaddr_t)state->pte);
 
-	ke_wait(&vmps->mutex, "vm_fault:vmps->mutex", false, false, -1);
-	vad = vmp_ps_vad_find(vmps, vaddr);
-
-	if (!vad)
-		kfatal("VM fault at 0x%zx doesn't have a vad\n", vaddr);
+	if (out != NULL)
+		*out = vmp_page_retain_locked(new_page, out_account);
 
 	/*
-	 * a VAD exists. Check if it is nonwriteable and this is a write fault.
-	 * If so, signal error.
+	 * the leaf table's used_ptes already counts this PTE. the zero page's
+	 * translation may be cached, and unlike an upgrade, reads through it
+	 * would now be wrong.
 	 */
-	if (write && !(vad->flags.protection & kVMWrite))
-		kfatal("Write fault at 0x%zx in nonwriteable vad\n", vaddr);
+	vmp_md_pte_make_hw(state->pte, new_page->pfn, true);
+	vmp_md_tlb_invalidate(vmps, vaddr, vaddr + PGSIZE, kVMTLBInvalZeroPage);
+	vmp_wsl_insert(vmps, vaddr);
+
+	return kVMFaultRetOK;
+}
+
+/*
+ * Replace a read-only mapping of a shared page of same-page merging with a
+ * private copy.
+ */
+static int
+vm_do_merged_write_fault(vmp_procstate_t *vmps,
+    struct vmp_md_fault_state *state, vaddr_t vaddr,
+    vm_account_t *out_account, vm_page_t **out)
+{
+	vm_page_t *shared = vmp_md_pte_page(state->pte), *new_page;
+	int	   r;
+
+	r = vmp_page_alloc_locked(&new_page, &vmps->account,
+	    kPageUseAnonPrivate, false);
+	if (r != 0)
+		return r;
+	new_page->owner = vmps;
+	new_page->referent_pte = V2P((vaddr_t)state->pte);
+	memcpy((void *)vm_page_direct_map_addr(new_page),
+	    (void *)vm_page_direct_map_addr(shared), PGSIZE);
+
+	if (out != NULL)
+		*out = vmp_page_retain_locked(new_page, out_account);
+
+	/* as for the zero page; but this mapping held a reference */
+	vmp_md_pte_make_hw(state->pte, new_page->pfn, true);
+	vmp_md_tlb_invalidate(vmps, vaddr, vaddr + PGSIZE, kVMTLBInvalMerge);
+	vmp_merge_page_release(shared);
+	vmp_wsl_insert(vmps, vaddr);
+
+	return kVMFaultRetOK;
+}
+
+/* pages a hard fault reads, by the advice of its VAD */
+static const size_t pagein_cluster[] = {
+	[kVMAdviceNormal] = 4,
+	[kVMAdviceSequential] = VMP_PAGEIN_CLUSTER_MAX,
+	[kVMAdviceRandom] = 1,
+};
+
+/* pages behind a fault in a sequential VAD left to the working set */
+#define FREE_BEHIND_PAGES VMP_PAGEIN_CLUSTER_MAX
+
+size_t
+vmp_pagein_cluster_locked(vmp_procstate_t *vmps, vaddr_t vaddr, vaddr_t end,
+    size_t max, bool reclaim, vm_page_t *page)
+{
+	vm_page_t *pages[VMP_PAGEIN_CLUSTER_MAX];
+	pte_t	  *ptes[VMP_PAGEIN_CLUSTER_MAX];
+	uintptr_t  slot = 0;
+	size_t	   n;
+	int	   r;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(max <= VMP_PAGEIN_CLUSTER_MAX);
+
+	for (n = 0; n < max && vaddr + n * PGSIZE < end; n++) {
+		if (vmp_mp_fetch_pte(vmps, vaddr + n * PGSIZE, &ptes[n],
+			NULL) != 0 ||
+		    !vmp_md_pte_is_outpaged(ptes[n]))
+			break;
+		if (n == 0)
+			slot = vmp_md_pte_drumslot(ptes[0]);
+		else if (vmp_md_pte_drumslot(ptes[n]) != slot + n)
+			break;
+
+		if (n == 0 && page != NULL) {
+			pages[0] = page;
+			continue;
+		}
+		if (reclaim)
+			r = vmp_page_alloc_locked(&pages[n], &vmps->account,
+			    kPageUseAnonPrivate, false);
+		else
+			r = vmp_page_alloc_free_locked(&pages[n],
+			    &vmps->account, kPageUseAnonPrivate);
+		if (r != 0)
+			break;
+	}
+	if (n == 0)
+		return 0;
+
+	vmp_md_pagefile_read_cluster(slot, pages, n);
+
+	for (size_t i = page != NULL ? 1 : 0; i < n; i++) {
+		/* as on a hard fault, it stays clean, so the slot is kept */
+		pages[i]->swap_descriptor = slot + i;
+		pages[i]->owner = vmps;
+		pages[i]->referent_pte = V2P((vaddr_t)ptes[i]);
+		/* the outpaged PTE was counted in used_ptes already */
+		vmp_md_pte_make_trans(ptes[i], pages[i]->pfn);
+		vmp_page_release_locked(pages[i], &vmps->account);
+	}
+
+	return n;
+}
+
+enum vm_fault_kind
+vmp_fault_locked(vmp_procstate_t *vmps, vm_vad_t *vad,
+    struct vmp_md_fault_state *state, vaddr_t vaddr, bool write,
+    bool *made_writeable, vm_account_t *out_account, vm_page_t **out)
+{
+	vm_fault_return_t  r;
+	enum vm_fault_kind kind;
 
-	ipl = vmp_acquire_pfn_lock();
 	r = vmp_md_wire_pte(vmps, vaddr, state);
 	switch (r) {
 	case kVMFaultRetOK:
@@ -58,38 +203,125 @@ vm_do_fault(struct vmp_md_fault_state *state, vaddr_t vaddr, bool write,
 
 	if (vmp_md_pte_is_valid(state->pte) &&
 	    (!write || vmp_md_pte_is_writeable(state->pte))) {
-		/* this fault must have already been handled */
-		kfatal("fault arleady handled\n");
+		/* another thread of this process already handled it */
+		VMP_STAT_INC(nfaultcollided);
+		kind = kVMFaultCollided;
+		if (out != NULL) {
+			vm_page_t *page = vmp_md_pte_page(state->pte);
+			*out = vmp_page_retain_locked(page, out_account);
+		}
+		*made_writeable = write;
 	} else if (vmp_md_pte_is_valid(state->pte)) {
 		/* it must be valid but nonwriteable and this must be a write */
 		kassert(write && !vmp_md_pte_is_writeable(state->pte));
-		r = vm_do_write_fault(vad, state, vaddr, out_account, out);
-		switch (r) {
-		case kVMFaultRetOK:
-			break;
+		if (vmp_md_pte_page(state->pte) == vmp_zero_page) {
+			r = vm_do_zero_page_write_fault(vmps, state, vaddr,
+			    out_account, out);
+			kassert(r == 0);
+			VMP_STAT_INC(nfaultzero);
+			kind = kVMFaultZero;
+		} else if (vmp_md_pte_page(state->pte)->use ==
+		    kPageUseMerged) {
+			r = vm_do_merged_write_fault(vmps, state, vaddr,
+			    out_account, out);
+			kassert(r == 0);
+			VMP_STAT_INC(nfaultcow);
+			kind = kVMFaultCOW;
+		} else {
+			r = vm_do_write_fault(vad, state, vaddr, out_account,
+			    out);
+			switch (r) {
+			case kVMFaultRetOK:
+				break;
 
-		default:
-			kfatal("Handle %d return value from "
-			       "vmp_do_write_fault\n",
-			    r);
+			default:
+				kfatal("Handle %d return value from "
+				       "vmp_do_write_fault\n",
+				    r);
+			}
+			if (vad->flags.cow) {
+				VMP_STAT_INC(nfaultcow);
+				kind = kVMFaultCOW;
+			} else {
+				VMP_STAT_INC(nfaultwrite);
+				kind = kVMFaultWrite;
+			}
 		}
 		*made_writeable = true;
+		/* this may have been the last PTE of its table to be written */
+		vmp_md_try_promote(vmps, vad, vaddr, state);
 	} else if (vmp_md_pte_is_trans(state->pte)) {
-#if 0
 		vm_page_t *page = vmp_md_pte_page(state->pte);
 
+		/*
+		 * soft fault: the page is still resident on the standby or
+		 * modified queue. the transition PTE was already counted in the
+		 * leaf table's used_ptes, so that's unchanged.
+		 */
 		kassert(page != NULL);
-		vmp_page_retain_locked(page);
+		vmp_page_retain_locked(page, &vmps->account);
 
-		if (out != NULL) {
-			page->reference_count++;
-			*out = page;
-		}
+		if (out != NULL)
+			*out = vmp_page_retain_locked(page, out_account);
 
 		vmp_md_pte_make_hw(state->pte, page->pfn, false);
 		vmp_wsl_insert(vmps, vaddr);
-#endif
-		kfatal("Trans fault\n");
+		VMP_STAT_INC(nfaulttrans);
+		kind = kVMFaultTrans;
+	} else if (vmp_md_pte_is_outpaged(state->pte)) {
+		uintptr_t  slot = vmp_md_pte_drumslot(state->pte);
+		vm_page_t *new_page;
+		size_t	   nread;
+		int	   r;
+
+		/*
+		 * hard fault: read the page back in from the pagefile, and
+		 * some of those after it in the same run of slots; only while
+		 * free pages last, unless the VAD is read in order
+		 */
+		r = vmp_page_alloc_locked(&new_page, &vmps->account,
+		    kPageUseAnonPrivate, false);
+		kassert(r == 0);
+
+		nread = vmp_pagein_cluster_locked(vmps, vaddr, vad->end,
+		    pagein_cluster[vad->flags.advice],
+		    vad->flags.advice == kVMAdviceSequential, new_page);
+		kassert(nread != 0);
+		VMP_STAT_ADD(nreadahead, nread - 1);
+		/* it stays clean until written, so the slot is kept */
+		new_page->swap_descriptor = slot;
+		new_page->owner = vmps;
+		new_page->referent_pte = V2P((vaddr_t)state->pte);
+
+		if (out != NULL)
+			*out = vmp_page_retain_locked(new_page, out_account);
+
+		vmp_md_pte_make_hw(state->pte, new_page->pfn, false);
+		vmp_wsl_insert(vmps, vaddr);
+		VMP_STAT_INC(nfaultpagein);
+		kind = kVMFaultPagein;
+	} else if (vmp_md_pte_is_compressed(state->pte)) {
+		vm_page_t *new_page;
+		int	   r;
+
+		/* decompress the page out of the compressed cache */
+		r = vmp_page_alloc_locked(&new_page, &vmps->account,
+		    kPageUseAnonPrivate, false);
+		kassert(r == 0);
+
+		vmp_zcache_load(vmp_md_pte_zcache_handle(state->pte), new_page);
+		/* this is now its only copy */
+		new_page->dirty = true;
+		new_page->owner = vmps;
+		new_page->referent_pte = V2P((vaddr_t)state->pte);
+
+		if (out != NULL)
+			*out = vmp_page_retain_locked(new_page, out_account);
+
+		vmp_md_pte_make_hw(state->pte, new_page->pfn, false);
+		vmp_wsl_insert(vmps, vaddr);
+		VMP_STAT_INC(nfaultzcache);
+		kind = kVMFaultZCache;
 	} else {
 		vm_page_t *new_page;
 		int	   r;
@@ -97,12 +329,31 @@ vm_do_fault(struct vmp_md_fault_state *state, vaddr_t vaddr, bool write,
 		/* it must be empty */
 		kassert(vmp_md_pte_is_empty(state->pte));
 
-		if (vad->section == NULL) {
+		if (vad->section == NULL && !write && vmp_zero_page_enabled) {
+			/*
+			 * read of untouched anonymous memory: map the zero page
+			 * until the first write. the PTE takes no reference on
+			 * it and doesn't enter the working set.
+			 */
+			if (out != NULL) {
+				*out = vmp_page_retain_locked(vmp_zero_page,
+				    out_account);
+			}
+
+			vmp_md_pte_make_hw(state->pte, vmp_zero_page->pfn,
+			    false);
+			state->bot_page->refcnt++;
+			state->bot_page->used_ptes++;
+			VMP_STAT_INC(nfaultzeropage);
+			kind = kVMFaultZeroPage;
+		} else if (vad->section == NULL) {
 			/* install demand-zeroed page */
 
 			r = vmp_page_alloc_locked(&new_page, &vmps->account,
 			    kPageUseAnonPrivate, false);
 			kassert(r == 0);
+			new_page->owner = vmps;
+			new_page->referent_pte = V2P((vaddr_t)state->pte);
 
 			if (out != NULL) {
 				*out = vmp_page_retain_locked(new_page,
@@ -114,22 +365,144 @@ vm_do_fault(struct vmp_md_fault_state *state, vaddr_t vaddr, bool write,
 			 * must update this first as vmp_wsl_insert may evict a
 			 * page and reduced used_ptes to zero
 			 */
-			 state->bot_page->refcnt++;
+			state->bot_page->refcnt++;
 			state->bot_page->used_ptes++;
 			vmp_wsl_insert(vmps, vaddr);
+			VMP_STAT_INC(nfaultzero);
+			kind = kVMFaultZero;
 		} else {
 			kfatal("Section page\n");
 		}
 	}
 
+	return kind;
+}
+
+int
+vm_do_fault(vmp_procstate_t *vmps, struct vmp_md_fault_state *state,
+    vaddr_t vaddr, bool write, bool *made_writeable,
+    vm_account_t *out_account, vm_page_t **out)
+{
+	vm_vad_t	  *vad;
+	ipl_t		   ipl;
+	enum vm_fault_kind kind;
+	uint64_t	   begin = ke_nanotime(), latency;
+
+	vaddr = PGROUNDDOWN(vaddr);
+	VMP_TRACE(kVMTraceFaultBegin, vmps, vaddr, 0, write);
+
+	kassert(splget() < kIPLDPC);
+
+	ke_wait(&vmps->mutex, "vm_fault:vmps->mutex", false, false, -1);
+	vad = vmp_ps_vad_find(vmps, vaddr);
+
+	if (!vad)
+		kfatal("VM fault at 0x%zx doesn't have a vad\n", vaddr);
+
+	/*
+	 * a VAD exists. Check if it is nonwriteable and this is a write fault.
+	 * If so, signal error.
+	 */
+	if (write && !(vad->flags.protection & kVMWrite))
+		kfatal("Write fault at 0x%zx in nonwriteable vad\n", vaddr);
+
+	ipl = vmp_acquire_pfn_lock();
+	kind = vmp_fault_locked(vmps, vad, state, vaddr, write, made_writeable,
+	    out_account, out);
+	/*
+	 * free behind a sequential scan: what it passed a window ago won't be
+	 * wanted again, so is evicted without waiting its turn, in address
+	 * order so that it's written out to consecutive slots. a window's worth
+	 * is looked at rather than one page, so that pages the scan didn't
+	 * fault on are caught too.
+	 */
+	if (vad->flags.advice == kVMAdviceSequential &&
+	    vaddr >= vad->start + 2 * FREE_BEHIND_PAGES * PGSIZE) {
+		size_t n = vmp_wsl_evict_range(vmps,
+		    vaddr - 2 * FREE_BEHIND_PAGES * PGSIZE,
+		    vaddr - FREE_BEHIND_PAGES * PGSIZE);
+		VMP_STAT_ADD(nfreebehind, n);
+	}
 	vmp_release_pfn_lock(ipl);
+
+	latency = ke_nanotime() - begin;
+	fault_stats_add(&vmps->fault_stats, kind, latency, false);
+	fault_stats_add(&vmp_stat_cpus[ke_cpu_num()].faults, kind, latency,
+	    true);
+	if (vmps->prefetch_log != NULL)
+		vmp_prefetch_log(vmps, vaddr, kind);
 	ke_mutex_release(&vmps->mutex);
 
+	VMP_TRACE(kVMTraceFaultEnd, vmps, vaddr, latency, kind);
+
 	// kfatal("Implement the logic...\n");
 
 	return 0;
 }
 
+uint64_t
+vm_fault_hist_percentile(const uint64_t *hist, double pct)
+{
+	return log2hist_percentile(hist, VM_FAULT_HIST_BUCKETS, pct);
+}
+
+void
+vm_ps_query_stats(vmp_procstate_t *vmps, struct vm_fault_stats *stats)
+{
+	if (vmps != NULL) {
+		ke_wait(&vmps->mutex, "vm_ps_query_stats:vmps->mutex", false,
+		    false, -1);
+		*stats = vmps->fault_stats;
+		ke_mutex_release(&vmps->mutex);
+		return;
+	}
+
+	memset(stats, 0x0, sizeof(*stats));
+	for (size_t cpu = 0; cpu < KRX_MAX_CPUS; cpu++) {
+		uint64_t *out = (uint64_t *)stats;
+		uint64_t *in = (uint64_t *)&vmp_stat_cpus[cpu].faults;
+
+		for (size_t i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++)
+			out[i] += __atomic_load_n(&in[i], __ATOMIC_RELAXED);
+	}
+}
+
+void
+vm_ps_dump_stats(vmp_procstate_t *vmps)
+{
+	static const char    *names[kVMFaultKindMax] = {
+		[kVMFaultZero] = "zero",
+		[kVMFaultZeroPage] = "zero-page",
+		[kVMFaultWrite] = "write",
+		[kVMFaultTrans] = "soft",
+		[kVMFaultPagein] = "hard",
+		[kVMFaultCollided] = "collided",
+		[kVMFaultCOW] = "cow",
+		[kVMFaultZCache] = "zcache",
+	};
+	struct vm_fault_stats stats;
+
+	vm_ps_query_stats(vmps, &stats);
+
+	if (vmps == NULL)
+		kprintf("Fault statistics of the system:\n");
+	else
+		kprintf("Fault statistics of process %p:\n", vmps);
+	kprintf("\033[7m%-11s%-10s%-10s%-10s%-10s\033[m\n", "kind", "count",
+	    "mean ns", "p50 ns", "p99 ns");
+	for (int kind = 0; kind < kVMFaultKindMax; kind++) {
+		uint64_t count = stats.count[kind];
+
+		if (count == 0)
+			continue;
+		kprintf("%-11s%-10" PRIu64 "%-10" PRIu64 "<%-9" PRIu64
+			"<%-9" PRIu64 "\n",
+		    names[kind], count, stats.total_ns[kind] / count,
+		    vm_fault_hist_percentile(stats.hist[kind], 50),
+		    vm_fault_hist_percentile(stats.hist[kind], 99));
+	}
+}
+
 int
 vmp_fault(vaddr_t vaddr, bool write, vm_account_t *out_account, vm_page_t **out)
 {
@@ -141,8 +514,8 @@ vmp_fault(vaddr_t vaddr, bool write, vm_account_t *out_account, vm_page_t **out)
 
 retry:
 	made_writeable = false;
-	switch (vm_do_fault(&state, vaddr, write, &made_writeable, out_account,
-	    out)) {
+	switch (vm_do_fault(vmps, &state, vaddr, write, &made_writeable,
+	    out_account, out)) {
 	case kVMFaultRetOK: {
 		ipl_t ipl;
 
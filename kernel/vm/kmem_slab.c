@@ -0,0 +1,482 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file kmem_slab.c
+ * @brief Slab allocator for fixed-size kernel objects.
+ *
+ * Each slab is a single page from the VM. Pages may be tiny in the soft port,
+ * so a slab's bookkeeping is kept in its PFN database entry rather than in the
+ * page itself: owner points to the zone, used_ptes counts objects allocated
+ * from the slab, referent_pte holds the head of its free list, and queue_link
+ * links it onto one of the zone's partial, full or empty slab lists.
+ *
+ * In front of the slabs, every simulated CPU has a magazine of free objects
+ * per zone, found by ke_cpu_num(). Host threads numbered alike share it under
+ * its lock, and one exiting leaves nothing stranded. Allocation pops from the
+ * magazine, refilling it with half a magazine of objects from the slabs when
+ * it is empty; freeing pushes onto it, flushing half back to the slabs when it
+ * is full.
+ *
+ * Empty slabs are kept until the VM runs short of free pages, at which point
+ * vmp_page_reclaim_locked() gives them back, emptying the magazines too if
+ * nothing else can be reclaimed. Freeing thus never needs the PFN lock; only
+ * growing a zone does.
+ *
+ * Lock ordering is PFN lock -> kmem_zones_lock -> magazine -> zone.
+ */
+
+#include <inttypes.h>
+
+#include "kdk/kmem.h"
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+struct kmem_magazine {
+	/*! Linkage in kmem_zone::magazines. */
+	TAILQ_ENTRY(kmem_magazine) queue_entry;
+	/*! Protects the rest; taken remotely only to gather statistics. */
+	kspinlock_t lock;
+	/*! Number of objects in objs. */
+	size_t count;
+	/*! The free objects. */
+	void *objs[KMEM_MAGAZINE_SIZE];
+	/*! Allocations and frees, and those satisfied without the zone. */
+	uint64_t nallocs, nfrees, nallochits, nfreehits;
+};
+
+/* linkage of a free object on its slab's free list */
+struct kmem_bufctl {
+	struct kmem_bufctl *next;
+};
+
+static TAILQ_HEAD(, kmem_zone) kmem_zones = TAILQ_HEAD_INITIALIZER(kmem_zones);
+static kspinlock_t kmem_zones_lock = KSPINLOCK_NAMED_INITIALISER(
+    "kmem_zones_lock");
+static unsigned	   kmem_nzones;
+/* each CPU's magazine of each zone, by zone index; created on first use */
+static struct kmem_magazine *kmem_magazines[KMEM_MAX_ZONES][KRX_MAX_CPUS];
+
+#define SIZE_ZONE(I, SIZE) \
+	KMEM_ZONE_INITIALISER(size_zones[I], "kmem_" #SIZE, SIZE)
+
+/* kmem_alloc() size classes; those larger than a page go unused */
+static kmem_zone_t size_zones[] = {
+	SIZE_ZONE(0, 16),
+	SIZE_ZONE(1, 32),
+	SIZE_ZONE(2, 64),
+	SIZE_ZONE(3, 128),
+	SIZE_ZONE(4, 256),
+	SIZE_ZONE(5, 512),
+	SIZE_ZONE(6, 1024),
+	SIZE_ZONE(7, 2048),
+	SIZE_ZONE(8, 4096),
+	SIZE_ZONE(9, 8192),
+	SIZE_ZONE(10, 16384),
+	SIZE_ZONE(11, 32768),
+	SIZE_ZONE(12, 65536),
+};
+
+static inline size_t
+zone_nperslab(kmem_zone_t *zone)
+{
+	return PGSIZE / zone->size;
+}
+
+static unsigned
+zone_register(kmem_zone_t *zone)
+{
+	ipl_t ipl = ke_spinlock_acquire(&kmem_zones_lock);
+
+	if (zone->index == 0) {
+		kassert(zone->size <= PGSIZE);
+		kassert(kmem_nzones < KMEM_MAX_ZONES);
+		TAILQ_INSERT_TAIL(&kmem_zones, zone, queue_entry);
+		__atomic_store_n(&zone->index, ++kmem_nzones, __ATOMIC_RELEASE);
+	}
+	ke_spinlock_release(&kmem_zones_lock, ipl);
+
+	return zone->index;
+}
+
+static struct kmem_magazine *
+magazine_get(kmem_zone_t *zone)
+{
+	unsigned	      index = __atomic_load_n(&zone->index,
+			       __ATOMIC_ACQUIRE);
+	struct kmem_magazine **slot, *mag;
+	ipl_t		       ipl;
+
+	if (index == 0)
+		index = zone_register(zone);
+
+	slot = &kmem_magazines[index - 1][ke_cpu_num()];
+	mag = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (mag != NULL)
+		return mag;
+
+	/* threads may share a CPU number, so another may be here first */
+	ipl = ke_spinlock_acquire(&kmem_zones_lock);
+	mag = *slot;
+	if (mag == NULL) {
+		mag = calloc(1, sizeof(*mag));
+		if (mag == NULL)
+			kfatal("Failed to allocate kmem magazine\n");
+		mag->lock = (kspinlock_t)KSPINLOCK_NAMED_INITIALISER(
+		    "kmem magazine");
+		TAILQ_INSERT_TAIL(&zone->magazines, mag, queue_entry);
+		__atomic_store_n(slot, mag, __ATOMIC_RELEASE);
+	}
+	ke_spinlock_release(&kmem_zones_lock, ipl);
+
+	return mag;
+}
+
+/* the list a slab belongs on, given its count of allocated objects */
+static inline struct kmem_slab_list *
+slab_list(kmem_zone_t *zone, vm_page_t *slab)
+{
+	if (slab->used_ptes == 0)
+		return &zone->empty;
+	else if (slab->used_ptes == zone_nperslab(zone))
+		return &zone->full;
+	else
+		return &zone->partial;
+}
+
+/*
+ * Take an object from the slabs, preferring partial ones.
+ * \pre zone lock held
+ */
+static void *
+slab_alloc(kmem_zone_t *zone)
+{
+	vm_page_t	   *slab;
+	struct kmem_bufctl *obj;
+
+	slab = TAILQ_FIRST(&zone->partial);
+	if (slab == NULL)
+		slab = TAILQ_FIRST(&zone->empty);
+	if (slab == NULL)
+		return NULL;
+
+	TAILQ_REMOVE(slab_list(zone, slab), slab, queue_link);
+	obj = (struct kmem_bufctl *)slab->referent_pte;
+	slab->referent_pte = (uintptr_t)obj->next;
+	slab->used_ptes++;
+	TAILQ_INSERT_HEAD(slab_list(zone, slab), slab, queue_link);
+	zone->nslaballocated++;
+
+	return obj;
+}
+
+/*
+ * Return an object to its slab.
+ * \pre zone lock held
+ */
+static void
+slab_free(kmem_zone_t *zone, void *ptr)
+{
+	vm_page_t	   *slab = vm_paddr_to_page(V2P(PGROUNDDOWN(ptr)));
+	struct kmem_bufctl *obj = ptr;
+
+	kassert(slab->use == kPageUseKMem && slab->owner == zone);
+	kassert(slab->used_ptes > 0);
+
+	TAILQ_REMOVE(slab_list(zone, slab), slab, queue_link);
+	obj->next = (struct kmem_bufctl *)slab->referent_pte;
+	slab->referent_pte = (uintptr_t)obj;
+	slab->used_ptes--;
+	TAILQ_INSERT_HEAD(slab_list(zone, slab), slab, queue_link);
+	zone->nslaballocated--;
+}
+
+/*
+ * Allocate from this CPU's magazine, refilling it from the slabs if need be.
+ * Returns NULL if the zone needs to grow.
+ */
+static void *
+zonealloc_fast(kmem_zone_t *zone)
+{
+	struct kmem_magazine *mag = magazine_get(zone);
+	void		     *obj = NULL;
+	ipl_t		      ipl;
+
+	ipl = ke_spinlock_acquire(&mag->lock);
+	if (mag->count > 0) {
+		mag->nallochits++;
+	} else {
+		ipl_t zone_ipl = ke_spinlock_acquire(&zone->lock);
+		while (mag->count < KMEM_MAGAZINE_SIZE / 2) {
+			void *refill = slab_alloc(zone);
+			if (refill == NULL)
+				break;
+			mag->objs[mag->count++] = refill;
+		}
+		ke_spinlock_release(&zone->lock, zone_ipl);
+	}
+
+	if (mag->count > 0) {
+		obj = mag->objs[--mag->count];
+		mag->nallocs++;
+	}
+	ke_spinlock_release(&mag->lock, ipl);
+
+	return obj;
+}
+
+/*
+ * Add a new slab to a zone.
+ * \pre PFN lock held, no kmem locks held.
+ */
+static bool
+zone_grow_locked(kmem_zone_t *zone)
+{
+	struct kmem_bufctl *head = NULL;
+	vm_page_t	   *slab;
+	char		   *base;
+	ipl_t		    ipl;
+
+	if (vmp_page_alloc_locked(&slab, NULL, kPageUseKMem, false) != 0)
+		return false;
+
+	base = (char *)vm_page_direct_map_addr(slab);
+	for (size_t i = zone_nperslab(zone); i-- > 0;) {
+		struct kmem_bufctl *obj = (void *)(base + i * zone->size);
+		obj->next = head;
+		head = obj;
+	}
+	slab->owner = zone;
+	slab->referent_pte = (uintptr_t)head;
+
+	ipl = ke_spinlock_acquire(&zone->lock);
+	TAILQ_INSERT_TAIL(&zone->empty, slab, queue_link);
+	zone->nslabs++;
+	zone->ngrows++;
+	ke_spinlock_release(&zone->lock, ipl);
+
+	return true;
+}
+
+void *
+vmp_kmem_zonealloc_locked(kmem_zone_t *zone)
+{
+	void *obj;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	while ((obj = zonealloc_fast(zone)) == NULL)
+		if (!zone_grow_locked(zone))
+			return NULL;
+
+	return obj;
+}
+
+void *
+kmem_zonealloc(kmem_zone_t *zone)
+{
+	void *obj;
+	ipl_t ipl;
+
+	obj = zonealloc_fast(zone);
+	if (obj != NULL)
+		return obj;
+
+	ipl = vmp_acquire_pfn_lock();
+	obj = vmp_kmem_zonealloc_locked(zone);
+	vmp_release_pfn_lock(ipl);
+
+	return obj;
+}
+
+void
+kmem_zonefree(kmem_zone_t *zone, void *ptr)
+{
+	struct kmem_magazine *mag = magazine_get(zone);
+	ipl_t		      ipl;
+
+	ipl = ke_spinlock_acquire(&mag->lock);
+	if (mag->count == KMEM_MAGAZINE_SIZE) {
+		ipl_t zone_ipl = ke_spinlock_acquire(&zone->lock);
+		while (mag->count > KMEM_MAGAZINE_SIZE / 2)
+			slab_free(zone, mag->objs[--mag->count]);
+		ke_spinlock_release(&zone->lock, zone_ipl);
+	} else {
+		mag->nfreehits++;
+	}
+	mag->objs[mag->count++] = ptr;
+	mag->nfrees++;
+	ke_spinlock_release(&mag->lock, ipl);
+}
+
+/*
+ * Give up to \p count of a zone's empty slabs back to the VM.
+ * \pre PFN lock held, zone lock held
+ */
+static size_t
+zone_reap(kmem_zone_t *zone, size_t count)
+{
+	vm_page_t *slab;
+	size_t	   n;
+
+	for (n = 0; n < count && (slab = TAILQ_FIRST(&zone->empty)) != NULL;
+	     n++) {
+		TAILQ_REMOVE(&zone->empty, slab, queue_link);
+		zone->nslabs--;
+		zone->nreaped++;
+		slab->owner = NULL;
+		slab->referent_pte = 0;
+		vmp_page_delete_locked(slab, NULL, true);
+	}
+
+	return n;
+}
+
+size_t
+vmp_kmem_reap_locked(size_t count, bool drain_magazines)
+{
+	kmem_zone_t *zone;
+	size_t	     n = 0;
+	ipl_t	     ipl;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	ipl = ke_spinlock_acquire(&kmem_zones_lock);
+	TAILQ_FOREACH (zone, &kmem_zones, queue_entry) {
+		ipl_t zone_ipl = ke_spinlock_acquire(&zone->lock);
+		n += zone_reap(zone, count - n);
+		ke_spinlock_release(&zone->lock, zone_ipl);
+	}
+
+	/*
+	 * still short: the magazines may be holding the last objects of some
+	 * slabs, so empty them all and try again.
+	 */
+	for (zone = TAILQ_FIRST(&kmem_zones);
+	     drain_magazines && zone != NULL && n < count;
+	     zone = TAILQ_NEXT(zone, queue_entry)) {
+		struct kmem_magazine *mag;
+		ipl_t		      zone_ipl;
+
+		TAILQ_FOREACH (mag, &zone->magazines, queue_entry) {
+			ipl_t mag_ipl = ke_spinlock_acquire(&mag->lock);
+			zone_ipl = ke_spinlock_acquire(&zone->lock);
+			while (mag->count > 0)
+				slab_free(zone, mag->objs[--mag->count]);
+			ke_spinlock_release(&zone->lock, zone_ipl);
+			ke_spinlock_release(&mag->lock, mag_ipl);
+		}
+
+		zone_ipl = ke_spinlock_acquire(&zone->lock);
+		n += zone_reap(zone, count - n);
+		ke_spinlock_release(&zone->lock, zone_ipl);
+	}
+	ke_spinlock_release(&kmem_zones_lock, ipl);
+
+	return n;
+}
+
+static kmem_zone_t *
+size_zone(size_t size)
+{
+	for (size_t i = 0; i < elementsof(size_zones); i++)
+		if (size_zones[i].size >= size)
+			return size_zones[i].size <= PGSIZE ? &size_zones[i] :
+							      NULL;
+	return NULL;
+}
+
+void *
+kmem_alloc(size_t size)
+{
+	kmem_zone_t *zone = size_zone(size);
+
+	if (zone == NULL)
+		return malloc(size);
+
+	return kmem_zonealloc(zone);
+}
+
+void
+kmem_free(void *ptr, size_t size)
+{
+	kmem_zone_t *zone = size_zone(size);
+
+	if (zone == NULL)
+		free(ptr);
+	else
+		kmem_zonefree(zone, ptr);
+}
+
+void
+kmem_zone_get_stats(kmem_zone_t *zone, struct kmem_zone_stats *stats)
+{
+	struct kmem_magazine *mag;
+	ipl_t		      ipl, zone_ipl;
+
+	memset(stats, 0x0, sizeof(*stats));
+	stats->name = zone->name;
+	stats->size = zone->size;
+	stats->nperslab = zone_nperslab(zone);
+
+	ipl = ke_spinlock_acquire(&kmem_zones_lock);
+	TAILQ_FOREACH (mag, &zone->magazines, queue_entry) {
+		ipl_t mag_ipl = ke_spinlock_acquire(&mag->lock);
+		stats->nmagazine += mag->count;
+		stats->nallocs += mag->nallocs;
+		stats->nfrees += mag->nfrees;
+		stats->nallochits += mag->nallochits;
+		stats->nfreehits += mag->nfreehits;
+		ke_spinlock_release(&mag->lock, mag_ipl);
+	}
+
+	zone_ipl = ke_spinlock_acquire(&zone->lock);
+	stats->nslabs = zone->nslabs;
+	/* magazines may have moved meanwhile; this is only a snapshot */
+	stats->ninuse = zone->nslaballocated > stats->nmagazine ?
+	    zone->nslaballocated - stats->nmagazine :
+	    0;
+	stats->ngrows = zone->ngrows;
+	stats->nreaped = zone->nreaped;
+	ke_spinlock_release(&zone->lock, zone_ipl);
+	ke_spinlock_release(&kmem_zones_lock, ipl);
+}
+
+void
+kmem_dump(void)
+{
+	kmem_zone_t *zones[KMEM_MAX_ZONES], *zone;
+	size_t	     nzones = 0;
+	ipl_t	     ipl;
+
+	ipl = ke_spinlock_acquire(&kmem_zones_lock);
+	TAILQ_FOREACH (zone, &kmem_zones, queue_entry)
+		zones[nzones++] = zone;
+	ke_spinlock_release(&kmem_zones_lock, ipl);
+
+	kprintf("\033[7m%-12s%-7s%-7s%-7s%-8s%-9s%-10s%-10s%-7s%-7s\033[m\n",
+	    "name", "size", "slabs", "inuse", "cached", "bytes", "allocs",
+	    "maghit%", "grows", "reaps");
+	for (size_t i = 0; i < nzones; i++) {
+		struct kmem_zone_stats stats;
+
+		kmem_zone_get_stats(zones[i], &stats);
+		kprintf("%-12s%-7zu%-7zu%-7zu%-8zu%-9zu%-10" PRIu64
+			"%-10.1f%-7" PRIu64 "%-7" PRIu64 "\n",
+		    stats.name, stats.size, stats.nslabs, stats.ninuse,
+		    stats.nmagazine, stats.nslabs * PGSIZE,
+		    stats.nallocs,
+		    stats.nallocs == 0 ?
+			0.0 :
+			100.0 * stats.nallochits / stats.nallocs,
+		    stats.ngrows, stats.nreaped);
+	}
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file mdl.c
+ * @brief Memory descriptor lists.
+ *
+ * An MDL wires the pages of a range of a process' memory, so that I/O can
+ * address them physically. Each page is faulted on as an access by the
+ * process would be, with the fault taking the wire, under one hold of the
+ * process' mutex and PFN lock for the whole range.
+ *
+ * The wire is an ordinary reference charged to the wires of the process'
+ * account. It keeps the page active, and so off the standby and modified
+ * queues, whatever becomes of its mapping; and it keeps the page where it is,
+ * as nothing migrates or merges a page another holds a reference to.
+ */
+
+#include "kdk/kmem.h"
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+static size_t
+mdl_size(size_t npages)
+{
+	return sizeof(vm_mdl_t) + sizeof(vm_page_t *) * npages;
+}
+
+/* unwire the first npages pages of an MDL */
+static void
+mdl_unwire_locked(vm_mdl_t *mdl, size_t npages)
+{
+	vm_account_t *account = &mdl->vmps->account;
+
+	for (size_t i = 0; i < npages; i++) {
+		vm_page_t *page = mdl->pages[i];
+
+		if (page->use == kPageUseMerged) {
+			vmp_merge_page_unwire(page, account);
+			continue;
+		}
+		/* the I/O wrote it behind the MMU's back */
+		if (mdl->write && page->use == kPageUseAnonPrivate)
+			page->dirty = true;
+		vmp_page_release_locked(page, account);
+	}
+}
+
+/* whether a VAD covers private anonymous memory allowing the access */
+static bool
+vad_allows(vm_vad_t *vad, bool write)
+{
+	return vad != NULL && vad->section == NULL &&
+	    (!write || (vad->flags.protection & kVMWrite));
+}
+
+vm_mdl_t *
+vm_mdl_build(vmp_procstate_t *vmps, vaddr_t vaddr, size_t length, bool write)
+{
+	vaddr_t	  start = PGROUNDDOWN(vaddr), end;
+	vm_vad_t *vad = NULL;
+	vm_mdl_t *mdl;
+	size_t	  n = 0;
+	ipl_t	  ipl;
+
+	if (length == 0)
+		return NULL;
+
+	end = PGROUNDUP(vaddr + length);
+	mdl = kmem_alloc(mdl_size((end - start) / PGSIZE));
+	if (mdl == NULL)
+		return NULL;
+	mdl->vmps = vmps;
+	mdl->offset = vaddr - start;
+	mdl->length = length;
+	mdl->write = write;
+	mdl->npages = (end - start) / PGSIZE;
+
+	ke_wait(&vmps->mutex, "vm_mdl_build:vmps->mutex", false, false, -1);
+	ipl = vmp_acquire_pfn_lock();
+
+	for (vaddr_t va = start; va < end; va += PGSIZE, n++) {
+		struct vmp_md_fault_state state;
+		bool			  made_writeable;
+
+		if (vad == NULL || va >= vad->end) {
+			vad = vmp_ps_vad_find(vmps, va);
+			if (!vad_allows(vad, write))
+				break;
+		}
+
+		memset(&state, 0x0, sizeof(state));
+		for (;;) {
+			made_writeable = false;
+			vmp_fault_locked(vmps, vad, &state, va, write,
+			    &made_writeable, &vmps->account, &mdl->pages[n]);
+			if (!write || made_writeable)
+				break;
+			/* mapped read-only; go again to make it writeable */
+			vmp_page_release_locked(mdl->pages[n], &vmps->account);
+		}
+		vmp_md_fault_state_release(vmps, &state);
+	}
+
+	if (n < mdl->npages)
+		mdl_unwire_locked(mdl, n);
+
+	vmp_release_pfn_lock(ipl);
+	ke_mutex_release(&vmps->mutex);
+
+	if (n < mdl->npages) {
+		kmem_free(mdl, mdl_size(mdl->npages));
+		return NULL;
+	}
+
+	return mdl;
+}
+
+void
+vm_mdl_release(vm_mdl_t *mdl)
+{
+	ipl_t ipl = vmp_acquire_pfn_lock();
+
+	mdl_unwire_locked(mdl, mdl->npages);
+	vmp_release_pfn_lock(ipl);
+
+	kmem_free(mdl, mdl_size(mdl->npages));
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file merge.c
+ * @brief Same-page merging of private anonymous pages.
+ *
+ * A scanner walks the private anonymous memory of a process, a batch of pages
+ * at a time, hashing each resident private page into its offset field. A page
+ * whose hash is unchanged since the last pass is taken to be stable, and is
+ * then merged: into the zero page if it is all zeroes, otherwise into a shared
+ * page of the same contents. The private page is freed and its PTE made a
+ * read-only mapping of the shared page; writing to it copies it out again, as
+ * the zero page is.
+ *
+ * Shared pages are found by hash in a small table of buckets. A stable page
+ * that matches no shared page is noted in the unstable table, a direct-mapped
+ * table of candidate pages holding no references; each entry is checked to
+ * still be a private page of the hash noted before it is used. When a later
+ * stable page matches a candidate, it becomes a shared page itself, and the
+ * candidate is merged into it once the scanner comes back to it.
+ *
+ * Each PTE mapping a shared page holds a reference to it, charged to no
+ * account; the process' account is credited with the private page that was
+ * merged away. Like the zero page, shared pages are not in any working set
+ * and are never paged out. The last unmapping frees a shared page.
+ *
+ * The scanner holds the process' mutex and the PFNDB lock for its batch; the
+ * tables and statistics are under the PFNDB lock.
+ */
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+#define MERGE_BUCKETS 64
+#define MERGE_UNSTABLE_ENTRIES 256
+/*! Hashes are kept in vm_page_t::offset, which is this wide. */
+#define MERGE_HASH_MASK ((1ULL << 48) - 1)
+
+struct merge_candidate {
+	vm_page_t *page;
+	uint64_t   hash;
+};
+
+/*! shared pages, by hash; linked through queue_link */
+static TAILQ_HEAD(, vm_page) merge_buckets[MERGE_BUCKETS];
+static struct merge_candidate merge_unstable[MERGE_UNSTABLE_ENTRIES];
+static struct vm_merge_stats  merge_stats;
+static bool		      merge_inited;
+
+/* FNV-1a, folded to the width of the offset field; never 0 */
+static uint64_t
+page_hash(vm_page_t *page)
+{
+	const uint64_t *words = (uint64_t *)vm_page_direct_map_addr(page);
+	uint64_t	hash = 0xcbf29ce484222325ULL;
+
+	for (size_t i = 0; i < PGSIZE / sizeof(uint64_t); i++) {
+		hash ^= words[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	hash = (hash ^ (hash >> 48)) & MERGE_HASH_MASK;
+	return hash == 0 ? 1 : hash;
+}
+
+static bool
+page_is_zero(vm_page_t *page)
+{
+	const uint64_t *words = (uint64_t *)vm_page_direct_map_addr(page);
+
+	for (size_t i = 0; i < PGSIZE / sizeof(uint64_t); i++)
+		if (words[i] != 0)
+			return false;
+	return true;
+}
+
+static bool
+page_equal(vm_page_t *x, vm_page_t *y)
+{
+	return memcmp((void *)vm_page_direct_map_addr(x),
+		   (void *)vm_page_direct_map_addr(y), PGSIZE) == 0;
+}
+
+static void
+merge_init(void)
+{
+	for (size_t i = 0; i < MERGE_BUCKETS; i++)
+		TAILQ_INIT(&merge_buckets[i]);
+	merge_inited = true;
+}
+
+static vm_page_t *
+shared_find(vm_page_t *page, uint64_t hash)
+{
+	vm_page_t *shared;
+
+	TAILQ_FOREACH (shared, &merge_buckets[hash % MERGE_BUCKETS],
+	    queue_link)
+		if (shared->offset == hash && page_equal(shared, page))
+			return shared;
+
+	return NULL;
+}
+
+/*
+ * Stop the process writing to a page while it is compared, so that it can't
+ * change between the comparison and the merge.
+ */
+static void
+write_protect(vmp_procstate_t *vmps, vaddr_t vaddr, pte_t *pte,
+    vm_page_t *page)
+{
+	if (!vmp_md_pte_is_writeable(pte))
+		return;
+
+	page->dirty = true;
+	pte->hw.writeable = 0;
+	vmp_md_tlb_invalidate(vmps, vaddr, vaddr + PGSIZE, kVMTLBInvalMerge);
+}
+
+/* take a private page out of the working set and free it */
+static void
+private_page_free(vmp_procstate_t *vmps, vaddr_t vaddr, vm_page_t *page)
+{
+	vmp_wsl_remove(vmps, vaddr);
+	vmp_page_delete_locked(page, &vmps->account, true);
+}
+
+/* replace a private page's mapping with a read-only mapping of \p to */
+static void
+merge_into(vmp_procstate_t *vmps, vaddr_t vaddr, pte_t *pte, vm_page_t *page,
+    vm_page_t *to)
+{
+	/* the leaf table's used_ptes and references are unchanged */
+	vmp_md_pte_make_hw(pte, to->pfn, false);
+	vmp_md_tlb_invalidate(vmps, vaddr, vaddr + PGSIZE, kVMTLBInvalMerge);
+	private_page_free(vmps, vaddr, page);
+}
+
+/* make a mapped private page a shared page, keeping the mapping's reference */
+static void
+make_shared(vmp_procstate_t *vmps, vaddr_t vaddr, vm_page_t *page,
+    uint64_t hash)
+{
+	vmp_wsl_remove(vmps, vaddr);
+
+	/* its contents are no longer those of any pagefile copy */
+	if (page->swap_descriptor != 0) {
+		vmp_pagefile_slot_free(page->swap_descriptor);
+		page->swap_descriptor = 0;
+	}
+
+	vmp_account_add(&vmps->account, -1, -1);
+	vmp_page_set_use_locked(page, kPageUseMerged);
+	page->dirty = false;
+	page->owner = NULL;
+	page->referent_pte = 0;
+	page->offset = hash;
+	TAILQ_INSERT_TAIL(&merge_buckets[hash % MERGE_BUCKETS], page,
+	    queue_link);
+
+	merge_stats.npages++;
+	merge_stats.nsharing++;
+}
+
+/*
+ * Consider merging the private page mapped by a valid PTE. Returns whether
+ * it was merged away.
+ */
+static bool
+merge_page(vmp_procstate_t *vmps, vaddr_t vaddr, pte_t *pte)
+{
+	vm_page_t	       *page = vmp_md_pte_page(pte), *shared;
+	struct merge_candidate *cand;
+	uint64_t		hash;
+
+	/* a wired page must keep its frame */
+	if (page->use != kPageUseAnonPrivate || page->refcnt != 1)
+		return false;
+
+	merge_stats.nscanned++;
+	hash = page_hash(page);
+	if (hash != page->offset) {
+		/* new or changed since the last pass */
+		page->offset = hash;
+		return false;
+	}
+
+	if (vmp_zero_page_enabled && page_is_zero(page)) {
+		write_protect(vmps, vaddr, pte, page);
+		if (!page_is_zero(page))
+			return false;
+		merge_into(vmps, vaddr, pte, page, vmp_zero_page);
+		merge_stats.nmergedzero++;
+		return true;
+	}
+
+	if (shared_find(page, hash) != NULL) {
+		write_protect(vmps, vaddr, pte, page);
+		/* the page may have changed before it was protected */
+		shared = shared_find(page, hash);
+		if (shared == NULL)
+			return false;
+		vmp_page_retain_locked(shared, NULL);
+		merge_into(vmps, vaddr, pte, page, shared);
+		merge_stats.nsharing++;
+		merge_stats.nmerged++;
+		return true;
+	}
+
+	cand = &merge_unstable[hash % MERGE_UNSTABLE_ENTRIES];
+	if (cand->page != NULL && cand->page != page &&
+	    cand->page->use == kPageUseAnonPrivate &&
+	    cand->page->offset == cand->hash && cand->hash == hash &&
+	    page_equal(cand->page, page)) {
+		write_protect(vmps, vaddr, pte, page);
+		if (page_equal(cand->page, page)) {
+			/* the candidate will be merged into it when next seen */
+			make_shared(vmps, vaddr, page, hash);
+			cand->page = NULL;
+			return false;
+		}
+	}
+
+	cand->page = page;
+	cand->hash = hash;
+	return false;
+}
+
+size_t
+vm_ps_merge_scan(vmp_procstate_t *vmps, size_t npages)
+{
+	vm_vad_t *vad;
+	vaddr_t	  vaddr;
+	size_t	  nmerged = 0;
+	uint64_t  begin;
+	ipl_t	  ipl;
+
+	ke_wait(&vmps->mutex, "vm_ps_merge_scan:vmps->mutex", false, false,
+	    -1);
+	ipl = vmp_acquire_pfn_lock();
+	begin = ke_nanotime();
+
+	if (!merge_inited)
+		merge_init();
+
+	vaddr = vmps->merge_cursor;
+	vad = RB_MIN(vm_vad_rbtree, &vmps->vad_queue);
+	while (vad != NULL && vad->end <= vaddr)
+		vad = RB_NEXT(vm_vad_rbtree, &vmps->vad_queue, vad);
+
+	while (npages > 0) {
+		pte_t *pte;
+
+		if (vad == NULL) {
+			/* end of a pass; begin the next with the next batch */
+			merge_stats.npasses++;
+			vaddr = 0;
+			break;
+		}
+		if (vad->section != NULL || vaddr >= vad->end) {
+			vad = RB_NEXT(vm_vad_rbtree, &vmps->vad_queue, vad);
+			continue;
+		}
+		if (vaddr < vad->start)
+			vaddr = vad->start;
+
+		if (vmp_mp_fetch_pte(vmps, vaddr, &pte, NULL) == 0 &&
+		    vmp_md_pte_is_valid(pte))
+			nmerged += merge_page(vmps, vaddr, pte);
+
+		vaddr += PGSIZE;
+		npages--;
+	}
+
+	vmps->merge_cursor = vaddr;
+	merge_stats.scan_ns += ke_nanotime() - begin;
+
+	vmp_release_pfn_lock(ipl);
+	ke_mutex_release(&vmps->mutex);
+
+	return nmerged;
+}
+
+void
+vm_merge_get_stats(struct vm_merge_stats *stats)
+{
+	ipl_t ipl = vmp_acquire_pfn_lock();
+	*stats = merge_stats;
+	vmp_release_pfn_lock(ipl);
+}
+
+/* drop a reference to a shared page, freeing it if it was the last */
+static void
+shared_put(vm_page_t *page, vm_account_t *account)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(page->use == kPageUseMerged && page->refcnt > 0);
+
+	if (page->refcnt > 1) {
+		vmp_page_release_locked(page, account);
+		return;
+	}
+
+	TAILQ_REMOVE(&merge_buckets[page->offset % MERGE_BUCKETS], page,
+	    queue_link);
+	merge_stats.npages--;
+	/* the account was only charged the wire */
+	vmp_account_add(account, 0, -1);
+	vmp_page_delete_locked(page, NULL, true);
+}
+
+void
+vmp_merge_page_release(vm_page_t *page)
+{
+	merge_stats.nsharing--;
+	shared_put(page, NULL);
+}
+
+void
+vmp_merge_page_unwire(vm_page_t *page, vm_account_t *account)
+{
+	shared_put(page, account);
+}
@@ -30,58 +30,80 @@
 #define DEFINE_PAGEQUEUE(NAME) \
 	static page_queue_t NAME = TAILQ_HEAD_INITIALIZER(NAME)
 
-typedef TAILQ_HEAD(, vm_page) page_queue_t;
-
-struct vmp_pregion {
-	/*! Linkage to pregion_queue. */
-	TAILQ_ENTRY(vmp_pregion) queue_entry;
-	/*! Base address of region. */
-	paddr_t base;
-	/*! Number of pages the region covers. */
-	size_t npages;
-	/*! PFN database part for region. */
-	vm_page_t pages[0];
-};
+typedef TAILQ_HEAD(vm_page_queue, vm_page) page_queue_t;
 
-DEFINE_PAGEQUEUE(vm_pagequeue_free);
+/*! Free pages of each tier. */
+static page_queue_t vm_pagequeue_free[kVMTierMax] = {
+	TAILQ_HEAD_INITIALIZER(vm_pagequeue_free[kVMTierFast]),
+	TAILQ_HEAD_INITIALIZER(vm_pagequeue_free[kVMTierSlow]),
+};
 DEFINE_PAGEQUEUE(vm_pagequeue_modified);
 DEFINE_PAGEQUEUE(vm_pagequeue_standby);
-static TAILQ_HEAD(, vmp_pregion) pregion_queue = TAILQ_HEAD_INITIALIZER(
-    pregion_queue);
-struct vm_stat vmstat;
-kspinlock_t    vmp_pfn_lock = KSPINLOCK_INITIALISER;
-vm_account_t   deleted_account;
+/*! Empty (hence zeroed) pagetable pages kept for reuse; hottest at head. */
+DEFINE_PAGEQUEUE(vm_pagequeue_ptcache);
+struct vmp_pregion_queue vmp_pregion_queue = TAILQ_HEAD_INITIALIZER(
+    vmp_pregion_queue);
+/*! Length of vm_pagequeue_ptcache. */
+static size_t	    ptcache_count;
+size_t		    vmp_tier_npages[kVMTierMax], vmp_tier_nfree[kVMTierMax];
+struct vmp_stat_cpu vmp_stat_cpus[KRX_MAX_CPUS];
+kspinlock_t	    vmp_pfn_lock = KSPINLOCK_NAMED_INITIALISER("vmp_pfn_lock");
+vm_account_t	    deleted_account;
+size_t		    vmp_ptcache_max = VMP_PTCACHE_DEFAULT_MAX;
+vm_page_t	   *vmp_zero_page;
+bool		    vmp_zero_page_enabled = true;
 
 static inline void
 update_page_use_stats(enum vm_page_use use, int value)
 {
 	kassert(ke_spinlock_held(&vmp_pfn_lock));
 
-#define CASE(ENUM, VAR)              \
-	case ENUM:                   \
-		vmstat.VAR += value; \
+#define CASE(ENUM, VAR)                   \
+	case ENUM:                        \
+		VMP_STAT_ADD(VAR, value); \
 		break
 
 	switch (use) {
 	case kPageUseDeleted:
-		vmstat.ndeleted += value;
+		VMP_STAT_ADD(ndeleted, value);
 		break;
 
 	case kPageUseAnonPrivate:
-		vmstat.nanonprivate += value;
+		VMP_STAT_ADD(nanonprivate, value);
 		break;
 
 		CASE(kPageUsePML3, nprocpgtable);
 		CASE(kPageUsePML2, nprocpgtable);
 		CASE(kPageUsePML1, nprocpgtable);
+		CASE(kPageUseZero, nkwired);
+		CASE(kPageUseKMem, nkwired);
+		CASE(kPageUseZCache, nzcache);
+		CASE(kPageUseMerged, nmerged);
 
 	default:
 		kfatal("Handle\n");
 	}
 }
 
+/* put a free page on the free queue of its tier */
+static void
+free_enqueue(vm_page_t *page)
+{
+	TAILQ_INSERT_TAIL(&vm_pagequeue_free[page->tier], page, queue_link);
+	vmp_tier_nfree[page->tier]++;
+	VMP_STAT_INC(nfree);
+}
+
+static void
+free_dequeue(vm_page_t *page)
+{
+	TAILQ_REMOVE(&vm_pagequeue_free[page->tier], page, queue_link);
+	vmp_tier_nfree[page->tier]--;
+	VMP_STAT_DEC(nfree);
+}
+
 void
-vm_region_add(paddr_t base, size_t length)
+vm_region_add(paddr_t base, size_t length, enum vm_mem_tier tier)
 {
 	struct vmp_pregion *bm = (void *)P2V(base);
 	size_t		    used; /* n bytes used by bitmap struct */
@@ -90,19 +112,22 @@ vm_region_add(paddr_t base, size_t length)
 	/* set up a pregion for this area */
 	bm->base = base;
 	bm->npages = length / PGSIZE;
+	bm->tier = tier;
 
 	used = ROUNDUP(sizeof(struct vmp_pregion) +
 		sizeof(vm_page_t) * bm->npages,
 	    PGSIZE);
 
 	kprintf("VM: Usable memory area: 0x%zx-0x%zx"
-		"(%zu MiB, %zu pages)\n",
-	    base, base + length, length / (1024 * 1024), length / PGSIZE);
+		"(%zu MiB, %zu pages, %s tier)\n",
+	    base, base + length, length / (1024 * 1024), length / PGSIZE,
+	    tier == kVMTierFast ? "fast" : "slow");
 	kprintf("VM: %zu KiB for PFN database part\n", used / 1024);
 
 	/* initialise pages */
 	for (b = 0; b < bm->npages; b++) {
 		bm->pages[b].pfn = PADDR_TO_PFN(bm->base + PGSIZE * b);
+		bm->pages[b].tier = tier;
 		// bm->pages[b].anon = NULL;
 		// LIST_INIT(&bm->pages[b].pv_list);
 	}
@@ -111,20 +136,27 @@ vm_region_add(paddr_t base, size_t length)
 	for (b = 0; b < used / PGSIZE; b++) {
 		bm->pages[b].use = kPageUsePFNDB;
 		bm->pages[b].refcnt = 1;
-		vmstat.npwired++;
+		VMP_STAT_INC(npwired);
 	}
 
 	/* now zero the remainder */
 	for (; b < bm->npages; b++) {
 		bm->pages[b].use = kPageUseFree;
-		TAILQ_INSERT_TAIL(&vm_pagequeue_free, &bm->pages[b],
-		    queue_link);
+		free_enqueue(&bm->pages[b]);
 	}
 
-	vmstat.nfree += bm->npages - (used / PGSIZE);
-	// vmstat.ntotal += bm->npages;
+	vmp_tier_npages[tier] += bm->npages;
+	// VMP_STAT_ADD(ntotal, bm->npages);
 
-	TAILQ_INSERT_TAIL(&pregion_queue, bm, queue_entry);
+	TAILQ_INSERT_TAIL(&vmp_pregion_queue, bm, queue_entry);
+
+	if (vmp_zero_page == NULL) {
+		ipl_t ipl = vmp_acquire_pfn_lock();
+		int   r = vmp_page_alloc_locked(&vmp_zero_page, NULL,
+			  kPageUseZero, false);
+		kassert(r == 0);
+		vmp_release_pfn_lock(ipl);
+	}
 }
 
 vm_page_t *
@@ -132,7 +164,7 @@ vm_paddr_to_page(paddr_t paddr)
 {
 	struct vmp_pregion *preg;
 
-	TAILQ_FOREACH (preg, &pregion_queue, queue_entry) {
+	TAILQ_FOREACH (preg, &vmp_pregion_queue, queue_entry) {
 		if (preg->base <= paddr &&
 		    (preg->base + PGSIZE * preg->npages) > paddr) {
 			return &preg->pages[(paddr - preg->base) / PGSIZE];
@@ -143,18 +175,13 @@ vm_paddr_to_page(paddr_t paddr)
 	return NULL;
 }
 
-int
-vmp_page_alloc_locked(vm_page_t **out, vm_account_t *account,
-    enum vm_page_use use, bool must)
+/*
+ * Set up a page just taken off the free queue or pagetable cache for \p use,
+ * with one reference charged to \p account.
+ */
+static void
+page_setup(vm_page_t *page, vm_account_t *account, enum vm_page_use use)
 {
-	vm_page_t *page;
-
-	kassert(ke_spinlock_held(&vmp_pfn_lock));
-
-	page = TAILQ_FIRST(&vm_pagequeue_free);
-	kassert(page != NULL);
-	TAILQ_REMOVE(&vm_pagequeue_free, page, queue_link);
-
 #ifdef KRX_VM_SANITY_CHECKING
 	kassert(page->refcnt == 0);
 	kassert(page->used_ptes == 0);
@@ -171,11 +198,41 @@ vmp_page_alloc_locked(vm_page_t **out, vm_account_t *account,
 	page->swap_descriptor = 0;
 	page->used_ptes = 0;
 
-	vmstat.nfree--;
-	vmstat.nactive++;
-	account->nalloced++;
-	account->nwires++;
+	VMP_STAT_INC(nactive);
+	vmp_account_add(account, 1, 1);
 	update_page_use_stats(use, 1);
+	VMP_TRACE(kVMTracePageAlloc, NULL, page->pfn, 0, use);
+}
+
+int
+vmp_page_alloc_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use, bool must)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	if (TAILQ_EMPTY(&vm_pagequeue_free[kVMTierFast]) &&
+	    TAILQ_EMPTY(&vm_pagequeue_free[kVMTierSlow]))
+		vmp_page_reclaim_locked(VMP_RECLAIM_BATCH);
+
+	return vmp_page_alloc_free_locked(out, account, use);
+}
+
+int
+vmp_page_alloc_free_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use)
+{
+	vm_page_t *page;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	page = TAILQ_FIRST(&vm_pagequeue_free[kVMTierFast]);
+	if (page == NULL)
+		page = TAILQ_FIRST(&vm_pagequeue_free[kVMTierSlow]);
+	if (page == NULL)
+		return kVMFaultRetPageShortage;
+	free_dequeue(page);
+
+	page_setup(page, account, use);
 
 	*out = page;
 
@@ -184,6 +241,174 @@ vmp_page_alloc_locked(vm_page_t **out, vm_account_t *account,
 	return 0;
 }
 
+int
+vmp_pagetable_page_alloc_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use)
+{
+	vm_page_t *page;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	page = TAILQ_FIRST(&vm_pagequeue_ptcache);
+	if (page == NULL) {
+		VMP_STAT_INC(nptcachemiss);
+		return vmp_page_alloc_locked(out, account, use, false);
+	}
+	TAILQ_REMOVE(&vm_pagequeue_ptcache, page, queue_link);
+	ptcache_count--;
+	VMP_STAT_DEC(nptcached);
+	VMP_STAT_INC(nptcachehit);
+
+	/* its entries were all emptied before it was cached; no need to zero */
+	page_setup(page, account, use);
+
+	*out = page;
+
+	return 0;
+}
+
+void
+vmp_pagetable_page_free_locked(vm_page_t *page, vm_account_t *account)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(page->refcnt == 1 && page->used_ptes == 0);
+
+	if (ptcache_count >= vmp_ptcache_max) {
+		vmp_page_delete_locked(page, account, true);
+		return;
+	}
+
+#ifdef KRX_VM_SANITY_CHECKING
+	for (size_t i = 0; i < PGSIZE / sizeof(uint64_t); i++)
+		kassert(((uint64_t *)vm_page_direct_map_addr(page))[i] == 0);
+#endif
+
+	update_page_use_stats(page->use, -1);
+	vmp_account_add(account, -1, -1);
+	VMP_STAT_DEC(nactive);
+	VMP_TRACE(kVMTracePageFree, NULL, page->pfn, 0, page->use);
+
+	page->refcnt = 0;
+	page->referent_pte = 0;
+	/* tells it apart from pages of the free queue */
+	page->owner = &vm_pagequeue_ptcache;
+	page->use = kPageUseFree;
+	TAILQ_INSERT_HEAD(&vm_pagequeue_ptcache, page, queue_link);
+	ptcache_count++;
+	VMP_STAT_INC(nptcached);
+}
+
+/*
+ * Give back up to \p count pages from the pagetable cache to the free queue,
+ * coldest first.
+ */
+static size_t
+ptcache_drain(size_t count)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		vm_page_t *page = TAILQ_LAST(&vm_pagequeue_ptcache,
+		    vm_page_queue);
+
+		if (page == NULL)
+			break;
+
+		TAILQ_REMOVE(&vm_pagequeue_ptcache, page, queue_link);
+		ptcache_count--;
+		VMP_STAT_DEC(nptcached);
+		page->owner = NULL;
+		free_enqueue(page);
+		VMP_STAT_INC(nptcachedrain);
+	}
+
+	return n;
+}
+
+/* take a free page off the free queue or pagetable cache, whichever it is on */
+static void
+page_unqueue_free(vm_page_t *page)
+{
+	if (page->owner == &vm_pagequeue_ptcache) {
+		TAILQ_REMOVE(&vm_pagequeue_ptcache, page, queue_link);
+		ptcache_count--;
+		VMP_STAT_DEC(nptcached);
+	} else {
+		free_dequeue(page);
+	}
+}
+
+/* find an aligned run of npages free pages within the regions of a tier */
+static vm_page_t *
+contig_find(size_t npages, enum vm_mem_tier tier)
+{
+	struct vmp_pregion *preg;
+
+	TAILQ_FOREACH (preg, &vmp_pregion_queue, queue_entry) {
+		size_t first = (npages - PADDR_TO_PFN(preg->base) % npages) %
+		    npages;
+
+		if (preg->tier != tier)
+			continue;
+
+		for (size_t b = first; b + npages <= preg->npages;
+		     b += npages) {
+			vm_page_t *run = &preg->pages[b];
+			size_t	   i;
+
+			for (i = 0; i < npages; i++)
+				if (run[i].use != kPageUseFree)
+					break;
+			if (i == npages)
+				return run;
+		}
+	}
+
+	return NULL;
+}
+
+int
+vmp_page_alloc_contig_locked(vm_page_t **out, size_t npages,
+    vm_account_t *account, enum vm_page_use use)
+{
+	vm_page_t *run;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(npages != 0 && (npages & (npages - 1)) == 0);
+
+	run = contig_find(npages, kVMTierFast);
+	if (run == NULL)
+		run = contig_find(npages, kVMTierSlow);
+	if (run == NULL)
+		return kVMFaultRetPageShortage;
+
+	for (size_t i = 0; i < npages; i++) {
+		page_unqueue_free(&run[i]);
+		page_setup(&run[i], account, use);
+	}
+
+	*out = run;
+	return 0;
+}
+
+int
+vmp_page_alloc_tier_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use, enum vm_mem_tier tier)
+{
+	vm_page_t *page;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	page = TAILQ_FIRST(&vm_pagequeue_free[tier]);
+	if (page == NULL)
+		return kVMFaultRetPageShortage;
+	free_dequeue(page);
+	page_setup(page, account, use);
+
+	*out = page;
+	return 0;
+}
+
 void
 vmp_page_free_locked(vm_page_t *page)
 {
@@ -191,15 +416,32 @@ vmp_page_free_locked(vm_page_t *page)
 	kassert(page->use == kPageUseDeleted);
 	kassert(page->refcnt == 0);
 
-	kprintf("Freeing page %p\n", page);
+	VMP_TRACE(kVMTracePageFree, NULL, page->pfn, 0, page->use);
+
+	if (page->swap_descriptor != 0) {
+		vmp_pagefile_slot_free(page->swap_descriptor);
+		page->swap_descriptor = 0;
+	}
 
 	page->dirty = false;
 	page->referent_pte = 0;
-	page->use = kPageUseDeleted;
+	page->owner = NULL;
+	page->use = kPageUseFree;
 	page->used_ptes = 0;
-	deleted_account.nalloced--;
-	vmstat.nfree++;
-	vmstat.ndeleted--;
+	vmp_account_add(&deleted_account, -1, 0);
+	VMP_STAT_DEC(ndeleted);
+	free_enqueue(page);
+}
+
+void
+vmp_page_set_use_locked(vm_page_t *page, enum vm_page_use use)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(page->use != kPageUseDeleted && page->use != kPageUseFree);
+
+	update_page_use_stats(page->use, -1);
+	update_page_use_stats(use, 1);
+	page->use = use;
 }
 
 void
@@ -210,11 +452,11 @@ vmp_page_delete_locked(vm_page_t *page, vm_account_t *account, bool release)
 	kassert(!page->busy);
 
 	update_page_use_stats(page->use, -1);
-	vmstat.ndeleted++;
+	VMP_STAT_INC(ndeleted);
 	page->use = kPageUseDeleted;
 
-	account->nalloced--;
-	deleted_account.nalloced++;
+	vmp_account_add(account, -1, 0);
+	vmp_account_add(&deleted_account, 1, 0);
 
 	if (release) {
 		kassert(page->refcnt > 0);
@@ -222,11 +464,11 @@ vmp_page_delete_locked(vm_page_t *page, vm_account_t *account, bool release)
 	} else {
 		if (page->refcnt == 0 && page->dirty) {
 			TAILQ_REMOVE(&vm_pagequeue_modified, page, queue_link);
-			vmstat.nmodified--;
+			VMP_STAT_DEC(nmodified);
 			vmp_page_free_locked(page);
 		} else if (page->refcnt == 0) {
 			TAILQ_REMOVE(&vm_pagequeue_standby, page, queue_link);
-			vmstat.nstandby--;
+			VMP_STAT_DEC(nstandby);
 			vmp_page_free_locked(page);
 		}
 	}
@@ -237,19 +479,19 @@ vmp_page_retain_locked(vm_page_t *page, vm_account_t *account)
 {
 	kassert(ke_spinlock_held(&vmp_pfn_lock));
 
-	account->nwires++;
+	vmp_account_add(account, 0, 1);
 
 	if (page->refcnt++ == 0) {
 		/* going from inactive to active state */
 		kassert(page->use != kPageUseDeleted);
 		if (page->dirty) {
 			TAILQ_REMOVE(&vm_pagequeue_modified, page, queue_link);
-			vmstat.nmodified--;
-			vmstat.nactive++;
+			VMP_STAT_DEC(nmodified);
+			VMP_STAT_INC(nactive);
 		} else {
 			TAILQ_REMOVE(&vm_pagequeue_standby, page, queue_link);
-			vmstat.nstandby--;
-			vmstat.nactive++;
+			VMP_STAT_DEC(nstandby);
+			VMP_STAT_INC(nactive);
 		}
 	}
 
@@ -262,23 +504,264 @@ vmp_page_release_locked(vm_page_t *page, vm_account_t *account)
 	kassert(ke_spinlock_held(&vmp_pfn_lock));
 	kassert(page->refcnt > 0);
 
-	account->nwires--;
+	vmp_account_add(account, 0, -1);
 
 	if (page->refcnt-- == 1) {
 		/* going from active to inactive state */
-		vmstat.nactive--;
+		VMP_STAT_DEC(nactive);
 		if (page->use == kPageUseDeleted) {
 			vmp_page_free_locked(page);
 		} else if (page->dirty) {
 			TAILQ_INSERT_TAIL(&vm_pagequeue_modified, page, queue_link);
-			vmstat.nmodified++;
+			VMP_STAT_INC(nmodified);
 		} else {
 			TAILQ_INSERT_TAIL(&vm_pagequeue_standby, page, queue_link);
-			vmstat.nstandby++;
+			VMP_STAT_INC(nstandby);
 		}
 	}
 }
 
+void
+vmp_page_make_cold_locked(vm_page_t *page)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	if (page->refcnt != 0)
+		return;
+
+	kassert(page->use == kPageUseAnonPrivate);
+	if (page->dirty) {
+		TAILQ_REMOVE(&vm_pagequeue_modified, page, queue_link);
+		TAILQ_INSERT_HEAD(&vm_pagequeue_modified, page, queue_link);
+	} else {
+		TAILQ_REMOVE(&vm_pagequeue_standby, page, queue_link);
+		TAILQ_INSERT_HEAD(&vm_pagequeue_standby, page, queue_link);
+	}
+}
+
+bool
+vmp_page_is_movable(vm_page_t *page)
+{
+	pte_t *pte;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	if (page->use != kPageUseAnonPrivate || page->busy ||
+	    page->referent_pte == 0)
+		return false;
+
+	/* an inactive page is in transition, so there is no TLB entry */
+	if (page->refcnt == 0)
+		return true;
+
+	/* a page someone else has retained can't be moved */
+	pte = (pte_t *)P2V(page->referent_pte);
+	return page->refcnt == 1 && vmp_md_pte_is_valid(pte) &&
+	    !vmp_md_pte_is_large(pte) && vmp_md_pte_page(pte) == page;
+}
+
+int
+vmp_page_migrate_locked(vm_page_t *page, vm_page_t *to)
+{
+	pte_t *pte;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(to->use == kPageUseFree);
+
+	if (!vmp_page_is_movable(page))
+		return -1;
+
+	pte = (pte_t *)P2V(page->referent_pte);
+	page_unqueue_free(to);
+
+	/* the same page, as far as counters and accounts go */
+	to->refcnt = page->refcnt;
+	to->use = page->use;
+	to->busy = 0;
+	to->dirty = page->dirty;
+	to->offset = page->offset;
+	to->owner = page->owner;
+	to->referent_pte = page->referent_pte;
+	to->swap_descriptor = page->swap_descriptor;
+
+	if (page->refcnt == 0) {
+		kassert(vmp_md_pte_is_trans(pte) && pte->sw.pfn == page->pfn);
+		TAILQ_INSERT_BEFORE(page, to, queue_link);
+		if (page->dirty)
+			TAILQ_REMOVE(&vm_pagequeue_modified, page, queue_link);
+		else
+			TAILQ_REMOVE(&vm_pagequeue_standby, page, queue_link);
+		vmp_md_pte_make_trans(pte, to->pfn);
+	} else {
+		vaddr_t vaddr = vmp_md_pte_vaddr(pte);
+
+		/* the copy, taken after the invalidation, catches every store */
+		vmp_md_pte_make_hw(pte, to->pfn, vmp_md_pte_is_writeable(pte));
+		vmp_md_tlb_invalidate(page->owner, vaddr, vaddr + PGSIZE,
+		    kVMTLBInvalMigrate);
+	}
+
+	memcpy((void *)vm_page_direct_map_addr(to),
+	    (void *)vm_page_direct_map_addr(page), PGSIZE);
+
+	page->refcnt = 0;
+	page->use = kPageUseFree;
+	page->dirty = false;
+	page->offset = 0;
+	page->owner = NULL;
+	page->referent_pte = 0;
+	page->swap_descriptor = 0;
+	free_enqueue(page);
+
+	return 0;
+}
+
+/*
+ * Write out up to \p count pages from the modified queue to the pagefile,
+ * moving them onto the standby queue.
+ */
+static size_t
+modified_page_writer(size_t count)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		vm_page_t *page = TAILQ_FIRST(&vm_pagequeue_modified);
+
+		if (page == NULL)
+			break;
+
+		kassert(page->use == kPageUseAnonPrivate);
+		kassert(page->refcnt == 0);
+
+		if (page->swap_descriptor == 0) {
+			page->swap_descriptor = vmp_pagefile_slot_alloc();
+			if (page->swap_descriptor == 0)
+				break;
+		}
+
+		vmp_md_pagefile_write(page->swap_descriptor, page);
+		page->dirty = false;
+		VMP_STAT_INC(npageout);
+
+		TAILQ_REMOVE(&vm_pagequeue_modified, page, queue_link);
+		VMP_STAT_DEC(nmodified);
+		TAILQ_INSERT_TAIL(&vm_pagequeue_standby, page, queue_link);
+		VMP_STAT_INC(nstandby);
+	}
+
+	return n;
+}
+
+/*
+ * Compress up to \p count pages from the modified queue into the compressed
+ * cache, replacing the transition PTEs that refer to them with compressed PTEs
+ * and freeing them. Returns the number freed.
+ */
+static size_t
+modified_page_compress(size_t count)
+{
+	vm_page_t *page, *next;
+	size_t	   n = 0, ntried = 0;
+
+	TAILQ_FOREACH_SAFE (page, &vm_pagequeue_modified, queue_link, next) {
+		vmp_procstate_t *owner = page->owner;
+		pte_t		*pte;
+		uintptr_t	 handle;
+
+		if (ntried++ == count)
+			break;
+
+		kassert(page->use == kPageUseAnonPrivate);
+		kassert(page->refcnt == 0);
+		pte = (pte_t *)P2V(page->referent_pte);
+		kassert(vmp_md_pte_is_trans(pte) && pte->sw.pfn == page->pfn);
+
+		/* incompressible pages are left to the pagefile */
+		if (vmp_zcache_store(page, &handle) != 0)
+			continue;
+
+		if (page->swap_descriptor != 0) {
+			vmp_pagefile_slot_free(page->swap_descriptor);
+			page->swap_descriptor = 0;
+		}
+		vmp_md_pte_make_compressed(pte, handle);
+		vmp_page_delete_locked(page, &owner->account, false);
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * Repurpose up to \p count standby pages, replacing the transition PTEs that
+ * refer to them with swap descriptor PTEs.
+ */
+static size_t
+reclaim_standby(size_t count)
+{
+	size_t n;
+
+	for (n = 0; n < count; n++) {
+		vm_page_t	*page = TAILQ_FIRST(&vm_pagequeue_standby);
+		vmp_procstate_t *owner;
+		pte_t		*pte;
+		uintptr_t	 slot;
+
+		if (page == NULL)
+			break;
+
+		kassert(page->use == kPageUseAnonPrivate);
+		owner = page->owner;
+		pte = (pte_t *)P2V(page->referent_pte);
+		kassert(vmp_md_pte_is_trans(pte) && pte->sw.pfn == page->pfn);
+
+		slot = page->swap_descriptor;
+		if (slot == 0) {
+			/* never dirtied, but has no copy in the pagefile yet */
+			slot = vmp_pagefile_slot_alloc();
+			if (slot == 0)
+				break;
+			vmp_md_pagefile_write(slot, page);
+			VMP_STAT_INC(npageout);
+		}
+
+		/* the slot now belongs to the PTE rather than the page */
+		page->swap_descriptor = 0;
+		vmp_md_pte_make_outpaged(pte, slot);
+		vmp_page_delete_locked(page, &owner->account, false);
+		VMP_STAT_INC(nreclaimed);
+	}
+
+	return n;
+}
+
+size_t
+vmp_page_reclaim_locked(size_t count)
+{
+	size_t n;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	/* cached pagetables are the cheapest to give back */
+	n = ptcache_drain(count);
+	if (n < count)
+		n += vmp_kmem_reap_locked(count - n, false);
+	if (n < count)
+		n += reclaim_standby(count - n);
+	if (n < count)
+		n += modified_page_compress(count - n);
+	if (n < count) {
+		modified_page_writer(count - n);
+		n += reclaim_standby(count - n);
+	}
+	/* last resort, as it costs every CPU its cached objects */
+	if (n == 0)
+		n = vmp_kmem_reap_locked(count, true);
+
+	return n;
+}
+
 static const char *
 vm_page_use_str(enum vm_page_use use)
 {
@@ -295,30 +778,89 @@ vm_page_use_str(enum vm_page_use use)
 		return "PML2";
 	case kPageUsePML1:
 		return "PML1";
+	case kPageUseZero:
+		return "zero";
+	case kPageUseKMem:
+		return "kmem";
+	case kPageUseZCache:
+		return "zcache";
+	case kPageUseMerged:
+		return "merged";
 	default:
 		return "BAD";
 	}
 }
 
+void
+vm_stat_get(struct vm_stat *stat)
+{
+	size_t *out = (size_t *)stat;
+
+	memset(stat, 0x0, sizeof(*stat));
+	for (int cpu = 0; cpu < KRX_MAX_CPUS; cpu++) {
+		size_t *delta = (size_t *)&vmp_stat_cpus[cpu].stat;
+
+		for (size_t i = 0; i < sizeof(*stat) / sizeof(size_t); i++)
+			out[i] += __atomic_load_n(&delta[i], __ATOMIC_RELAXED);
+	}
+}
+
+void
+vm_stat_get_exact(struct vm_stat *stat)
+{
+	ipl_t ipl = vmp_acquire_pfn_lock();
+	vm_stat_get(stat);
+	vmp_release_pfn_lock(ipl);
+}
+
+void
+vm_account_init(vm_account_t *account)
+{
+	memset(account, 0x0, sizeof(*account));
+}
+
+void
+vm_account_get(vm_account_t *account, size_t *nalloced, size_t *nwires)
+{
+	size_t alloced = 0, wires = 0;
+
+	for (int cpu = 0; cpu < KRX_MAX_CPUS; cpu++) {
+		alloced += __atomic_load_n(&account->cpu[cpu].nalloced,
+		    __ATOMIC_RELAXED);
+		wires += __atomic_load_n(&account->cpu[cpu].nwires,
+		    __ATOMIC_RELAXED);
+	}
+
+	if (nalloced != NULL)
+		*nalloced = alloced;
+	if (nwires != NULL)
+		*nwires = wires;
+}
+
 int
 vmp_pages_dump(void)
 {
 	struct vmp_pregion *region;
+	struct vm_stat	    stat;
+
+	vm_stat_get_exact(&stat);
 
 	printf("Active: %zu, modified: %zu, standby: %zu, free: %zu\n",
-	    vmstat.nactive, vmstat.nmodified, vmstat.nstandby, vmstat.nfree);
+	    stat.nactive, stat.nmodified, stat.nstandby, stat.nfree);
 
 	kprintf("\033[7m%-9s%-9s%-9s%-9s%-9s\033[m\n", "free", "del", "priv",
 	    "fork", "file");
-	kprintf("%-9zu%-9zu%-9zu%-9zu%-9zu\n", vmstat.nfree, vmstat.ndeleted,
-	    vmstat.nanonprivate, vmstat.nanonfork, vmstat.nfile);
+	kprintf("%-9zu%-9zu%-9zu%-9zu%-9zu\n", stat.nfree, stat.ndeleted,
+	    stat.nanonprivate, stat.nanonfork, stat.nfile);
 	kprintf("\033[7m%-9s%-9s%-9s%-9s%-9s\033[m\n", "share", "pgtbl",
 	    "proto", "kwired", "pwired");
-	kprintf("%-9zu%-9zu%-9zu%-9zu%-9zu\n", vmstat.nanonshare,
-	    vmstat.nprocpgtable, vmstat.nprotopgtable, vmstat.nkwired,
-	    vmstat.npwired);
+	kprintf("%-9zu%-9zu%-9zu%-9zu%-9zu\n", stat.nanonshare,
+	    stat.nprocpgtable, stat.nprotopgtable, stat.nkwired,
+	    stat.npwired);
+	kprintf("\033[7m%-9s%-9s\033[m\n", "zcache", "merged");
+	kprintf("%-9zu%-9zu\n", stat.nzcache, stat.nmerged);
 
-	TAILQ_FOREACH (region, &pregion_queue, queue_entry) {
+	TAILQ_FOREACH (region, &vmp_pregion_queue, queue_entry) {
 		for (int i = 0; i < region->npages; i++) {
 			vm_page_t *page = &region->pages[i];
 
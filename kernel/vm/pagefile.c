@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file pagefile.c
+ * @brief Pagefile slot (drumslot) management.
+ *
+ * Slots are numbered from 1 so that a swap descriptor of 0 can mean "none".
+ * Free slots are kept on a stack, so allocation and freeing are O(1). All
+ * functions here are called with the PFN database lock held.
+ */
+
+#include "kdk/vm.h"
+#include "vmp.h"
+
+static uintptr_t *free_slots;
+static size_t	  nslots, nfree_slots;
+
+void
+vm_pagefile_add(size_t count)
+{
+	kassert(nslots == 0);
+
+	free_slots = kmem_alloc(sizeof(uintptr_t) * count);
+	/* hand out low-numbered slots first */
+	for (size_t i = 0; i < count; i++)
+		free_slots[i] = count - i;
+	nslots = nfree_slots = count;
+
+	kprintf("VM: Pagefile of %zu KiB\n", count * PGSIZE / 1024);
+}
+
+uintptr_t
+vmp_pagefile_slot_alloc(void)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	if (nfree_slots == 0)
+		return 0;
+
+	return free_slots[--nfree_slots];
+}
+
+void
+vmp_pagefile_slot_free(uintptr_t slot)
+{
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(slot != 0 && slot <= nslots);
+	kassert(nfree_slots < nslots);
+
+	free_slots[nfree_slots++] = slot;
+}
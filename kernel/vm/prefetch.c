@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file prefetch.c
+ * @brief Start-up prefetching.
+ *
+ * Processes running the same image touch much the same scattered set of pages
+ * as they start. The first faults of a process can be logged and saved as the
+ * prefetch record of a key naming the image; later processes of that image
+ * then have the recorded pages brought in in bulk before they fault on them,
+ * with pagefile reads clustered by slot.
+ *
+ * Records are immutable once saved. Each is referenced by the record list
+ * while it is the current record of its key, and by any prefetch using it.
+ */
+
+#include "kdk/kmem.h"
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+/*! Most pages read from the pagefile in one I/O. */
+#define PREFETCH_CLUSTER_MAX 16
+
+/*!
+ * Page addresses, each with bit 0 set if the page was private rather than a
+ * zero page mapping when faulted on.
+ */
+struct vmp_prefetch_record {
+	TAILQ_ENTRY(vmp_prefetch_record) queue_entry;
+	/*! records_lock protects */
+	unsigned refcnt;
+	char	 key[VM_PREFETCH_KEY_MAX];
+	/*! entries used, and room for */
+	size_t	 npages, capacity;
+	vaddr_t	 pages[0];
+};
+
+struct prefetch_read {
+	uintptr_t slot;
+	vaddr_t	  vaddr;
+};
+
+static TAILQ_HEAD(, vmp_prefetch_record) records = TAILQ_HEAD_INITIALIZER(
+    records);
+static kspinlock_t records_lock = KSPINLOCK_NAMED_INITIALISER(
+    "vmp_prefetch_lock");
+
+static size_t
+record_size(size_t capacity)
+{
+	return sizeof(struct vmp_prefetch_record) + sizeof(vaddr_t) * capacity;
+}
+
+static void
+record_release(struct vmp_prefetch_record *record)
+{
+	ipl_t ipl = ke_spinlock_acquire(&records_lock);
+	bool  last = --record->refcnt == 0;
+
+	ke_spinlock_release(&records_lock, ipl);
+
+	if (last)
+		kmem_free(record, record_size(record->capacity));
+}
+
+static int
+page_cmp(const void *x, const void *y)
+{
+	vaddr_t a = *(const vaddr_t *)x, b = *(const vaddr_t *)y;
+
+	return a < b ? -1 : a > b;
+}
+
+static int
+read_cmp(const void *x, const void *y)
+{
+	uintptr_t a = ((const struct prefetch_read *)x)->slot,
+		  b = ((const struct prefetch_read *)y)->slot;
+
+	return a < b ? -1 : a > b;
+}
+
+int
+vm_ps_prefetch_record(vmp_procstate_t *vmps, const char *key, size_t npages)
+{
+	struct vmp_prefetch_record *log;
+
+	if (npages == 0 || npages > VM_PREFETCH_MAX_PAGES)
+		return -1;
+
+	log = kmem_alloc(record_size(npages));
+	if (log == NULL)
+		return -1;
+	log->refcnt = 1;
+	strncpy(log->key, key, VM_PREFETCH_KEY_MAX - 1);
+	log->key[VM_PREFETCH_KEY_MAX - 1] = '\0';
+	log->npages = 0;
+	log->capacity = npages;
+
+	ke_wait(&vmps->mutex, "vm_ps_prefetch_record:vmps->mutex", false, false,
+	    -1);
+	vmp_prefetch_log_free(vmps);
+	vmps->prefetch_log = log;
+	ke_mutex_release(&vmps->mutex);
+
+	return 0;
+}
+
+/* sort a log, merge its duplicates, and make it the record of its key */
+static void
+prefetch_save_locked(vmp_procstate_t *vmps)
+{
+	struct vmp_prefetch_record *log = vmps->prefetch_log, *old;
+	size_t			    n = 0;
+	ipl_t			    ipl;
+
+	vmps->prefetch_log = NULL;
+
+	qsort(log->pages, log->npages, sizeof(vaddr_t), page_cmp);
+	for (size_t i = 0; i < log->npages; i++) {
+		if (n != 0 && PGROUNDDOWN(log->pages[n - 1]) ==
+			PGROUNDDOWN(log->pages[i]))
+			log->pages[n - 1] |= log->pages[i];
+		else
+			log->pages[n++] = log->pages[i];
+	}
+	log->npages = n;
+
+	ipl = ke_spinlock_acquire(&records_lock);
+	TAILQ_FOREACH (old, &records, queue_entry)
+		if (strcmp(old->key, log->key) == 0)
+			break;
+	if (old != NULL)
+		TAILQ_REMOVE(&records, old, queue_entry);
+	TAILQ_INSERT_TAIL(&records, log, queue_entry);
+	ke_spinlock_release(&records_lock, ipl);
+
+	if (old != NULL)
+		record_release(old);
+}
+
+void
+vm_ps_prefetch_save(vmp_procstate_t *vmps)
+{
+	ke_wait(&vmps->mutex, "vm_ps_prefetch_save:vmps->mutex", false, false,
+	    -1);
+	if (vmps->prefetch_log != NULL)
+		prefetch_save_locked(vmps);
+	ke_mutex_release(&vmps->mutex);
+}
+
+void
+vmp_prefetch_log(vmp_procstate_t *vmps, vaddr_t vaddr, enum vm_fault_kind kind)
+{
+	struct vmp_prefetch_record *log = vmps->prefetch_log;
+
+	switch (kind) {
+	case kVMFaultZeroPage:
+		break;
+
+	case kVMFaultZero:
+	case kVMFaultTrans:
+	case kVMFaultPagein:
+	case kVMFaultZCache:
+		vaddr |= 1;
+		break;
+
+	default:
+		/* the page was already there */
+		return;
+	}
+
+	log->pages[log->npages++] = vaddr;
+	if (log->npages == log->capacity)
+		prefetch_save_locked(vmps);
+}
+
+void
+vmp_prefetch_log_free(vmp_procstate_t *vmps)
+{
+	if (vmps->prefetch_log == NULL)
+		return;
+	kmem_free(vmps->prefetch_log,
+	    record_size(vmps->prefetch_log->capacity));
+	vmps->prefetch_log = NULL;
+}
+
+static bool
+ws_has_room(vmp_procstate_t *vmps)
+{
+	return vmps->ws_current_count < vmps->ws_max_count;
+}
+
+/*
+ * Fill an empty PTE as a fault would: with a private zeroed page, or the zero
+ * page. Returns whether it was.
+ */
+static bool
+prefetch_empty(vmp_procstate_t *vmps, vaddr_t vaddr, bool private)
+{
+	struct vmp_md_fault_state state;
+	vm_page_t		 *page = vmp_zero_page;
+
+	if (!private && !vmp_zero_page_enabled)
+		return false;
+	if (private && !ws_has_room(vmps))
+		return false;
+
+	memset(&state, 0x0, sizeof(state));
+	if (vmp_md_wire_pte(vmps, vaddr, &state) != kVMFaultRetOK)
+		return false;
+	if (!vmp_md_pte_is_empty(state.pte)) {
+		/* it was within a large page, which wiring it split */
+		vmp_md_fault_state_release(vmps, &state);
+		return false;
+	}
+
+	if (private) {
+		int r = vmp_page_alloc_locked(&page, &vmps->account,
+		    kPageUseAnonPrivate, false);
+		if (r != 0) {
+			vmp_md_fault_state_release(vmps, &state);
+			return false;
+		}
+		page->owner = vmps;
+		page->referent_pte = V2P((vaddr_t)state.pte);
+	}
+
+	vmp_md_pte_make_hw(state.pte, page->pfn, false);
+	state.bot_page->refcnt++;
+	state.bot_page->used_ptes++;
+	if (private)
+		vmp_wsl_insert(vmps, vaddr);
+	vmp_md_fault_state_release(vmps, &state);
+
+	return true;
+}
+
+/*
+ * Read in a run of consecutive pagefile slots, and map each page, or leave it
+ * on the standby queue if the working set is full. Returns the number of pages
+ * read, which is fewer than asked only if memory ran out.
+ */
+static size_t
+prefetch_cluster(vmp_procstate_t *vmps, struct prefetch_read *reads,
+    size_t nreads)
+{
+	vm_page_t *pages[PREFETCH_CLUSTER_MAX];
+	size_t	   n;
+
+	for (n = 0; n < nreads; n++)
+		if (vmp_page_alloc_locked(&pages[n], &vmps->account,
+			kPageUseAnonPrivate, false) != 0)
+			break;
+	if (n == 0)
+		return 0;
+
+	vmp_md_pagefile_read_cluster(reads[0].slot, pages, n);
+	VMP_STAT_INC(nprefetchread);
+
+	for (size_t i = 0; i < n; i++) {
+		vm_page_t *page = pages[i];
+		pte_t	  *pte;
+		int	   r;
+
+		r = vmp_mp_fetch_pte(vmps, reads[i].vaddr, &pte, NULL);
+		kassert(r == 0 && vmp_md_pte_is_outpaged(pte));
+
+		/* as on a hard fault, it stays clean, so the slot is kept */
+		page->swap_descriptor = reads[i].slot;
+		page->owner = vmps;
+		page->referent_pte = V2P((vaddr_t)pte);
+
+		if (ws_has_room(vmps)) {
+			vmp_md_pte_make_hw(pte, page->pfn, false);
+			vmp_wsl_insert(vmps, reads[i].vaddr);
+		} else {
+			vmp_md_pte_make_trans(pte, page->pfn);
+			vmp_page_release_locked(page, &vmps->account);
+		}
+	}
+
+	return n;
+}
+
+int
+vm_ps_prefetch(vmp_procstate_t *vmps, const char *key)
+{
+	struct vmp_prefetch_record *record;
+	struct prefetch_read	   *reads;
+	size_t			    nreads = 0, nprefetched = 0;
+	ipl_t			    ipl;
+
+	ipl = ke_spinlock_acquire(&records_lock);
+	TAILQ_FOREACH (record, &records, queue_entry)
+		if (strcmp(record->key, key) == 0)
+			break;
+	if (record != NULL)
+		record->refcnt++;
+	ke_spinlock_release(&records_lock, ipl);
+
+	if (record == NULL)
+		return -1;
+
+	reads = kmem_alloc(sizeof(*reads) * (record->npages + 1));
+	if (reads == NULL) {
+		record_release(record);
+		return 0;
+	}
+
+	ke_wait(&vmps->mutex, "vm_ps_prefetch:vmps->mutex", false, false, -1);
+	ipl = vmp_acquire_pfn_lock();
+
+	for (size_t i = 0; i < record->npages; i++) {
+		vaddr_t	  vaddr = PGROUNDDOWN(record->pages[i]);
+		bool	  private = record->pages[i] & 1;
+		vm_vad_t *vad = vmp_ps_vad_find(vmps, vaddr);
+		pte_t	 *pte;
+
+		if (vad == NULL || vad->section != NULL)
+			continue;
+
+		if (vmp_mp_fetch_pte(vmps, vaddr, &pte, NULL) != 0 ||
+		    vmp_md_pte_is_empty(pte)) {
+			nprefetched += prefetch_empty(vmps, vaddr, private);
+		} else if (vmp_md_pte_is_outpaged(pte)) {
+			reads[nreads].slot = vmp_md_pte_drumslot(pte);
+			reads[nreads].vaddr = vaddr;
+			nreads++;
+		} else if (vmp_md_pte_is_trans(pte) && ws_has_room(vmps)) {
+			vm_page_t *page = vmp_md_pte_page(pte);
+
+			/* as on a soft fault */
+			vmp_page_retain_locked(page, &vmps->account);
+			vmp_md_pte_make_hw(pte, page->pfn, false);
+			vmp_wsl_insert(vmps, vaddr);
+			nprefetched++;
+		}
+	}
+
+	/* read back runs of consecutive slots together */
+	qsort(reads, nreads, sizeof(*reads), read_cmp);
+	for (size_t i = 0; i < nreads;) {
+		size_t n, nread;
+
+		for (n = 1; i + n < nreads && n < PREFETCH_CLUSTER_MAX &&
+		     reads[i + n].slot == reads[i].slot + n;
+		     n++)
+			;
+
+		nread = prefetch_cluster(vmps, &reads[i], n);
+		nprefetched += nread;
+		if (nread < n)
+			break;
+		i += n;
+	}
+
+	VMP_STAT_ADD(nprefetch, nprefetched);
+	vmp_release_pfn_lock(ipl);
+	ke_mutex_release(&vmps->mutex);
+
+	kmem_free(reads, sizeof(*reads) * (record->npages + 1));
+	record_release(record);
+
+	return nprefetched;
+}
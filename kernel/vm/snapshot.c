@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file snapshot.c
+ * @brief Machine-readable snapshots of memory use.
+ *
+ * A snapshot reports the global page counts by state and by use, and for
+ * each process asked about its totals and those of each VAD. Per-VAD counts
+ * come from one walk of the process' pagetables, under its mutex and the
+ * PFNDB lock, during which a cursor follows the (address-ordered) VAD tree.
+ * Text is only formatted and written out once both are released.
+ *
+ * JSON snapshots are a single object; CSV snapshots are in long form, one
+ * metric per row, so that every row has the same columns.
+ */
+
+#include <stdarg.h>
+
+#include "kdk/kmem.h"
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+/* page counts of a VAD */
+struct snapshot_vad {
+	vaddr_t start, end;
+	/*! mapped pages, other than the zero page; of them, possibly dirty */
+	size_t resident, dirty;
+	/*!
+	 * pages on the standby or modified queues, in the pagefile, and in the
+	 * compressed cache
+	 */
+	size_t transition, swapped, compressed;
+};
+
+struct snapshot_walk {
+	vmp_procstate_t	    *vmps;
+	/*! VAD the next PTEs are expected to fall in, and its counts */
+	vm_vad_t	    *vad;
+	struct snapshot_vad *counts;
+};
+
+struct snapshot_writer {
+	enum vm_snapshot_format format;
+	vm_snapshot_writer_t	writer;
+	void		       *context;
+	/*! CSV: leading columns of rows */
+	char			prefix[80];
+	/*! JSON: whether nothing was yet written in the current object */
+	bool			first;
+};
+
+static const struct snapshot_metric {
+	const char *name;
+	size_t	    offset;
+} state_metrics[] = {
+	{ "wired", offsetof(struct vm_stat, npwired) },
+	{ "active", offsetof(struct vm_stat, nactive) },
+	{ "free", offsetof(struct vm_stat, nfree) },
+	{ "modified", offsetof(struct vm_stat, nmodified) },
+	{ "standby", offsetof(struct vm_stat, nstandby) },
+	{ "ptcached", offsetof(struct vm_stat, nptcached) },
+}, use_metrics[] = {
+	{ "deleted", offsetof(struct vm_stat, ndeleted) },
+	{ "anonprivate", offsetof(struct vm_stat, nanonprivate) },
+	{ "anonfork", offsetof(struct vm_stat, nanonfork) },
+	{ "file", offsetof(struct vm_stat, nfile) },
+	{ "anonshare", offsetof(struct vm_stat, nanonshare) },
+	{ "procpgtable", offsetof(struct vm_stat, nprocpgtable) },
+	{ "protopgtable", offsetof(struct vm_stat, nprotopgtable) },
+	{ "kwired", offsetof(struct vm_stat, nkwired) },
+	{ "zcache", offsetof(struct vm_stat, nzcache) },
+	{ "merged", offsetof(struct vm_stat, nmerged) },
+};
+
+static void
+snapshot_walk_pte(void *context, vaddr_t vaddr, pte_t *pte)
+{
+	struct snapshot_walk *walk = context;
+
+	while (walk->vad != NULL && walk->vad->end <= vaddr) {
+		walk->vad = RB_NEXT(vm_vad_rbtree, &walk->vmps->vad_queue,
+		    walk->vad);
+		walk->counts++;
+	}
+	if (walk->vad == NULL || walk->vad->start > vaddr)
+		return;
+
+	if (vmp_md_pte_is_valid(pte)) {
+		vm_page_t *page = vmp_md_pte_page(pte);
+
+		if (page == vmp_zero_page)
+			return;
+		walk->counts->resident++;
+		if (page->dirty || vmp_md_pte_is_writeable(pte))
+			walk->counts->dirty++;
+	} else if (vmp_md_pte_is_trans(pte)) {
+		walk->counts->transition++;
+	} else if (vmp_md_pte_is_outpaged(pte)) {
+		walk->counts->swapped++;
+	} else if (vmp_md_pte_is_compressed(pte)) {
+		walk->counts->compressed++;
+	}
+}
+
+static void
+put(struct snapshot_writer *sw, const char *fmt, ...)
+{
+	char	buf[160];
+	va_list ap;
+	int	len;
+
+	va_start(ap, fmt);
+	len = kvsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+	sw->writer(sw->context, buf, len);
+}
+
+/* JSON: open an object or array member (or element, if key is NULL) */
+static void
+put_open(struct snapshot_writer *sw, const char *key, char bracket)
+{
+	if (sw->format != kVMSnapshotJSON)
+		return;
+	if (key != NULL)
+		put(sw, "%s\"%s\":%c", sw->first ? "" : ",", key, bracket);
+	else
+		put(sw, "%s%c", sw->first ? "" : ",", bracket);
+	sw->first = true;
+}
+
+static void
+put_close(struct snapshot_writer *sw, char bracket)
+{
+	if (sw->format != kVMSnapshotJSON)
+		return;
+	put(sw, "%c", bracket);
+	sw->first = false;
+}
+
+static void
+put_metric(struct snapshot_writer *sw, const char *name, size_t value)
+{
+	if (sw->format == kVMSnapshotJSON)
+		put(sw, "%s\"%s\":%zu", sw->first ? "" : ",", name, value);
+	else
+		put(sw, "%s,%s,%zu\n", sw->prefix, name, value);
+	sw->first = false;
+}
+
+static void
+put_counts(struct snapshot_writer *sw, struct snapshot_vad *counts)
+{
+	put_metric(sw, "resident", counts->resident);
+	put_metric(sw, "dirty", counts->dirty);
+	put_metric(sw, "transition", counts->transition);
+	put_metric(sw, "swapped", counts->swapped);
+	put_metric(sw, "compressed", counts->compressed);
+}
+
+static void
+put_stat(struct snapshot_writer *sw, const char *key,
+    const struct snapshot_metric *metrics, size_t nmetrics,
+    struct vm_stat *stat)
+{
+	put_open(sw, key, '{');
+	for (size_t i = 0; i < nmetrics; i++)
+		put_metric(sw, metrics[i].name,
+		    *(size_t *)((char *)stat + metrics[i].offset));
+	put_close(sw, '}');
+}
+
+static int
+snapshot_ps(struct snapshot_writer *sw, vmp_procstate_t *vmps)
+{
+	struct snapshot_walk walk;
+	struct snapshot_vad *vads = NULL, total = { 0 };
+	vm_vad_t	    *vad;
+	size_t		     nvads = 0, ntables, ws_count, ws_max, nalloced,
+			     nwires;
+	ipl_t		     ipl;
+
+	ke_wait(&vmps->mutex, "snapshot_ps:vmps->mutex", false, false, -1);
+
+	RB_FOREACH (vad, vm_vad_rbtree, &vmps->vad_queue)
+		nvads++;
+	if (nvads != 0) {
+		vads = kmem_alloc(sizeof(*vads) * nvads);
+		if (vads == NULL) {
+			ke_mutex_release(&vmps->mutex);
+			return -1;
+		}
+		memset(vads, 0x0, sizeof(*vads) * nvads);
+	}
+
+	walk.vmps = vmps;
+	walk.vad = RB_MIN(vm_vad_rbtree, &vmps->vad_queue);
+	walk.counts = vads;
+
+	ipl = vmp_acquire_pfn_lock();
+	ntables = vmp_md_ps_walk(vmps, snapshot_walk_pte, &walk);
+	vmp_release_pfn_lock(ipl);
+
+	nvads = 0;
+	RB_FOREACH (vad, vm_vad_rbtree, &vmps->vad_queue) {
+		vads[nvads].start = vad->start;
+		vads[nvads].end = vad->end;
+		nvads++;
+	}
+	ws_count = vmps->ws_current_count;
+	ws_max = vmps->ws_max_count;
+	vm_account_get(&vmps->account, &nalloced, &nwires);
+
+	ke_mutex_release(&vmps->mutex);
+
+	for (size_t i = 0; i < nvads; i++) {
+		total.resident += vads[i].resident;
+		total.dirty += vads[i].dirty;
+		total.transition += vads[i].transition;
+		total.swapped += vads[i].swapped;
+		total.compressed += vads[i].compressed;
+	}
+
+	put_open(sw, NULL, '{');
+	if (sw->format == kVMSnapshotJSON)
+		put(sw, "\"id\":\"%p\"", vmps);
+	sw->first = false;
+	ksnprintf(sw->prefix, sizeof(sw->prefix), "process,%p,,", vmps);
+	put_counts(sw, &total);
+	put_metric(sw, "ws", ws_count);
+	put_metric(sw, "ws_max", ws_max);
+	put_metric(sw, "pagetables", ntables);
+	put_metric(sw, "allocated", nalloced);
+	put_metric(sw, "wired", nwires);
+
+	put_open(sw, "vads", '[');
+	for (size_t i = 0; i < nvads; i++) {
+		put_open(sw, NULL, '{');
+		if (sw->format == kVMSnapshotJSON)
+			put(sw, "\"start\":\"0x%zx\",\"end\":\"0x%zx\"",
+			    vads[i].start, vads[i].end);
+		sw->first = false;
+		ksnprintf(sw->prefix, sizeof(sw->prefix),
+		    "vad,%p,0x%zx,0x%zx", vmps, vads[i].start, vads[i].end);
+		put_counts(sw, &vads[i]);
+		put_close(sw, '}');
+	}
+	put_close(sw, ']');
+	put_close(sw, '}');
+
+	if (vads != NULL)
+		kmem_free(vads, sizeof(*vads) * nvads);
+
+	return 0;
+}
+
+int
+vm_snapshot(vmp_procstate_t **procs, size_t nprocs,
+    enum vm_snapshot_format format, vm_snapshot_writer_t writer, void *context)
+{
+	struct snapshot_writer sw = {
+		.format = format,
+		.writer = writer,
+		.context = context,
+		.first = true,
+	};
+	struct vm_stat	       stat;
+	int		       r = 0;
+
+	vm_stat_get_exact(&stat);
+
+	if (format == kVMSnapshotCSV)
+		put(&sw, "scope,process,start,end,metric,value\n");
+	put_open(&sw, NULL, '{');
+
+	strcpy(sw.prefix, "state,,,");
+	put_stat(&sw, "state", state_metrics, elementsof(state_metrics),
+	    &stat);
+	strcpy(sw.prefix, "use,,,");
+	put_stat(&sw, "use", use_metrics, elementsof(use_metrics), &stat);
+
+	put_open(&sw, "processes", '[');
+	for (size_t i = 0; r == 0 && i < nprocs; i++)
+		r = snapshot_ps(&sw, procs[i]);
+	put_close(&sw, ']');
+
+	put_close(&sw, '}');
+	if (format == kVMSnapshotJSON)
+		put(&sw, "\n");
+
+	return r;
+}
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file lock.c
+ * @brief Lock statistics for the soft port.
+ *
+ * The spinlocks and mutexes of soft_compat.h count acquisitions, contended
+ * acquisitions, and histograms of wait and hold times per lock class, i.e.
+ * per lock name - so that every process' VAD mutex, say, is accounted
+ * together. Each simulated CPU has an array of statistics indexed by class,
+ * which it updates only while holding the lock concerned, so the fast paths
+ * take no further lock and share no cache lines.
+ *
+ * Both the class table and the list of per-CPU arrays are protected by a host
+ * mutex, which is only taken on first use of a class or by a thread, and for
+ * reporting. Per-CPU arrays outlive their threads, so statistics remain
+ * available after a simulator's threads have been joined.
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "kdk/libkern.h"
+#include "kdk/port.h"
+#include "kdk/queue.h"
+
+struct soft_lock_cpu {
+	TAILQ_ENTRY(soft_lock_cpu) queue_entry;
+	struct soft_lock_stats stats[SOFT_LOCK_MAX_CLASSES];
+};
+
+__thread struct soft_lock_stats *SIM_lockstats;
+__thread unsigned		 SIM_nspinlocks;
+bool				 soft_lock_timing = true;
+
+static pthread_mutex_t soft_lock_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char     *class_names[SOFT_LOCK_MAX_CLASSES];
+static unsigned	       nclasses;
+static TAILQ_HEAD(, soft_lock_cpu) cpus = TAILQ_HEAD_INITIALIZER(cpus);
+
+unsigned
+soft_lock_class_lookup(const char *name)
+{
+	unsigned i;
+
+	if (name == NULL)
+		name = "(unnamed)";
+
+	pthread_mutex_lock(&soft_lock_lock);
+	for (i = 0; i < nclasses; i++)
+		if (strcmp(class_names[i], name) == 0)
+			break;
+	if (i == nclasses) {
+		if (nclasses == SOFT_LOCK_MAX_CLASSES)
+			kfatal("Too many lock classes (adding %s)\n", name);
+		class_names[nclasses++] = name;
+	}
+	pthread_mutex_unlock(&soft_lock_lock);
+
+	return i + 1;
+}
+
+struct soft_lock_stats *
+soft_lock_cpu_init(void)
+{
+	struct soft_lock_cpu *cpu = calloc(1, sizeof(*cpu));
+
+	if (cpu == NULL)
+		kfatal("Failed to allocate lock statistics\n");
+
+	pthread_mutex_lock(&soft_lock_lock);
+	TAILQ_INSERT_TAIL(&cpus, cpu, queue_entry);
+	pthread_mutex_unlock(&soft_lock_lock);
+
+	return cpu->stats;
+}
+
+size_t
+soft_lock_get_stats(struct soft_lock_stats *stats, size_t max)
+{
+	struct soft_lock_cpu *cpu;
+	size_t		      n;
+
+	pthread_mutex_lock(&soft_lock_lock);
+	n = nclasses < max ? nclasses : max;
+	memset(stats, 0x0, sizeof(*stats) * n);
+	for (size_t i = 0; i < n; i++)
+		stats[i].name = class_names[i];
+
+	TAILQ_FOREACH (cpu, &cpus, queue_entry) {
+		for (size_t i = 0; i < n; i++) {
+			struct soft_lock_stats *in = &cpu->stats[i];
+
+			stats[i].acquires += in->acquires;
+			stats[i].contended += in->contended;
+			stats[i].wait_ns += in->wait_ns;
+			stats[i].hold_ns += in->hold_ns;
+			for (int j = 0; j < SOFT_LOCK_HIST_BUCKETS; j++) {
+				stats[i].wait_hist[j] += in->wait_hist[j];
+				stats[i].hold_hist[j] += in->hold_hist[j];
+			}
+		}
+	}
+	n = nclasses;
+	pthread_mutex_unlock(&soft_lock_lock);
+
+	return n;
+}
+
+uint64_t
+soft_lock_hist_percentile(const uint64_t *hist, double pct)
+{
+	return log2hist_percentile(hist, SOFT_LOCK_HIST_BUCKETS, pct);
+}
+
+static void
+dump_hist(const char *what, const uint64_t *hist)
+{
+	kprintf("  %s:", what);
+	for (int i = 0; i < SOFT_LOCK_HIST_BUCKETS; i++)
+		if (hist[i] != 0)
+			kprintf(" <%" PRIu64 "%s:%" PRIu64,
+			    (uint64_t)1 << i,
+			    i == SOFT_LOCK_HIST_BUCKETS - 1 ? "+" : "",
+			    hist[i]);
+	kprintf("\n");
+}
+
+void
+soft_lock_dump_stats(void)
+{
+	struct soft_lock_stats stats[SOFT_LOCK_MAX_CLASSES];
+	size_t		       n;
+
+	n = soft_lock_get_stats(stats, elementsof(stats));
+
+	kprintf("%-16s%-11s%-11s%-9s%-9s%-9s%-9s\n", "lock", "acquires",
+	    "contended", "wait50", "wait99", "hold50", "hold99");
+	for (size_t i = 0; i < n; i++) {
+		struct soft_lock_stats *s = &stats[i];
+
+		kprintf("%-16s%-11" PRIu64 "%-11" PRIu64 "%-9" PRIu64
+			"%-9" PRIu64 "%-9" PRIu64 "%-9" PRIu64 "\n",
+		    s->name, s->acquires, s->contended,
+		    soft_lock_hist_percentile(s->wait_hist, 50),
+		    soft_lock_hist_percentile(s->wait_hist, 99),
+		    soft_lock_hist_percentile(s->hold_hist, 50),
+		    soft_lock_hist_percentile(s->hold_hist, 99));
+		dump_hist("wait ns", s->wait_hist);
+		dump_hist("hold ns", s->hold_hist);
+	}
+}
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file mmu.c
+ * @brief Simulated MMU for the soft port: page table walker and software TLB.
+ *
+ * Each simulated CPU (i.e. each host thread) has a set-associative TLB of its
+ * own. Hits are resolved under only the TLB's own lock, which is never
+ * contended except by a shootdown; misses walk the page tables under the PFN
+ * lock and refill the TLB before dropping it.
+ *
+ * An entry may translate a large page, a PML2 entry mapping a leaf table's
+ * worth of contiguous pages; such entries are tagged with the large page's
+ * number and are looked up after the page's own entry misses.
+ *
+ * Walks set the accessed bit of the entry they load, as hardware would. An
+ * access resolving to the slow memory tier is counted, and waits out
+ * soft_slow_tier_latency_ns by spinning, as a CPU stalls on a slow load.
+ *
+ * Lock ordering is PFN lock -> TLB lock. The VM issues shootdowns with the PFN
+ * lock held, after changing the PTEs concerned, so a walker can't refill a
+ * stale translation after the shootdown has passed it by.
+ */
+
+#include <inttypes.h>
+
+#include "../vmp.h"
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vm/soft/mmu.h"
+
+struct soft_tlb_entry {
+	/*! root pagetable physical address; acts as an ASID */
+	paddr_t asid;
+	/*! virtual page number, or if large, vpn >> SOFT_LEVEL_BITS */
+	vaddr_t vpn;
+	/*! if large, of the first page */
+	pfn_t	pfn : 61;
+	bool	large : 1, writeable : 1, valid : 1;
+};
+
+struct soft_tlb {
+	/*! Linkage in tlb_queue. */
+	TAILQ_ENTRY(soft_tlb) queue_entry;
+	/*! Protects entries; taken remotely only by shootdowns. */
+	kspinlock_t lock;
+	/*! Next way to replace within each set. */
+	uint8_t victim[SOFT_TLB_SETS];
+	/*! The entries. */
+	struct soft_tlb_entry entries[SOFT_TLB_SETS][SOFT_TLB_WAYS];
+	/*! Owner-maintained statistics. */
+	uint64_t hits, misses, fills, large_fills, slow_accesses;
+};
+
+static TAILQ_HEAD(, soft_tlb) tlb_queue = TAILQ_HEAD_INITIALIZER(tlb_queue);
+static kspinlock_t tlb_queue_lock = KSPINLOCK_NAMED_INITIALISER(
+    "tlb_queue_lock");
+static __thread struct soft_tlb *SIM_tlb = NULL;
+/* statistics of TLBs since freed; protected by tlb_queue_lock */
+static uint64_t retired_hits, retired_misses, retired_fills,
+    retired_large_fills, retired_slow_accesses;
+
+/* shootdown statistics; updated by initiators with the PFN lock held */
+static uint64_t nshootdowns[kVMTLBInvalMax], nshootdown_pages[kVMTLBInvalMax],
+    nshootdown_hits[kVMTLBInvalMax], nshootdown_wasted[kVMTLBInvalMax];
+
+static struct soft_tlb *
+tlb_get(void)
+{
+	struct soft_tlb *tlb = SIM_tlb;
+	ipl_t		 ipl;
+
+	if (tlb != NULL)
+		return tlb;
+
+	tlb = calloc(1, sizeof(*tlb));
+	tlb->lock = (kspinlock_t)KSPINLOCK_NAMED_INITIALISER("soft tlb");
+
+	ipl = ke_spinlock_acquire(&tlb_queue_lock);
+	TAILQ_INSERT_TAIL(&tlb_queue, tlb, queue_entry);
+	ke_spinlock_release(&tlb_queue_lock, ipl);
+
+	SIM_tlb = tlb;
+	return tlb;
+}
+
+void
+soft_mmu_thread_exit(void)
+{
+	struct soft_tlb *tlb = SIM_tlb;
+	ipl_t		 ipl;
+
+	if (tlb == NULL)
+		return;
+
+	/*
+	 * once off the queue, shootdowns no longer reach it, and nor does
+	 * anything else
+	 */
+	ipl = ke_spinlock_acquire(&tlb_queue_lock);
+	TAILQ_REMOVE(&tlb_queue, tlb, queue_entry);
+	retired_hits += tlb->hits;
+	retired_misses += tlb->misses;
+	retired_fills += tlb->fills;
+	retired_large_fills += tlb->large_fills;
+	retired_slow_accesses += tlb->slow_accesses;
+	ke_spinlock_release(&tlb_queue_lock, ipl);
+
+	SIM_tlb = NULL;
+	free(tlb);
+}
+
+static inline struct soft_tlb_entry *
+tlb_probe(struct soft_tlb *tlb, paddr_t asid, vaddr_t tag, bool large)
+{
+	struct soft_tlb_entry *set = tlb->entries[tag % SOFT_TLB_SETS];
+
+	for (int i = 0; i < SOFT_TLB_WAYS; i++)
+		if (set[i].valid && set[i].vpn == tag && set[i].large == large &&
+		    set[i].asid == asid)
+			return &set[i];
+
+	return NULL;
+}
+
+/* find the entry translating \p vpn, whether its own or its large page's */
+static inline struct soft_tlb_entry *
+tlb_lookup(struct soft_tlb *tlb, paddr_t asid, vaddr_t vpn)
+{
+	struct soft_tlb_entry *entry = tlb_probe(tlb, asid, vpn, false);
+
+	if (entry == NULL)
+		entry = tlb_probe(tlb, asid, vpn >> SOFT_LEVEL_BITS, true);
+	return entry;
+}
+
+static inline pfn_t
+tlb_entry_pfn(struct soft_tlb_entry *entry, vaddr_t vpn)
+{
+	return entry->large ? entry->pfn + vpn % SOFT_PTES_PER_TABLE :
+			      entry->pfn;
+}
+
+/* whether \p entry translates any page of [vpn_start, vpn_end) */
+static inline bool
+tlb_entry_in(struct soft_tlb_entry *entry, vaddr_t vpn_start, vaddr_t vpn_end)
+{
+	vaddr_t first = entry->large ? entry->vpn << SOFT_LEVEL_BITS :
+				       entry->vpn,
+		end = first + (entry->large ? SOFT_PTES_PER_TABLE : 1);
+
+	return first < vpn_end && end > vpn_start;
+}
+
+/* for a large page, \p vpn and \p pfn are of its first page */
+static void
+tlb_fill(struct soft_tlb *tlb, paddr_t asid, vaddr_t vpn, pfn_t pfn,
+    bool writeable, bool large)
+{
+	struct soft_tlb_entry *entry;
+	vaddr_t		       tag = large ? vpn >> SOFT_LEVEL_BITS : vpn;
+	size_t		       set = tag % SOFT_TLB_SETS;
+
+	entry = tlb_probe(tlb, asid, tag, large);
+	if (entry == NULL) {
+		entry = &tlb->entries[set][tlb->victim[set]];
+		tlb->victim[set] = (tlb->victim[set] + 1) % SOFT_TLB_WAYS;
+	}
+
+	entry->asid = asid;
+	entry->vpn = tag;
+	entry->pfn = pfn;
+	entry->large = large;
+	entry->writeable = writeable;
+	entry->valid = 1;
+	tlb->fills++;
+	if (large)
+		tlb->large_fills++;
+}
+
+/* wait out the simulated extra latency of an access to the slow tier */
+static void
+slow_tier_wait(void)
+{
+	uint64_t until;
+
+	if (soft_slow_tier_latency_ns == 0)
+		return;
+
+	until = ke_nanotime() + soft_slow_tier_latency_ns;
+	while (ke_nanotime() < until)
+		soft_cpu_relax();
+}
+
+/*
+ * Walk the page tables of the current address space. Returns the leaf PTE, or
+ * the PML2 entry if it maps a large page.
+ * \pre PFN lock held
+ */
+static pte_hw_t *
+walk(vaddr_t addr, const char **failed_level)
+{
+	pte_hw_t       *top, *mid, *bot;
+	union soft_addr unpacked;
+
+	unpacked.addr = addr;
+
+	top = (pte_hw_t *)P2V(SIM_cr3);
+	if (!top[unpacked.top].valid) {
+		*failed_level = "pml3";
+		return NULL;
+	}
+
+	mid = (pte_hw_t *)P2V(PFN_TO_PADDR(top[unpacked.top].pfn));
+	if (!mid[unpacked.mid].valid) {
+		*failed_level = "pml2";
+		return NULL;
+	} else if (mid[unpacked.mid].large) {
+		return &mid[unpacked.mid];
+	}
+
+	bot = (pte_hw_t *)P2V(PFN_TO_PADDR(mid[unpacked.mid].pfn));
+	if (!bot[unpacked.bot].valid) {
+		*failed_level = "pml1";
+		return NULL;
+	}
+
+	return &bot[unpacked.bot];
+}
+
+paddr_t
+soft_mmu_access(vaddr_t addr, bool for_write)
+{
+	struct soft_tlb	      *tlb = tlb_get();
+	struct soft_tlb_entry *entry;
+	vaddr_t		       vpn = addr / PGSIZE;
+	paddr_t		       final_addr;
+	pte_hw_t	      *pte;
+	const char	      *failed_level;
+	ipl_t		       ipl, tlb_ipl;
+
+	tlb_ipl = ke_spinlock_acquire(&tlb->lock);
+	entry = tlb_lookup(tlb, SIM_cr3, vpn);
+	if (entry != NULL && (!for_write || entry->writeable)) {
+		tlb->hits++;
+		final_addr = PFN_TO_PADDR(tlb_entry_pfn(entry, vpn));
+		if (final_addr >= soft_slow_tier_base)
+			tlb->slow_accesses++;
+		ke_spinlock_release(&tlb->lock, tlb_ipl);
+		goto done;
+	}
+	tlb->misses++;
+	ke_spinlock_release(&tlb->lock, tlb_ipl);
+
+retry:
+	ipl = vmp_acquire_pfn_lock();
+	pte = walk(addr, &failed_level);
+	if (pte == NULL) {
+		vmp_release_pfn_lock(ipl);
+		vmp_fault(addr, for_write, NULL, NULL);
+		goto retry;
+	} else if (for_write && !pte->writeable) {
+		vmp_release_pfn_lock(ipl);
+		vmp_fault(addr, for_write, NULL, NULL);
+		goto retry;
+	}
+
+	if (pte->large) {
+		vaddr_t index = vpn % SOFT_PTES_PER_TABLE;
+
+		final_addr = PFN_TO_PADDR((pte->pfn + index));
+		vpn -= index;
+	} else {
+		final_addr = PFN_TO_PADDR(pte->pfn);
+	}
+	pte->accessed = 1;
+
+	tlb_ipl = ke_spinlock_acquire(&tlb->lock);
+	tlb_fill(tlb, SIM_cr3, vpn, pte->pfn, pte->writeable, pte->large);
+	if (final_addr >= soft_slow_tier_base)
+		tlb->slow_accesses++;
+	ke_spinlock_release(&tlb->lock, tlb_ipl);
+	vmp_release_pfn_lock(ipl);
+
+done:
+	if (final_addr >= soft_slow_tier_base)
+		slow_tier_wait();
+	return final_addr + addr % PGSIZE;
+}
+
+void
+vmp_md_tlb_invalidate(vmp_procstate_t *vmps, vaddr_t start, vaddr_t end,
+    enum vmp_tlb_inval_reason reason)
+{
+	struct soft_tlb *tlb;
+	paddr_t		 asid = vm_page_paddr(vmps->md.top);
+	vaddr_t		 vpn_start = start / PGSIZE,
+		 vpn_end = (end + PGSIZE - 1) / PGSIZE;
+	size_t		 nhits = 0;
+	ipl_t		 ipl;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+	kassert(reason < kVMTLBInvalMax);
+
+	nshootdowns[reason]++;
+	nshootdown_pages[reason] += vpn_end - vpn_start;
+
+	ipl = ke_spinlock_acquire(&tlb_queue_lock);
+	TAILQ_FOREACH (tlb, &tlb_queue, queue_entry) {
+		ipl_t tlb_ipl = ke_spinlock_acquire(&tlb->lock);
+
+		if (vpn_end - vpn_start > SOFT_TLB_SETS * SOFT_TLB_WAYS) {
+			/* cheaper to sweep the whole thing */
+			for (int s = 0; s < SOFT_TLB_SETS; s++) {
+				for (int w = 0; w < SOFT_TLB_WAYS; w++) {
+					struct soft_tlb_entry *entry =
+					    &tlb->entries[s][w];
+					if (entry->valid &&
+					    entry->asid == asid &&
+					    tlb_entry_in(entry, vpn_start,
+						vpn_end)) {
+						entry->valid = 0;
+						nhits++;
+					}
+				}
+			}
+		} else {
+			for (vaddr_t vpn = vpn_start; vpn < vpn_end; vpn++) {
+				struct soft_tlb_entry *entry;
+
+				/* both its own entry and its large page's */
+				while ((entry = tlb_lookup(tlb, asid, vpn)) !=
+				    NULL) {
+					entry->valid = 0;
+					nhits++;
+				}
+			}
+		}
+
+		ke_spinlock_release(&tlb->lock, tlb_ipl);
+	}
+	ke_spinlock_release(&tlb_queue_lock, ipl);
+
+	nshootdown_hits[reason] += nhits;
+	if (nhits == 0)
+		nshootdown_wasted[reason]++;
+}
+
+void
+soft_tlb_get_stats(struct soft_tlb_stats *stats)
+{
+	struct soft_tlb *tlb;
+	ipl_t		 ipl, queue_ipl;
+
+	memset(stats, 0x0, sizeof(*stats));
+
+	ipl = vmp_acquire_pfn_lock();
+	for (int i = 0; i < kVMTLBInvalMax; i++) {
+		stats->shootdowns[i] = nshootdowns[i];
+		stats->shootdown_pages[i] = nshootdown_pages[i];
+		stats->shootdown_hits[i] = nshootdown_hits[i];
+		stats->shootdown_wasted[i] = nshootdown_wasted[i];
+	}
+
+	queue_ipl = ke_spinlock_acquire(&tlb_queue_lock);
+	stats->hits = retired_hits;
+	stats->misses = retired_misses;
+	stats->fills = retired_fills;
+	stats->large_fills = retired_large_fills;
+	stats->slow_accesses = retired_slow_accesses;
+	TAILQ_FOREACH (tlb, &tlb_queue, queue_entry) {
+		ipl_t tlb_ipl = ke_spinlock_acquire(&tlb->lock);
+		stats->hits += tlb->hits;
+		stats->misses += tlb->misses;
+		stats->fills += tlb->fills;
+		stats->large_fills += tlb->large_fills;
+		stats->slow_accesses += tlb->slow_accesses;
+		ke_spinlock_release(&tlb->lock, tlb_ipl);
+	}
+	ke_spinlock_release(&tlb_queue_lock, queue_ipl);
+	vmp_release_pfn_lock(ipl);
+}
+
+void
+soft_tlb_dump_stats(void)
+{
+	static const char *reasons[kVMTLBInvalMax] = {
+		[kVMTLBInvalEviction] = "ws-evict",
+		[kVMTLBInvalUnmap] = "unmap",
+		[kVMTLBInvalDestroy] = "destroy",
+		[kVMTLBInvalZeroPage] = "zero-page",
+		[kVMTLBInvalMerge] = "merge",
+		[kVMTLBInvalLarge] = "large-page",
+		[kVMTLBInvalTier] = "tier",
+		[kVMTLBInvalMigrate] = "migrate",
+	};
+	struct soft_tlb_stats stats;
+
+	soft_tlb_get_stats(&stats);
+
+	kprintf("TLB: %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64
+		" fills (%" PRIu64 " of large pages)\n",
+	    stats.hits, stats.misses, stats.fills, stats.large_fills);
+	for (int i = 0; i < kVMTLBInvalMax; i++)
+		kprintf("TLB shootdowns (%s): %" PRIu64 " calls, %" PRIu64
+			" pages, %" PRIu64 " entries hit, %" PRIu64
+			" wasted\n",
+		    reasons[i], stats.shootdowns[i], stats.shootdown_pages[i],
+		    stats.shootdown_hits[i], stats.shootdown_wasted[i]);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef KRX_SOFT_MMU_H
+#define KRX_SOFT_MMU_H
+
+#include "vm/vmp.h"
+
+/*! Geometry of each simulated CPU's TLB. */
+#define SOFT_TLB_SETS 64
+#define SOFT_TLB_WAYS 4
+
+struct soft_tlb_stats {
+	/*! summed over all simulated CPUs; large_fills are of large pages */
+	uint64_t hits, misses, fills, large_fills;
+	/*! accesses resolving to the slow memory tier */
+	uint64_t slow_accesses;
+	/*! shootdown requests by reason */
+	uint64_t shootdowns[kVMTLBInvalMax];
+	/*! pages covered by those requests */
+	uint64_t shootdown_pages[kVMTLBInvalMax];
+	/*! TLB entries actually invalidated by them */
+	uint64_t shootdown_hits[kVMTLBInvalMax];
+	/*! requests which invalidated nothing anywhere */
+	uint64_t shootdown_wasted[kVMTLBInvalMax];
+};
+
+/*!
+ * @brief Simulate an access by the current thread to a virtual address.
+ *
+ * Translates through the calling thread's TLB, walking the page tables of
+ * SIM_cr3 and taking page faults as necessary.
+ *
+ * @returns Physical address the access resolved to.
+ */
+paddr_t soft_mmu_access(vaddr_t addr, bool for_write);
+
+/*!
+ * @brief Free the calling thread's TLB.
+ *
+ * To be called by each thread that made accesses, before it exits. Its
+ * statistics are kept in the totals.
+ */
+void soft_mmu_thread_exit(void);
+
+/*! @brief Get TLB statistics summed across all simulated CPUs. */
+void soft_tlb_get_stats(struct soft_tlb_stats *stats);
+/*! @brief Print TLB statistics. */
+void soft_tlb_dump_stats(void);
+
+#endif /* KRX_SOFT_MMU_H */
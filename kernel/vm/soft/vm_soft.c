@@ -1,56 +1,460 @@
+#include <stdio.h>
+#include <sys/mman.h>
+
 #include "../vmp.h"
+#include "kdk/libkern.h"
 #include "kdk/vm.h"
+#include "kdk/vm_trace.h"
 #include "vm/soft/vmp_soft.h"
 
-extern uint8_t page_contents[PGSIZE * 128];
+__thread paddr_t  SIM_cr3;
+__thread ipl_t	  SIM_ipl = kIPL0;
+__thread void	 *SIM_vmps = NULL;
+__thread unsigned SIM_cpu_num;
+uint8_t		 *soft_pmem;
+static uint8_t	 *soft_pagefile;
+bool		  soft_pwc_enabled = true;
+bool		  soft_large_pages_enabled = false;
+uint64_t	  soft_pagefile_latency_ns;
+uintptr_t	  soft_slow_tier_base = UINTPTR_MAX;
+uint64_t	  soft_slow_tier_latency_ns;
 
-vaddr_t
-P2V(paddr_t paddr)
+unsigned
+soft_cpu_num_assign(void)
+{
+	static unsigned next_cpu_num;
+
+	SIM_cpu_num = __atomic_fetch_add(&next_cpu_num, 1, __ATOMIC_RELAXED) %
+	    KRX_MAX_CPUS + 1;
+	return SIM_cpu_num;
+}
+
+void
+soft_pmem_init(size_t size, size_t slow_size)
+{
+	/* the zero page is wired for good, so the default leaves it room */
+	if (size == 0)
+		size = (size_t)KRX_SOFT_PMEM_KIB * 1024 + PGSIZE;
+	size = PGROUNDDOWN(size);
+	slow_size = PGROUNDDOWN(slow_size);
+
+	soft_pmem = mmap(NULL, size + slow_size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (soft_pmem == MAP_FAILED)
+		kfatal("Failed to map %zu bytes of simulated memory\n",
+		    size + slow_size);
+
+	vm_region_add(0, size, kVMTierFast);
+	if (slow_size != 0) {
+		soft_slow_tier_base = size;
+		vm_region_add(size, slow_size, kVMTierSlow);
+	}
+}
+
+void
+soft_pagefile_init(size_t size)
+{
+	size = PGROUNDDOWN(size);
+
+	soft_pagefile = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (soft_pagefile == MAP_FAILED)
+		kfatal("Failed to map %zu bytes of simulated pagefile\n", size);
+
+	vm_pagefile_add(size / PGSIZE);
+}
+
+int
+soft_trace_save(const char *path)
+{
+	struct vm_trace_file_header header = {
+		.magic = VM_TRACE_MAGIC,
+		.version = VM_TRACE_VERSION,
+		.event_size = sizeof(struct vm_trace_event),
+		.ring_size = VM_TRACE_RING_SIZE,
+	};
+	struct vm_trace_event	   *events;
+	FILE			   *file;
+	int			    r = 0;
+
+	events = malloc(sizeof(*events) * VM_TRACE_RING_SIZE);
+	if (events == NULL)
+		return -1;
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		free(events);
+		return -1;
+	}
+
+	/* the header is rewritten once the number of rings is known */
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+		r = -1;
+
+	for (unsigned cpu = 0; r == 0 && cpu < KRX_MAX_CPUS; cpu++) {
+		struct vm_trace_file_ring ring = { .cpu = cpu };
+
+		ring.nevents = vm_trace_read_ring(cpu, events, &ring.nlost);
+		if (ring.nevents == 0 && ring.nlost == 0)
+			continue;
+
+		if (fwrite(&ring, sizeof(ring), 1, file) != 1 ||
+		    fwrite(events, sizeof(*events), ring.nevents, file) !=
+			ring.nevents)
+			r = -1;
+		header.nrings++;
+	}
+
+	if (r == 0 && (fseek(file, 0, SEEK_SET) != 0 ||
+			  fwrite(&header, sizeof(header), 1, file) != 1))
+		r = -1;
+	if (fclose(file) != 0)
+		r = -1;
+	free(events);
+
+	return r;
+}
+
+/* wait out the simulated latency of a pagefile I/O */
+static void
+pagefile_io_wait(void)
+{
+	struct timespec ts;
+
+	if (soft_pagefile_latency_ns == 0)
+		return;
+
+	ts.tv_sec = soft_pagefile_latency_ns / 1000000000;
+	ts.tv_nsec = soft_pagefile_latency_ns % 1000000000;
+	nanosleep(&ts, NULL);
+}
+
+void
+vmp_md_pagefile_write(uintptr_t slot, vm_page_t *page)
 {
-	return paddr + (vaddr_t)page_contents;
+	pagefile_io_wait();
+	memcpy(soft_pagefile + (slot - 1) * PGSIZE,
+	    (void *)vm_page_direct_map_addr(page), PGSIZE);
 }
 
-paddr_t
-V2P(vaddr_t vaddr)
+void
+vmp_md_pagefile_read(uintptr_t slot, vm_page_t *page)
+{
+	pagefile_io_wait();
+	memcpy((void *)vm_page_direct_map_addr(page),
+	    soft_pagefile + (slot - 1) * PGSIZE, PGSIZE);
+}
+
+void
+vmp_md_pagefile_read_cluster(uintptr_t slot, vm_page_t **pages,
+    size_t npages)
 {
-	return vaddr - (vaddr_t)page_contents;
+	pagefile_io_wait();
+	for (size_t i = 0; i < npages; i++)
+		memcpy((void *)vm_page_direct_map_addr(pages[i]),
+		    soft_pagefile + (slot - 1 + i) * PGSIZE, PGSIZE);
 }
 
 int
 vmp_md_ps_init(vmp_procstate_t *vmps)
 {
 	vm_page_t *page;
+	ipl_t	   ipl;
 	int	   r;
 
+	ipl = vmp_acquire_pfn_lock();
 	r = vmp_page_alloc_locked(&page, &vmps->account, kPageUsePML3, false);
+	vmp_release_pfn_lock(ipl);
 	if (r != 0)
 		return r;
 
 	vmps->md.top = page;
+	memset(vmps->md.pwc, 0x0, sizeof(vmps->md.pwc));
+	vmps->md.pwc_hits = vmps->md.pwc_misses = 0;
 
 	return 0;
 }
 
-vm_fault_return_t
-vmp_md_wire_pte(vmp_procstate_t *vmps, vaddr_t vaddr,
+static inline struct soft_pwc_entry *
+pwc_entry(vmp_procstate_t *vmps, vaddr_t region)
+{
+	return &vmps->md.pwc[region % SOFT_PWC_ENTRIES];
+}
+
+/*
+ * Look up the leaf table covering \p vaddr in the paging-structure cache.
+ * \pre PFN lock held
+ */
+static inline struct soft_pwc_entry *
+pwc_lookup(vmp_procstate_t *vmps, vaddr_t vaddr)
+{
+	vaddr_t		       region = vaddr >> (PGSHIFT + SOFT_LEVEL_BITS);
+	struct soft_pwc_entry *entry = pwc_entry(vmps, region);
+
+	if (!soft_pwc_enabled)
+		return NULL;
+
+	if (entry->pml1 != NULL && entry->region == region) {
+		vmps->md.pwc_hits++;
+		return entry;
+	}
+
+	vmps->md.pwc_misses++;
+	return NULL;
+}
+
+static inline void
+pwc_fill(vmp_procstate_t *vmps, vaddr_t vaddr, vm_page_t *pml2_page,
+    vm_page_t *pml1_page)
+{
+	vaddr_t		       region = vaddr >> (PGSHIFT + SOFT_LEVEL_BITS);
+	struct soft_pwc_entry *entry = pwc_entry(vmps, region);
+
+	entry->region = region;
+	entry->pml1 = pml1_page;
+	entry->pml2 = pml2_page;
+}
+
+/* Forget any entry naming \p page, which is about to be freed. */
+static void
+pwc_invalidate(vmp_procstate_t *vmps, vm_page_t *page)
+{
+	for (size_t i = 0; i < SOFT_PWC_ENTRIES; i++) {
+		struct soft_pwc_entry *entry = &vmps->md.pwc[i];
+		if (entry->pml1 == page || entry->pml2 == page)
+			entry->pml1 = entry->pml2 = NULL;
+	}
+}
+
+/* the \p i'th page mapped by a large PML2 entry */
+static inline vm_page_t *
+large_page(pte_t *pml2e, size_t i)
+{
+	return vm_paddr_to_page(PFN_TO_PADDR((pml2e->hw.pfn + i)));
+}
+
+/* the leaf PTE that would map the \p i'th page of a large PML2 entry */
+static inline pte_t
+large_pte(pte_t *pml2e, size_t i)
+{
+	pte_t pte;
+
+	vmp_md_pte_make_hw(&pte, pml2e->hw.pfn + i, pml2e->hw.writeable);
+	return pte;
+}
+
+/* the large PML2 entry mapping \p vaddr, if there is one */
+static pte_t *
+large_entry(vmp_procstate_t *vmps, vaddr_t vaddr)
+{
+	union soft_addr addr = { .addr = vaddr };
+	pte_t	       *pml3 = (pte_t *)vm_page_direct_map_addr(vmps->md.top),
+		 *pml2;
+
+	if (!vmp_md_pte_is_valid(&pml3[addr.top]))
+		return NULL;
+	pml2 = (pte_t *)P2V(PFN_TO_PADDR(pml3[addr.top].hw.pfn));
+	if (!vmp_md_pte_is_valid(&pml2[addr.mid]) || !pml2[addr.mid].hw.large)
+		return NULL;
+	return &pml2[addr.mid];
+}
+
+/* index within its table of the entry at physical address \p entry */
+static inline size_t
+entry_index(paddr_t entry)
+{
+	return (entry % PGSIZE) / sizeof(pte_t);
+}
+
+vaddr_t
+vmp_md_pte_vaddr(pte_t *pte)
+{
+	paddr_t		pte_phys = V2P((vaddr_t)pte);
+	vm_page_t      *pml1_page = vm_paddr_to_page(pte_phys), *pml2_page;
+	union soft_addr addr = { .addr = 0 };
+
+	pml2_page = vm_paddr_to_page(pml1_page->referent_pte);
+	addr.bot = entry_index(pte_phys);
+	addr.mid = entry_index(pml1_page->referent_pte);
+	addr.top = entry_index(pml2_page->referent_pte);
+
+	return addr.addr;
+}
+
+/*
+ * Split the large page mapping [base, base + SOFT_LARGE_SIZE) through \p pml2e
+ * back into a leaf table mapping the same pages. The leaf table pointer takes
+ * over the large entry's used PTE count and reference in the PML2.
+ *
+ * If \p evict, the pages are all evicted, and their PTEs left in transition;
+ * the large page's working set entry goes with them. Otherwise the entry is
+ * replaced with one for each page.
+ */
+static int
+large_demote(vmp_procstate_t *vmps, vaddr_t base, pte_t *pml2e, bool evict)
+{
+	vm_page_t *pml1_page;
+	pte_t	  *pml1;
+	bool	   writeable = pml2e->hw.writeable;
+	int	   r;
+
+	r = vmp_pagetable_page_alloc_locked(&pml1_page, &vmps->account,
+	    kPageUsePML1);
+	if (r != 0)
+		return r;
+
+	pml1 = (pte_t *)vm_page_direct_map_addr(pml1_page);
+	pml1_page->referent_pte = V2P((vaddr_t)pml2e);
+	/* (the allocation's reference counts as one of the PTEs') */
+	pml1_page->used_ptes = SOFT_PTES_PER_TABLE;
+	pml1_page->refcnt += SOFT_PTES_PER_TABLE - 1;
+
+	for (size_t i = 0; i < SOFT_PTES_PER_TABLE; i++) {
+		vm_page_t *page = large_page(pml2e, i);
+
+		page->referent_pte = V2P((vaddr_t)&pml1[i]);
+		if (evict) {
+			/* as vm_page_evict() does */
+			page->dirty |= writeable;
+			vmp_md_pte_make_trans(&pml1[i], page->pfn);
+			vmp_page_release_locked(page, &vmps->account);
+		} else {
+			vmp_md_pte_make_hw(&pml1[i], page->pfn, writeable);
+		}
+	}
+
+	vmp_md_pte_make_hw(pml2e, PADDR_TO_PFN(vm_page_paddr(pml1_page)),
+	    true);
+	vmp_md_tlb_invalidate(vmps, base, base + SOFT_LARGE_SIZE,
+	    kVMTLBInvalLarge);
+	VMP_STAT_INC(nlargedemote);
+
+	if (!evict) {
+		/* (the caller may already have removed it, if unmapping) */
+		vmp_wsl_remove_range(vmps, base, base + PGSIZE);
+		for (size_t i = 0; i < SOFT_PTES_PER_TABLE; i++)
+			vmp_wsl_insert(vmps, base + i * PGSIZE);
+	}
+
+	return 0;
+}
+
+void
+vmp_md_large_evict(vmp_procstate_t *vmps, vaddr_t vaddr)
+{
+	pte_t *pml2e = large_entry(vmps, vaddr);
+	int    r;
+
+	kassert(pml2e != NULL);
+	r = large_demote(vmps, vaddr, pml2e, true);
+	kassert(r == 0);
+}
+
+bool
+vmp_md_try_promote(vmp_procstate_t *vmps, vm_vad_t *vad, vaddr_t vaddr,
     struct vmp_md_fault_state *state)
 {
-	union soft_addr addr;
-	vm_page_t      *pml2_page, *pml1_page;
+	vaddr_t	   base = vaddr & ~(SOFT_LARGE_SIZE - 1);
+	vm_page_t *pml1_page = state->bot_page, *pages[SOFT_PTES_PER_TABLE],
+		  *run;
+	pte_t	  *pml1, *pml2e;
+	bool	   in_place;
 
-	if (state->pte != NULL)
-		return kVMFaultRetOK;
+	/* the caller's own wiring of the table counts as a used PTE */
+	if (!soft_large_pages_enabled ||
+	    pml1_page->used_ptes != SOFT_PTES_PER_TABLE + 1)
+		return false;
+	if (vad->section != NULL || base < vad->start ||
+	    base + SOFT_LARGE_SIZE > vad->end)
+		return false;
 
-	addr.addr = vaddr;
+	pml1 = (pte_t *)vm_page_direct_map_addr(pml1_page);
+	for (size_t i = 0; i < SOFT_PTES_PER_TABLE; i++) {
+		if (!vmp_md_pte_is_valid(&pml1[i]) ||
+		    !vmp_md_pte_is_writeable(&pml1[i]))
+			return false;
+		pages[i] = vmp_md_pte_page(&pml1[i]);
+		/* a page someone else has retained can't be moved */
+		if (pages[i]->use != kPageUseAnonPrivate ||
+		    pages[i]->refcnt != 1)
+			return false;
+	}
+
+	in_place = pages[0]->pfn % SOFT_PTES_PER_TABLE == 0;
+	for (size_t i = 1; in_place && i < SOFT_PTES_PER_TABLE; i++)
+		in_place = pages[i]->pfn == pages[0]->pfn + i;
+
+	if (in_place) {
+		run = pages[0];
+	} else if (vmp_page_alloc_contig_locked(&run, SOFT_PTES_PER_TABLE,
+		       &vmps->account, kPageUseAnonPrivate) != 0) {
+		/* make a run; it may move the table's own pages, so refetch */
+		if (vmp_compact_locked(SOFT_PTES_PER_TABLE,
+			SOFT_PTES_PER_TABLE) == 0 ||
+		    vmp_page_alloc_contig_locked(&run, SOFT_PTES_PER_TABLE,
+			&vmps->account, kPageUseAnonPrivate) != 0) {
+			VMP_STAT_INC(nlargenocontig);
+			return false;
+		}
+		for (size_t i = 0; i < SOFT_PTES_PER_TABLE; i++)
+			pages[i] = vmp_md_pte_page(&pml1[i]);
+	}
+
+	pml2e = (pte_t *)P2V(pml1_page->referent_pte);
+	for (size_t i = 0; i < SOFT_PTES_PER_TABLE; i++) {
+		vm_page_t *page = in_place ? pages[i] : run + i;
+
+		vmp_md_pte_make_empty(&pml1[i]);
+		vmp_wsl_remove(vmps, base + i * PGSIZE);
+		if (!in_place) {
+			memcpy((void *)vm_page_direct_map_addr(page),
+			    (void *)vm_page_direct_map_addr(pages[i]), PGSIZE);
+			page->dirty = pages[i]->dirty;
+			page->owner = vmps;
+			vmp_page_delete_locked(pages[i], &vmps->account, true);
+		}
+		page->referent_pte = pml1_page->referent_pte;
+	}
+
+	/*
+	 * the large entry takes over the leaf table pointer's used PTE count
+	 * and reference in the PML2. the leaf table is freed as though the
+	 * caller's state had been released and its PTEs all emptied.
+	 */
+	*(uint64_t *)pml2e = 0;
+	pml2e->hw.pfn = run->pfn;
+	pml2e->hw.large = 1;
+	pml2e->hw.writeable = 1;
+	pml2e->hw.valid = 1;
 
-	pte_t *top_phys = (void *)SIM_cr3,
+	pml1_page->used_ptes = 0;
+	pml1_page->refcnt -= SOFT_PTES_PER_TABLE - 1;
+	vmp_page_release_locked(pml1_page, &vmps->account);
+	vmp_page_release_locked(state->mid_page, &vmps->account);
+	pwc_invalidate(vmps, pml1_page);
+	vmp_pagetable_page_free_locked(pml1_page, &vmps->account);
+	memset(state, 0x0, sizeof(*state));
+
+	vmp_md_tlb_invalidate(vmps, base, base + SOFT_LARGE_SIZE,
+	    kVMTLBInvalLarge);
+	vmp_wsl_insert_pages(vmps, base, SOFT_PTES_PER_TABLE);
+	VMP_STAT_INC(nlargepromote);
+
+	return true;
+}
+
+/* wire the PML2 covering \p addr into \p state, allocating it if need be */
+static vm_fault_return_t
+wire_pml2(vmp_procstate_t *vmps, union soft_addr addr,
+    struct vmp_md_fault_state *state)
+{
+	vm_page_t *pml2_page;
+	pte_t	  *top_phys = (void *)vm_page_paddr(vmps->md.top),
 	      *pml3_virt = (void *)P2V((paddr_t)top_phys);
 
-	if (state->mid_page != NULL)
-		goto fetch_pml1;
-	else if (vmp_md_pte_is_empty(&pml3_virt[addr.top])) {
-		int	  r = vmp_page_alloc_locked(&pml2_page, &vmps->account,
-			  kPageUsePML2, false);
+	if (vmp_md_pte_is_empty(&pml3_virt[addr.top])) {
+		int	  r = vmp_pagetable_page_alloc_locked(&pml2_page,
+			  &vmps->account, kPageUsePML2);
 		uintptr_t pml2_phys;
 
 		if (r != 0)
@@ -75,16 +479,57 @@ vmp_md_wire_pte(vmp_procstate_t *vmps, vaddr_t vaddr,
 		kfatal("Unhandled\n");
 	}
 
-fetch_pml1:
+	return kVMFaultRetOK;
+}
+
+vm_fault_return_t
+vmp_md_wire_pte(vmp_procstate_t *vmps, vaddr_t vaddr,
+    struct vmp_md_fault_state *state)
+{
+	union soft_addr addr;
+	vm_page_t      *pml2_page, *pml1_page;
+
+	if (state->pte != NULL)
+		return kVMFaultRetOK;
+
+	addr.addr = vaddr;
+
+	if (state->mid_page == NULL && state->bot_page == NULL) {
+		struct soft_pwc_entry *entry = pwc_lookup(vmps, vaddr);
+		if (entry != NULL) {
+			state->mid_page = vmp_page_retain_locked(entry->pml2,
+			    &vmps->account);
+			state->bot_page = vmp_page_retain_locked(entry->pml1,
+			    &vmps->account);
+			goto fetch_pte;
+		}
+	}
+
+	if (state->mid_page == NULL) {
+		vm_fault_return_t r = wire_pml2(vmps, addr, state);
+		if (r != kVMFaultRetOK)
+			return r;
+	}
+
 	pml2_page = state->mid_page;
 	pte_t *pml2_phys = (void *)vm_page_paddr(pml2_page),
 	      *pml2_virt = (void *)P2V((paddr_t)pml2_phys);
 
 	if (state->bot_page != NULL)
 		goto fetch_pte;
-	else if (vmp_md_pte_is_empty(&pml2_virt[addr.mid])) {
-		int	  r = vmp_page_alloc_locked(&pml1_page, &vmps->account,
-			  kPageUsePML1, false);
+
+	if (vmp_md_pte_is_valid(&pml2_virt[addr.mid]) &&
+	    pml2_virt[addr.mid].hw.large) {
+		/* a PTE within a large page is wanted, so it must be split */
+		int r = large_demote(vmps, vaddr & ~(SOFT_LARGE_SIZE - 1),
+		    &pml2_virt[addr.mid], false);
+		if (r != 0)
+			return r;
+	}
+
+	if (vmp_md_pte_is_empty(&pml2_virt[addr.mid])) {
+		int	  r = vmp_pagetable_page_alloc_locked(&pml1_page,
+			  &vmps->account, kPageUsePML1);
 		uintptr_t pml1_phys;
 
 		if (r != 0)
@@ -115,6 +560,8 @@ fetch_pml1:
 		kfatal("Unhandled\n");
 	}
 
+	pwc_fill(vmps, vaddr, pml2_page, pml1_page);
+
 fetch_pte:
 	pml1_page = state->bot_page;
 	pte_t *pml1 = (void *)vm_page_paddr(pml1_page);
@@ -124,6 +571,9 @@ fetch_pte:
 	return kVMFaultRetOK;
 }
 
+static void pagetable_ptes_became_zero(vmp_procstate_t *vmps, vm_page_t *page,
+    size_t n);
+
 static void
 free_pagetable(vmp_procstate_t *vmps, vm_page_t *page)
 {
@@ -139,15 +589,15 @@ free_pagetable(vmp_procstate_t *vmps, vm_page_t *page)
 		pte_t	  *referent_pte_phys = (void *)page->referent_pte,
 		      *referent_pte_virt = (pte_t *)P2V(
 			  (paddr_t)referent_pte_phys);
+		bool	   is_pml1 = page->use == kPageUsePML1;
 		parent_page = vm_paddr_to_page((paddr_t)referent_pte_phys);
 
 		vmp_md_pte_make_empty(referent_pte_virt);
-		if (page->use != kPageUsePML2) {
-			parent_page->used_ptes--;
-			if (parent_page->used_ptes == 0)
-				free_pagetable(vmps, parent_page);
-		}
-		vmp_page_delete_locked(page, &vmps->account, true);
+		pwc_invalidate(vmps, page);
+		vmp_pagetable_page_free_locked(page, &vmps->account);
+		/* (the root pagetable doesn't keep count of used PTEs) */
+		if (is_pml1)
+			pagetable_ptes_became_zero(vmps, parent_page, 1);
 	} else if (page->use == kPageUsePML3) {
 		kfatal("Free PML3\n");
 	} else {
@@ -155,6 +605,25 @@ free_pagetable(vmp_procstate_t *vmps, vm_page_t *page)
 	}
 }
 
+/*
+ * Note that \p n PTEs of a pagetable have been made empty. Each PTE holds an
+ * unaccounted reference, so the references are dropped directly, except that
+ * if the table becomes empty, the last is dropped by freeing the table.
+ */
+static void
+pagetable_ptes_became_zero(vmp_procstate_t *vmps, vm_page_t *page, size_t n)
+{
+	kassert(page->used_ptes >= n && page->refcnt >= n);
+
+	page->used_ptes -= n;
+	if (page->used_ptes == 0) {
+		page->refcnt -= n - 1;
+		free_pagetable(vmps, page);
+	} else {
+		page->refcnt -= n;
+	}
+}
+
 static void
 vmp_pagetable_page_pte_became_zero(vmp_procstate_t *vmps, vm_page_t *page)
 {
@@ -165,6 +634,159 @@ vmp_pagetable_page_pte_became_zero(vmp_procstate_t *vmps, vm_page_t *page)
 		vmp_page_release_locked(page, &vmps->account);
 }
 
+/* drop a wiring of a PML2, freeing it if it was only just allocated */
+static void
+pml2_unwire(vmp_procstate_t *vmps, vm_page_t *pml2_page)
+{
+	if (pml2_page->used_ptes == 0)
+		free_pagetable(vmps, pml2_page);
+	else
+		vmp_page_release_locked(pml2_page, &vmps->account);
+}
+
+/*
+ * Map a fresh large page over the region of the empty PML2 entry \p pml2e,
+ * beginning at \p base, wired by \p state. Returns false if there is no free
+ * run for it.
+ */
+static bool
+populate_large(vmp_procstate_t *vmps, struct vmp_md_fault_state *state,
+    pte_t *pml2e, vaddr_t base)
+{
+	vm_page_t *run;
+
+	if (vmp_page_alloc_contig_locked(&run, SOFT_PTES_PER_TABLE,
+		&vmps->account, kPageUseAnonPrivate) != 0)
+		return false;
+
+	for (size_t i = 0; i < SOFT_PTES_PER_TABLE; i++) {
+		memset((void *)vm_page_direct_map_addr(run + i), 0x0, PGSIZE);
+		run[i].owner = vmps;
+		run[i].referent_pte = V2P((vaddr_t)pml2e);
+	}
+
+	/* the large entry is a used PTE of the PML2, as a leaf table's is */
+	state->mid_page->refcnt++;
+	state->mid_page->used_ptes++;
+	*(uint64_t *)pml2e = 0;
+	pml2e->hw.pfn = run->pfn;
+	pml2e->hw.large = 1;
+	pml2e->hw.writeable = 1;
+	pml2e->hw.valid = 1;
+
+	vmp_wsl_insert_pages(vmps, base, SOFT_PTES_PER_TABLE);
+
+	return true;
+}
+
+/*
+ * Populate [start, end), which lies within one leaf table's region, counting
+ * the pages made resident in \p npopulated. Returns nonzero if memory ran
+ * short.
+ */
+static int
+populate_table(vmp_procstate_t *vmps, vm_vad_t *vad, vaddr_t start,
+    vaddr_t end, size_t *npopulated)
+{
+	struct vmp_md_fault_state state;
+	union soft_addr		  addr = { .addr = start };
+	vaddr_t			  vaddrs[SOFT_PTES_PER_TABLE];
+	size_t			  npages = (end - start) / PGSIZE, n = 0;
+	bool			  writeable = vad->flags.protection & kVMWrite;
+	pte_t			 *pml2e, *pml1;
+	int			  r = 0;
+
+	*npopulated = 0;
+	memset(&state, 0x0, sizeof(state));
+	if (wire_pml2(vmps, addr, &state) != kVMFaultRetOK)
+		return -1;
+
+	pml2e = &((pte_t *)P2V(vm_page_paddr(state.mid_page)))[addr.mid];
+	if (vmp_md_pte_is_valid(pml2e) && vmp_md_pte_is_large(pml2e)) {
+		/* all resident already */
+		pml2_unwire(vmps, state.mid_page);
+		return 0;
+	}
+
+	if (soft_large_pages_enabled && writeable &&
+	    npages == SOFT_PTES_PER_TABLE && vmp_md_pte_is_empty(pml2e) &&
+	    populate_large(vmps, &state, pml2e, start)) {
+		pml2_unwire(vmps, state.mid_page);
+		*npopulated = SOFT_PTES_PER_TABLE;
+		return 0;
+	}
+
+	if (vmp_md_wire_pte(vmps, start, &state) != kVMFaultRetOK) {
+		pml2_unwire(vmps, state.mid_page);
+		return -1;
+	}
+
+	pml1 = (pte_t *)vm_page_direct_map_addr(state.bot_page);
+	for (size_t i = addr.bot; i < addr.bot + npages; i++) {
+		vm_page_t *page;
+
+		if (!vmp_md_pte_is_empty(&pml1[i]))
+			continue;
+
+		if (!writeable && vmp_zero_page_enabled) {
+			/* as a read fault would; it takes no reference */
+			vmp_md_pte_make_hw(&pml1[i], vmp_zero_page->pfn, false);
+			state.bot_page->refcnt++;
+			state.bot_page->used_ptes++;
+			(*npopulated)++;
+			continue;
+		}
+
+		r = vmp_page_alloc_locked(&page, &vmps->account,
+		    kPageUseAnonPrivate, false);
+		if (r != 0)
+			break;
+		page->owner = vmps;
+		page->referent_pte = V2P((vaddr_t)&pml1[i]);
+
+		vmp_md_pte_make_hw(&pml1[i], page->pfn, writeable);
+		state.bot_page->refcnt++;
+		state.bot_page->used_ptes++;
+		vaddrs[n++] = start + (i - addr.bot) * PGSIZE;
+	}
+
+	vmp_wsl_insert_batch(vmps, vaddrs, n);
+	vmp_md_fault_state_release(vmps, &state);
+	*npopulated += n;
+
+	return r;
+}
+
+size_t
+vmp_md_populate(vmp_procstate_t *vmps, vm_vad_t *vad, vaddr_t start,
+    vaddr_t end)
+{
+	size_t total = 0;
+
+	for (vaddr_t va = start; va < end;) {
+		vaddr_t next = (va & ~(SOFT_LARGE_SIZE - 1)) + SOFT_LARGE_SIZE;
+		size_t	n;
+		ipl_t	ipl;
+		int	r;
+
+		if (next > end)
+			next = end;
+
+		ipl = vmp_acquire_pfn_lock();
+		r = populate_table(vmps, vad, va, next, &n);
+		vmp_release_pfn_lock(ipl);
+
+		total += n;
+		if (r != 0)
+			break;
+		va = next;
+	}
+
+	VMP_STAT_ADD(npopulated, total);
+
+	return total;
+}
+
 /*
  * fetch PTE (and containing page) for a given virtual address
  * (note: hope the optimiser is smart enough to inline this in its uses)
@@ -175,11 +797,18 @@ int
 vmp_mp_fetch_pte(vmp_procstate_t *vmps, vaddr_t vaddr, pte_t **pppte,
     vm_page_t **ptablepage)
 {
-	union soft_addr addr;
-	vm_page_t      *pml2_page, *pml1_page;
+	union soft_addr	       addr;
+	vm_page_t	      *pml2_page, *pml1_page;
+	struct soft_pwc_entry *entry;
 	addr.addr = vaddr;
 
-	pte_t *top_phys = (void *)SIM_cr3,
+	entry = pwc_lookup(vmps, vaddr);
+	if (entry != NULL) {
+		pml1_page = entry->pml1;
+		goto fetch_pte;
+	}
+
+	pte_t *top_phys = (void *)vm_page_paddr(vmps->md.top),
 	      *pml3_virt = (void *)P2V((paddr_t)top_phys);
 
 	if (vmp_md_pte_is_empty(&pml3_virt[addr.top])) {
@@ -197,7 +826,9 @@ fetch_pml1:;
 	pte_t *pml2_phys = (void *)vm_page_paddr(pml2_page),
 	      *pml2_virt = (void *)P2V((paddr_t)pml2_phys);
 
-	if (vmp_md_pte_is_empty(&pml2_virt[addr.mid])) {
+	if (vmp_md_pte_is_empty(&pml2_virt[addr.mid]) ||
+	    pml2_virt[addr.mid].hw.large) {
+		/* (a large page has no leaf PTEs) */
 		*pppte = NULL;
 		return -1;
 	} else if (vmp_md_pte_is_valid(&pml2_virt[addr.mid])) {
@@ -209,6 +840,8 @@ fetch_pml1:;
 		kfatal("Unhandled\n");
 	}
 
+	pwc_fill(vmps, vaddr, pml2_page, pml1_page);
+
 fetch_pte:;
 	pte_t *pml1 = (void *)vm_page_paddr(pml1_page);
 	*pppte = (pte_t *)P2V((paddr_t)&pml1[addr.bot]);
@@ -218,41 +851,258 @@ fetch_pte:;
 	return 0;
 }
 
+/*
+ * Unmap [vstart, vend), calling \p callback with each non-empty PTE removed.
+ *
+ * The walk descends the pagetable tree once, skipping empty upper-level
+ * entries wholesale and visiting each leaf table in a single pass; used PTE
+ * counts are adjusted once per leaf table, which is freed if it empties. The
+ * cost thus follows resident pagetables and PTEs, not the size of the range.
+ */
 void
 vmp_md_unmap_range_and_do(vmp_procstate_t *vmps, vaddr_t vstart, vaddr_t vend,
     void (*callback)(void *context, pte_t *saved_pte), void *context)
 {
-	union soft_addr start, end;
+	union soft_addr start, last;
+	pte_t	       *pml3 = (pte_t *)vm_page_direct_map_addr(vmps->md.top);
 	ipl_t		ipl;
-	pte_t	       *top_phys = (void *)SIM_cr3,
-	      *pml3_virt = (void *)P2V((paddr_t)top_phys);
+
+	if (vend <= vstart)
+		return;
 
 	start.addr = vstart;
-	end.addr = vend;
+	last.addr = vend - 1;
 
 	ipl = vmp_acquire_pfn_lock();
-	for (vaddr_t i = vstart; i <= vend; i += PGSIZE) {
-		pte_t	  *pte, saved_pte;
-		vm_page_t *table_page;
+	for (size_t top = start.top; top <= last.top; top++) {
+		size_t	   mid_first = top == start.top ? start.mid : 0,
+			 mid_last = top == last.top ? last.mid :
+						      SOFT_PTES_PER_TABLE - 1;
+		vm_page_t *pml2_page;
+		pte_t	  *pml2;
 
-		if (vmp_mp_fetch_pte(vmps, i, &pte, &table_page) != 0)
+		if (vmp_md_pte_is_empty(&pml3[top]))
 			continue;
 
-		saved_pte = *pte;
-		vmp_md_pte_make_empty(pte);
+		pml2_page = vm_paddr_to_page(PFN_TO_PADDR(pml3[top].hw.pfn));
+		pml2 = (pte_t *)vm_page_direct_map_addr(pml2_page);
+
+		for (size_t mid = mid_first; mid <= mid_last; mid++) {
+			bool	   first = top == start.top && mid == start.mid,
+			     last_table = top == last.top && mid == last.mid;
+			size_t	   bot_first = first ? start.bot : 0,
+				 bot_last = last_table ? last.bot :
+							 SOFT_PTES_PER_TABLE - 1,
+				 nzeroed = 0;
+			vm_page_t *pml1_page;
+			pte_t	  *pml1;
+
+			if (vmp_md_pte_is_empty(&pml2[mid]))
+				continue;
 
-		if (callback)
-			callback(context, &saved_pte);
+			if (pml2[mid].hw.large && (bot_first != 0 ||
+			    bot_last != SOFT_PTES_PER_TABLE - 1)) {
+				/* partly unmapped: split it, then carry on */
+				union soft_addr base = { .addr = 0 };
+				vaddr_t		end;
+				int		r;
 
-		vmp_pagetable_page_pte_became_zero(vmps, table_page);
+				base.top = top;
+				base.mid = mid;
+				end = base.addr + SOFT_LARGE_SIZE;
+				r = large_demote(vmps, base.addr, &pml2[mid],
+				    false);
+				kassert(r == 0);
+				/* the caller took the range out of the WS */
+				vmp_wsl_remove_range(vmps,
+				    base.addr > vstart ? base.addr : vstart,
+				    end < vend ? end : vend);
+			} else if (pml2[mid].hw.large) {
+				pte_t large = pml2[mid];
+
+				vmp_md_pte_make_empty(&pml2[mid]);
+				for (size_t i = 0; callback != NULL &&
+				     i < SOFT_PTES_PER_TABLE; i++) {
+					pte_t saved_pte = large_pte(&large, i);
+					callback(context, &saved_pte);
+				}
+
+				/* may free pml2_page */
+				pagetable_ptes_became_zero(vmps, pml2_page, 1);
+				continue;
+			}
+
+			pml1_page = vm_paddr_to_page(
+			    PFN_TO_PADDR(pml2[mid].hw.pfn));
+			pml1 = (pte_t *)vm_page_direct_map_addr(pml1_page);
+
+			for (size_t bot = bot_first; bot <= bot_last; bot++) {
+				pte_t saved_pte;
+
+				if (vmp_md_pte_is_empty(&pml1[bot]))
+					continue;
+
+				saved_pte = pml1[bot];
+				vmp_md_pte_make_empty(&pml1[bot]);
+				nzeroed++;
+
+				if (callback)
+					callback(context, &saved_pte);
+			}
+
+			/* may free pml1_page, and pml2_page with it */
+			if (nzeroed != 0)
+				pagetable_ptes_became_zero(vmps, pml1_page,
+				    nzeroed);
+		}
 	}
+	vmp_md_tlb_invalidate(vmps, vstart, vend, kVMTLBInvalUnmap);
 	vmp_release_pfn_lock(ipl);
 }
 
+size_t
+vmp_md_ps_walk(vmp_procstate_t *vmps,
+    void (*callback)(void *context, vaddr_t vaddr, pte_t *pte), void *context)
+{
+	pte_t *pml3 = (pte_t *)vm_page_direct_map_addr(vmps->md.top);
+	size_t ntables = 1;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	for (size_t top = 0; top < SOFT_PTES_PER_TABLE; top++) {
+		pte_t *pml2;
+
+		if (vmp_md_pte_is_empty(&pml3[top]))
+			continue;
+
+		pml2 = (pte_t *)P2V(PFN_TO_PADDR(pml3[top].hw.pfn));
+		ntables++;
+
+		for (size_t mid = 0; mid < SOFT_PTES_PER_TABLE; mid++) {
+			pte_t *pml1;
+
+			if (vmp_md_pte_is_empty(&pml2[mid]))
+				continue;
+
+			if (pml2[mid].hw.large) {
+				/* visit the PTEs it stands in for */
+				for (size_t bot = 0; bot < SOFT_PTES_PER_TABLE;
+				     bot++) {
+					union soft_addr addr = { .addr = 0 };
+					pte_t		pte;
+
+					pte = large_pte(&pml2[mid], bot);
+
+					addr.top = top;
+					addr.mid = mid;
+					addr.bot = bot;
+					callback(context, addr.addr, &pte);
+				}
+				continue;
+			}
+
+			pml1 = (pte_t *)P2V(PFN_TO_PADDR(pml2[mid].hw.pfn));
+			ntables++;
+
+			for (size_t bot = 0; bot < SOFT_PTES_PER_TABLE; bot++) {
+				union soft_addr addr = { .addr = 0 };
+
+				if (vmp_md_pte_is_empty(&pml1[bot]))
+					continue;
+
+				addr.top = top;
+				addr.mid = mid;
+				addr.bot = bot;
+				callback(context, addr.addr, &pml1[bot]);
+			}
+		}
+	}
+
+	return ntables;
+}
+
+/*
+ * Free a pagetable page regardless of its used PTE count and references,
+ * which are meaningless once the whole tree is being discarded.
+ */
+static void
+destroy_pagetable(vm_page_t *page)
+{
+	page->used_ptes = 0;
+	page->refcnt = 1;
+	page->referent_pte = 0;
+	vmp_page_delete_locked(page, NULL, true);
+}
+
+size_t
+vmp_md_ps_destroy(vmp_procstate_t *vmps,
+    void (*callback)(void *context, pte_t *saved_pte), void *context)
+{
+	pte_t *pml3 = (pte_t *)vm_page_direct_map_addr(vmps->md.top);
+	size_t ntables = 1;
+	ipl_t  ipl;
+
+	ipl = vmp_acquire_pfn_lock();
+	for (size_t top = 0; top < SOFT_PTES_PER_TABLE; top++) {
+		vm_page_t *pml2_page;
+		pte_t	  *pml2;
+
+		if (vmp_md_pte_is_empty(&pml3[top]))
+			continue;
+
+		pml2_page = vm_paddr_to_page(PFN_TO_PADDR(pml3[top].hw.pfn));
+		pml2 = (pte_t *)vm_page_direct_map_addr(pml2_page);
+
+		for (size_t mid = 0; mid < SOFT_PTES_PER_TABLE; mid++) {
+			vm_page_t *pml1_page;
+			pte_t	  *pml1;
+
+			if (vmp_md_pte_is_empty(&pml2[mid]))
+				continue;
+
+			if (pml2[mid].hw.large) {
+				for (size_t bot = 0; bot < SOFT_PTES_PER_TABLE;
+				     bot++) {
+					pte_t pte = large_pte(&pml2[mid], bot);
+					callback(context, &pte);
+				}
+				continue;
+			}
+
+			pml1_page = vm_paddr_to_page(
+			    PFN_TO_PADDR(pml2[mid].hw.pfn));
+			pml1 = (pte_t *)vm_page_direct_map_addr(pml1_page);
+
+			for (size_t bot = 0; bot < SOFT_PTES_PER_TABLE; bot++)
+				if (!vmp_md_pte_is_empty(&pml1[bot]))
+					callback(context, &pml1[bot]);
+
+			destroy_pagetable(pml1_page);
+			ntables++;
+		}
+
+		destroy_pagetable(pml2_page);
+		ntables++;
+	}
+
+	/* the root's address may be reused as another process' ASID */
+	vmp_md_tlb_invalidate(vmps, 0,
+	    1UL << (PGSHIFT + 3 * SOFT_LEVEL_BITS), kVMTLBInvalDestroy);
+	destroy_pagetable(vmps->md.top);
+	vmps->md.top = NULL;
+	memset(vmps->md.pwc, 0x0, sizeof(vmps->md.pwc));
+	vmp_release_pfn_lock(ipl);
+
+	return ntables;
+}
+
 void
 vmp_md_fault_state_release(vmp_procstate_t *vmps,
     struct vmp_md_fault_state		   *state)
 {
+	/* (emptied if the leaf table was promoted away) */
+	if (state->bot_page == NULL)
+		return;
 	vmp_page_release_locked(state->mid_page, &vmps->account);
 	vmp_pagetable_page_pte_became_zero(vmps, state->bot_page);
 }
@@ -3,12 +3,18 @@
 
 #include "kdk/vm.h"
 
-#define PADDR_TO_PFN(PADDR) ((uintptr_t)PADDR >> 7)
-#define PFN_TO_PADDR(PFN) ((uintptr_t)PFN << 7)
+/*! Bits of virtual address indexing each pagetable level. */
+#define SOFT_LEVEL_BITS (PGSHIFT - 3)
+/*! Entries in each pagetable. */
+#define SOFT_PTES_PER_TABLE (1UL << SOFT_LEVEL_BITS)
+/*! Size of the region mapped by a large PML2 entry, or by one leaf table. */
+#define SOFT_LARGE_SIZE (PGSIZE * SOFT_PTES_PER_TABLE)
 
 union __attribute__((packed)) soft_addr {
 	struct __attribute__((packed)) {
-		uint64_t pgi : 7, bot : 4, mid : 4, top : 4, unused : 45;
+		uint64_t pgi : PGSHIFT, bot : SOFT_LEVEL_BITS,
+		    mid : SOFT_LEVEL_BITS, top : SOFT_LEVEL_BITS,
+		    unused : 64 - PGSHIFT - 3 * SOFT_LEVEL_BITS;
 	};
 	uint64_t addr;
 };
@@ -18,17 +24,27 @@ enum pte_sw_type {
 	kPTETransition,
 	kPTETransitionFork,
 	kPTEOutpaged,
+	/*! pfn holds a compressed cache handle */
+	kPTECompressed,
 };
 
+/*!
+ * A valid PML2 entry with large set maps SOFT_PTES_PER_TABLE physically
+ * contiguous pages, beginning at pfn (which is aligned to their number),
+ * rather than pointing to a leaf table. The MMU sets accessed whenever it
+ * loads an entry into the TLB.
+ */
 typedef struct pte_hw {
-	uint64_t pfn : 62;
-	bool writeable : 1, valid : 1;
+	uint64_t pfn : 60;
+	bool large : 1, accessed : 1, writeable : 1, valid : 1;
 } pte_hw_t;
 
 typedef struct pte_sw {
-	enum pte_sw_type type : 2;
-	/*! or drumslot */
-	uint64_t pfn : 60;
+	enum pte_sw_type type : 3;
+	/*! or drumslot, or compressed cache handle */
+	uint64_t pfn : 59;
+	/*! keeps valid in the same bit as pte_hw::valid */
+	uint64_t reserved : 1;
 	bool valid : 1;
 } pte_sw_t;
 
@@ -37,10 +53,34 @@ typedef union pte {
 	pte_hw_t hw;
 } pte_t;
 
+/*! Entries in each process' paging-structure cache. */
+#define SOFT_PWC_ENTRIES 8
+
+/*!
+ * Paging-structure cache entry, mapping the region of address space covered
+ * by one leaf table to that table and its parent. Lets repeated walks within
+ * a region skip the upper levels.
+ */
+struct soft_pwc_entry {
+	/*! address >> (PGSHIFT + SOFT_LEVEL_BITS) */
+	vaddr_t region;
+	/*! the leaf table, or NULL if the entry is unused; and its parent */
+	vm_page_t *pml1, *pml2;
+};
+
 struct vmp_md_procstate {
 	vm_page_t *top;
+	/*! Paging-structure cache; PFN lock protects. Direct-mapped by region. */
+	struct soft_pwc_entry pwc[SOFT_PWC_ENTRIES];
+	/*! Paging-structure cache statistics. */
+	uint64_t pwc_hits, pwc_misses;
 };
 
+/*! Whether walks consult the paging-structure cache. For benchmarking. */
+extern bool soft_pwc_enabled;
+/*! Whether full leaf tables of private memory are promoted to large pages. */
+extern bool soft_large_pages_enabled;
+
 struct vmp_md_fault_state {
 	/*! pinned pages of the page table. */
 	vm_page_t *mid_page, *bot_page;
@@ -59,6 +99,25 @@ vmp_md_pte_is_writeable(void *pte)
 	return ((pte_hw_t *)pte)->writeable == 1;
 }
 
+static inline bool
+vmp_md_pte_is_accessed(void *pte)
+{
+	return ((pte_hw_t *)pte)->accessed == 1;
+}
+
+static inline void
+vmp_md_pte_clear_accessed(pte_t *pte)
+{
+	pte->hw.accessed = 0;
+}
+
+/*! Whether a valid PML2 entry maps a large page. */
+static inline bool
+vmp_md_pte_is_large(void *pte)
+{
+	return ((pte_hw_t *)pte)->large == 1;
+}
+
 static inline bool
 vmp_md_pte_is_trans(void *pte)
 {
@@ -73,12 +132,31 @@ vmp_md_pte_is_outpaged(void *pte)
 	return sw->valid == 0 && sw->type == kPTEOutpaged;
 }
 
+static inline bool
+vmp_md_pte_is_compressed(void *pte)
+{
+	pte_sw_t *sw = pte;
+	return sw->valid == 0 && sw->type == kPTECompressed;
+}
+
 static inline bool
 vmp_md_pte_is_empty(void *pte)
 {
 	return *(uint64_t *)pte == 0;
 }
 
+static inline uintptr_t
+vmp_md_pte_drumslot(pte_t *pte)
+{
+	return pte->sw.pfn;
+}
+
+static inline uintptr_t
+vmp_md_pte_zcache_handle(pte_t *pte)
+{
+	return pte->sw.pfn;
+}
+
 static inline vm_page_t *
 vmp_md_pte_page(pte_t *pte)
 {
@@ -93,22 +171,41 @@ vmp_md_pte_page(pte_t *pte)
 static inline void
 vmp_md_pte_make_empty(pte_t *pte)
 {
-	pte->hw.pfn = 0;
-	pte->hw.valid = 0;
-	pte->hw.writeable = 0;
+	*(uint64_t *)pte = 0;
 }
 
 static inline void
 vmp_md_pte_make_trans(pte_t *pte, pfn_t pfn)
 {
+	*(uint64_t *)pte = 0;
 	pte->sw.type = kPTETransition;
 	pte->sw.pfn = pfn;
 	pte->sw.valid = 0;
 }
 
+static inline void
+vmp_md_pte_make_outpaged(pte_t *pte, uintptr_t drumslot)
+{
+	*(uint64_t *)pte = 0;
+	pte->sw.type = kPTEOutpaged;
+	pte->sw.pfn = drumslot;
+	pte->sw.valid = 0;
+}
+
+static inline void
+vmp_md_pte_make_compressed(pte_t *pte, uintptr_t handle)
+{
+	*(uint64_t *)pte = 0;
+	pte->sw.type = kPTECompressed;
+	pte->sw.pfn = handle;
+	pte->sw.valid = 0;
+}
+
 static inline void
 vmp_md_pte_make_hw(pte_t *pte, pfn_t pfn, bool writeable)
 {
+	pte->hw.large = 0;
+	pte->hw.accessed = 0;
 	pte->hw.writeable = writeable;
 	pte->hw.pfn = pfn;
 	pte->hw.valid = 1;
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file tier.c
+ * @brief Migration of pages between memory tiers.
+ *
+ * Allocation fills the fast tier first, so what lands in the slow tier is
+ * just whatever was allocated once the fast tier was full. A migration pass
+ * over a process corrects this by use. It ages the working set by the
+ * accessed bits of its PTEs, then promotes slow pages found accessed on two
+ * passes running into fast memory. Only if too little fast memory is free for
+ * them are fast pages left unaccessed for several passes demoted, coldest
+ * first, and only as many as make up the difference.
+ *
+ * A page is migrated by pointing its PTE at a copy in the other tier. The PTE
+ * is rewritten first, and the TLB invalidated, so that the copy taken after
+ * catches every store; the PFN lock, held throughout, keeps anything from
+ * walking to the new page before it is filled in. Demotions are done first,
+ * so that the fast memory they free goes to the promotions of the same pass
+ * rather than to whatever is allocated next. Each invalidation covers only the
+ * pages moved, and with the first, those whose accessed bits were cleared.
+ */
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+/*! Most pages migrated in each direction by one pass. */
+#define TIER_BATCH_MAX 64
+
+struct tier_move {
+	vaddr_t	   vaddr;
+	pte_t	  *pte;
+	/*! the page, and the page of the other tier it is moving to */
+	vm_page_t *page, *new_page;
+	/*! aging passes the page has gone unaccessed */
+	unsigned age;
+};
+
+/*! State of a migration pass; PFN lock protects. */
+struct tier_pass {
+	/*! slow pages accessed since the last pass, and coldest fast pages */
+	struct tier_move hot[TIER_BATCH_MAX], cold[TIER_BATCH_MAX];
+	size_t		 nhot, ncold, max;
+	/*! pages to invalidate, [span[0], span[1]); empty if span[1] is 0 */
+	vaddr_t span[2];
+};
+
+unsigned		    vm_tier_cold_age = 4;
+static struct tier_pass	    tier_pass;
+static struct vm_tier_stats tier_stats;
+
+static void
+span_add(vaddr_t *span, vaddr_t vaddr)
+{
+	if (vaddr < span[0])
+		span[0] = vaddr;
+	if (vaddr + PGSIZE > span[1])
+		span[1] = vaddr + PGSIZE;
+}
+
+static void
+tier_consider(void *context, vaddr_t vaddr, pte_t *pte, unsigned age,
+    unsigned last_age)
+{
+	struct tier_pass *pass = context;
+	vm_page_t	 *page = vmp_md_pte_page(pte);
+	struct tier_move *move;
+
+	/* its accessed bit was just cleared; it mustn't stay cached */
+	if (age == 0)
+		span_add(pass->span, vaddr);
+
+	/* a page someone else has retained can't be moved */
+	if (page->use != kPageUseAnonPrivate || page->refcnt != 1)
+		return;
+
+	/* one access might be a fluke; two passes running are not */
+	if (page->tier == kVMTierSlow && age == 0 && last_age == 0 &&
+	    pass->nhot < pass->max) {
+		move = &pass->hot[pass->nhot++];
+	} else if (page->tier == kVMTierFast && age >= vm_tier_cold_age) {
+		if (pass->ncold < pass->max) {
+			move = &pass->cold[pass->ncold++];
+		} else {
+			/* keep the coldest; replace the warmest kept */
+			move = &pass->cold[0];
+			for (size_t i = 1; i < pass->ncold; i++)
+				if (pass->cold[i].age < move->age)
+					move = &pass->cold[i];
+			if (move->age >= age)
+				return;
+		}
+	} else {
+		return;
+	}
+
+	move->vaddr = vaddr;
+	move->pte = pte;
+	move->page = page;
+	move->new_page = NULL;
+	move->age = age;
+}
+
+/* sort cold pages coldest first */
+static void
+tier_sort_cold(struct tier_move *moves, size_t nmoves)
+{
+	for (size_t i = 1; i < nmoves; i++) {
+		struct tier_move move = moves[i];
+		size_t		 j;
+
+		for (j = i; j > 0 && moves[j - 1].age < move.age; j--)
+			moves[j] = moves[j - 1];
+		moves[j] = move;
+	}
+}
+
+/*
+ * Point a page's PTE at a fresh page of \p tier, which takes over its state.
+ * Returns false if the tier has no free page. The contents are copied later,
+ * once the TLB has been invalidated.
+ */
+static bool
+tier_remap(vmp_procstate_t *vmps, struct tier_move *move,
+    enum vm_mem_tier tier)
+{
+	vm_page_t *page = move->page, *new_page;
+
+	if (vmp_page_alloc_tier_locked(&new_page, &vmps->account,
+		kPageUseAnonPrivate, tier) != 0)
+		return false;
+
+	new_page->dirty = page->dirty;
+	new_page->offset = page->offset;
+	new_page->owner = page->owner;
+	new_page->referent_pte = page->referent_pte;
+	/* the pagefile copy, if any, is as good for the new page */
+	new_page->swap_descriptor = page->swap_descriptor;
+	page->swap_descriptor = 0;
+
+	vmp_md_pte_make_hw(move->pte, new_page->pfn,
+	    vmp_md_pte_is_writeable(move->pte));
+	move->new_page = new_page;
+
+	return true;
+}
+
+/*
+ * Remap up to \p nmoves pages to \p tier, invalidate them along with anything
+ * else the pass has to, and finish the moves by copying; returns how many were
+ * moved, fewer than asked only if the tier ran out of free pages.
+ */
+static size_t
+tier_migrate_batch(vmp_procstate_t *vmps, struct tier_pass *pass,
+    struct tier_move *moves, size_t nmoves, enum vm_mem_tier tier)
+{
+	size_t n;
+
+	for (n = 0; n < nmoves; n++) {
+		if (!tier_remap(vmps, &moves[n], tier))
+			break;
+		span_add(pass->span, moves[n].vaddr);
+	}
+
+	if (pass->span[1] != 0) {
+		vmp_md_tlb_invalidate(vmps, pass->span[0], pass->span[1],
+		    kVMTLBInvalTier);
+		pass->span[0] = UINTPTR_MAX;
+		pass->span[1] = 0;
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		memcpy((void *)vm_page_direct_map_addr(moves[i].new_page),
+		    (void *)vm_page_direct_map_addr(moves[i].page), PGSIZE);
+		vmp_page_delete_locked(moves[i].page, &vmps->account, true);
+	}
+
+	return n;
+}
+
+size_t
+vm_ps_tier_migrate(vmp_procstate_t *vmps, size_t npages)
+{
+	struct tier_pass *pass = &tier_pass;
+	size_t		  ndemote = 0, ndemoted, npromoted;
+	uint64_t	  begin;
+	ipl_t		  ipl;
+
+	ke_wait(&vmps->mutex, "vm_ps_tier_migrate:vmps->mutex", false, false,
+	    -1);
+	ipl = vmp_acquire_pfn_lock();
+	begin = ke_nanotime();
+
+	pass->nhot = pass->ncold = 0;
+	pass->max = npages < TIER_BATCH_MAX ? npages : TIER_BATCH_MAX;
+	pass->span[0] = UINTPTR_MAX;
+	pass->span[1] = 0;
+	vmp_wsl_age(vmps, tier_consider, pass);
+	tier_stats.npasses++;
+
+	/* demote only to make room for this pass' promotions */
+	if (vmp_tier_nfree[kVMTierFast] < pass->nhot)
+		ndemote = pass->nhot - vmp_tier_nfree[kVMTierFast];
+	if (ndemote > pass->ncold)
+		ndemote = pass->ncold;
+	tier_sort_cold(pass->cold, pass->ncold);
+
+	ndemoted = tier_migrate_batch(vmps, pass, pass->cold, ndemote,
+	    kVMTierSlow);
+	npromoted = tier_migrate_batch(vmps, pass, pass->hot, pass->nhot,
+	    kVMTierFast);
+	tier_stats.nnoroom += pass->nhot - npromoted;
+	tier_stats.ndemoted += ndemoted;
+	tier_stats.npromoted += npromoted;
+	tier_stats.migrate_ns += ke_nanotime() - begin;
+
+	vmp_release_pfn_lock(ipl);
+	ke_mutex_release(&vmps->mutex);
+
+	return ndemoted + npromoted;
+}
+
+void
+vm_tier_get_stats(struct vm_tier_stats *stats)
+{
+	ipl_t ipl = vmp_acquire_pfn_lock();
+
+	*stats = tier_stats;
+	for (int tier = 0; tier < kVMTierMax; tier++) {
+		stats->npages[tier] = vmp_tier_npages[tier];
+		stats->nfree[tier] = vmp_tier_nfree[tier];
+	}
+
+	vmp_release_pfn_lock(ipl);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file trace.c
+ * @brief VM event tracing.
+ *
+ * Events are recorded into a ring per CPU. Recording takes no lock: a slot is
+ * claimed with a relaxed increment of the ring's head (CPUs may share a ring,
+ * as ke_cpu_num() wraps) and then filled in. Old events are overwritten once
+ * a ring is full; vm_trace_read_ring() reports how many were lost.
+ *
+ * Call sites use VMP_TRACE(), which compiles to nothing without KRX_VM_TRACE
+ * and otherwise tests vm_trace_enabled before calling in here.
+ */
+
+#include <string.h>
+
+#include "kdk/vm.h"
+#include "kdk/vm_trace.h"
+#include "vmp.h"
+
+struct vmp_trace_ring {
+	/*! events ever recorded; the newest VM_TRACE_RING_SIZE are kept */
+	uint64_t head;
+	struct vm_trace_event events[VM_TRACE_RING_SIZE];
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct vmp_trace_ring vmp_trace_rings[KRX_MAX_CPUS];
+bool			     vm_trace_enabled = false;
+
+void
+vmp_trace_record(enum vm_trace_type type, vmp_procstate_t *ps, uint64_t addr,
+    uint64_t arg, uint32_t detail)
+{
+	unsigned	       cpu = ke_cpu_num();
+	struct vmp_trace_ring *ring = &vmp_trace_rings[cpu];
+	uint64_t	       slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+	struct vm_trace_event *event =
+	    &ring->events[slot & (VM_TRACE_RING_SIZE - 1)];
+
+	event->timestamp = ke_nanotime();
+	event->proc = (uintptr_t)ps;
+	event->addr = addr;
+	event->arg = arg;
+	event->type = type;
+	event->cpu = cpu;
+	event->detail = detail;
+}
+
+size_t
+vm_trace_read_ring(unsigned cpu, struct vm_trace_event *events,
+    uint64_t *nlost)
+{
+	struct vmp_trace_ring *ring = &vmp_trace_rings[cpu];
+	uint64_t	       head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	size_t		       n = head < VM_TRACE_RING_SIZE ? head : VM_TRACE_RING_SIZE;
+
+	kassert(cpu < KRX_MAX_CPUS);
+
+	for (size_t i = 0; i < n; i++)
+		events[i] = ring->events[(head - n + i) &
+		    (VM_TRACE_RING_SIZE - 1)];
+	*nlost = head - n;
+
+	return n;
+}
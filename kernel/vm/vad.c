@@ -1,10 +1,12 @@
+#include "kdk/libkern.h"
 #include "kdk/vm.h"
 #include "vmp.h"
 
-int vmp_vad_cmp(vm_vad_t *x, vm_vad_t *y);
-
 RB_GENERATE(vm_vad_rbtree, vm_vad, rbtree_entry, vmp_vad_cmp);
 
+static kmem_zone_t vad_zone = KMEM_ZONE_INITIALISER(vad_zone, "vm_vad",
+    sizeof(vm_vad_t));
+
 int
 vmp_vad_cmp(vm_vad_t *x, vm_vad_t *y)
 {
@@ -33,16 +35,18 @@ vmp_ps_vad_find(vmp_procstate_t *ps, vaddr_t vaddr)
 }
 
 int
-vm_ps_allocate(vmp_procstate_t *vmps, vaddr_t *vaddrp, size_t size, bool exact)
+vm_ps_allocate(vmp_procstate_t *vmps, vaddr_t *vaddrp, size_t size, bool exact,
+    bool populate)
 {
 	return vm_ps_map_section_view(vmps, NULL, vaddrp, size, 0, kVMAll,
-	    kVMAll, false, false, exact);
+	    kVMAll, false, false, exact, populate);
 }
 
 int
 vm_ps_map_section_view(vmp_procstate_t *vmps, void *section, vaddr_t *vaddrp,
     size_t size, off_t offset, vm_protection_t initial_protection,
-    vm_protection_t max_protection, bool inherit_shared, bool cow, bool exact)
+    vm_protection_t max_protection, bool inherit_shared, bool cow, bool exact,
+    bool populate)
 {
 	int	      r;
 	kwaitstatus_t w;
@@ -54,10 +58,12 @@ vm_ps_map_section_view(vmp_procstate_t *vmps, void *section, vaddr_t *vaddrp,
 
 	ke_wait(&vmps->mutex, "map_section_view:vmps->mutex", false, false, -1);
 
-	vad = kmem_alloc(sizeof(vm_vad_t));
+	vad = kmem_zonealloc(&vad_zone);
+	kassert(vad != NULL);
 	vad->start = (vaddr_t)addr;
 	vad->end = addr + size;
 	vad->flags.cow = cow;
+	vad->flags.advice = kVMAdviceNormal;
 	vad->flags.offset = offset;
 	vad->flags.inherit_shared = inherit_shared;
 	vad->flags.protection = initial_protection;
@@ -66,6 +72,9 @@ vm_ps_map_section_view(vmp_procstate_t *vmps, void *section, vaddr_t *vaddrp,
 
 	RB_INSERT(vm_vad_rbtree, &vmps->vad_queue, vad);
 
+	if (populate)
+		vmp_md_populate(vmps, vad, vad->start, vad->end);
+
 	ke_mutex_release(&vmps->mutex);
 
 	*vaddrp = addr;
@@ -76,8 +85,18 @@ vm_ps_map_section_view(vmp_procstate_t *vmps, void *section, vaddr_t *vaddrp,
 void
 deallocate_page_callback(void *context, pte_t *saved_pte)
 {
-	vm_vad_t  *vad = context;
-	vm_page_t *page = vmp_md_pte_page(saved_pte);
+	vmp_procstate_t *vmps = context;
+	vm_page_t	*page;
+
+	if (vmp_md_pte_is_outpaged(saved_pte)) {
+		vmp_pagefile_slot_free(vmp_md_pte_drumslot(saved_pte));
+		return;
+	} else if (vmp_md_pte_is_compressed(saved_pte)) {
+		vmp_zcache_free(vmp_md_pte_zcache_handle(saved_pte));
+		return;
+	}
+
+	page = vmp_md_pte_page(saved_pte);
 
 	/*
 	 * note: we don't need to do a TLB shootdown here on a one-by-one
@@ -90,7 +109,13 @@ deallocate_page_callback(void *context, pte_t *saved_pte)
 	if (vmp_md_pte_is_valid(saved_pte)) {
 		switch (page->use) {
 		case kPageUseAnonPrivate:
-			vmp_page_delete_locked(page, NULL, true);
+			vmp_page_delete_locked(page, &vmps->account, true);
+			break;
+		case kPageUseZero:
+			/* the mapping held no reference */
+			break;
+		case kPageUseMerged:
+			vmp_merge_page_release(page);
 			break;
 		default:
 			kfatal("Can't handle this\n");
@@ -98,7 +123,7 @@ deallocate_page_callback(void *context, pte_t *saved_pte)
 	} else {
 		switch (page->use) {
 		case kPageUseAnonPrivate:
-			vmp_page_delete_locked(page, NULL, false);
+			vmp_page_delete_locked(page, &vmps->account, false);
 			break;
 		default:
 			kfatal("Can't handle this\n");
@@ -128,10 +153,13 @@ vm_ps_deallocate(vmp_procstate_t *vmps, vaddr_t start, size_t size)
 			// ipl_t ipl;
 
 			RB_REMOVE(vm_vad_rbtree, &vmps->vad_queue, entry);
+			VMP_TRACE(kVMTraceUnmap, vmps, entry->start,
+			    entry->end, 0);
+			vmp_wsl_remove_range(vmps, entry->start, entry->end);
 			vmp_md_unmap_range_and_do(vmps, entry->start,
-			    entry->end, deallocate_page_callback, NULL);
+			    entry->end, deallocate_page_callback, vmps);
 
-			kmem_free(entry, sizeof(vm_vad_t));
+			kmem_zonefree(&vad_zone, entry);
 		} else if (entry->start >= start && entry->end <= end) {
 			kfatal("unimplemented deallocate right of vadt\n");
 		} else if (entry->start < start && entry->end < end) {
@@ -144,6 +172,193 @@ vm_ps_deallocate(vmp_procstate_t *vmps, vaddr_t start, size_t size)
 	return 0;
 }
 
+/*
+ * Bring in what of [start, end) of \p vad memory allows: untouched pages are
+ * populated, and paged out ones read onto the standby queue in clusters.
+ */
+static void
+advise_willneed(vmp_procstate_t *vmps, vm_vad_t *vad, vaddr_t start,
+    vaddr_t end)
+{
+	ipl_t  ipl;
+	size_t nread = 0;
+
+	vmp_md_populate(vmps, vad, start, end);
+
+	ipl = vmp_acquire_pfn_lock();
+	for (vaddr_t vaddr = start; vaddr < end;) {
+		size_t n = vmp_pagein_cluster_locked(vmps, vaddr, end,
+		    VMP_PAGEIN_CLUSTER_MAX, false, NULL);
+
+		nread += n;
+		vaddr += (n == 0 ? 1 : n) * PGSIZE;
+	}
+	vmp_release_pfn_lock(ipl);
+
+	VMP_STAT_ADD(nreadahead, nread);
+}
+
+/*
+ * Put [start, end) first in line for eviction from the working set, and its
+ * pages in transition first in line for reclaim.
+ */
+static void
+advise_cold(vmp_procstate_t *vmps, vaddr_t start, vaddr_t end)
+{
+	ipl_t ipl;
+
+	ipl = vmp_acquire_pfn_lock();
+	vmp_wsl_make_cold(vmps, start, end);
+	/*
+	 * backwards, so they're in address order at the queues' heads, and
+	 * those written out get consecutive slots to be read back in clusters
+	 */
+	for (vaddr_t vaddr = end; vaddr > start;) {
+		pte_t *pte;
+
+		vaddr -= PGSIZE;
+		if (vmp_mp_fetch_pte(vmps, vaddr, &pte, NULL) == 0 &&
+		    vmp_md_pte_is_trans(pte))
+			vmp_page_make_cold_locked(vmp_md_pte_page(pte));
+	}
+	vmp_release_pfn_lock(ipl);
+}
+
+int
+vm_ps_advise(vmp_procstate_t *vmps, vaddr_t vaddr, size_t length,
+    enum vm_advice advice)
+{
+	vm_vad_t     *vad;
+	vaddr_t	      start = PGROUNDDOWN(vaddr);
+	vaddr_t	      end = PGROUNDUP(vaddr + length), covered = start;
+	kwaitstatus_t w;
+	int	      r = 0;
+
+	w = ke_wait(&vmps->mutex, "vm_ps_advise:vmps->mutex", false, false,
+	    -1);
+	kassert(w == kKernWaitStatusOK);
+
+	RB_FOREACH (vad, vm_vad_rbtree, &vmps->vad_queue) {
+		vaddr_t vad_start, vad_end;
+
+		if (vad->end <= start || vad->start >= end)
+			continue;
+		vad_start = vad->start > start ? vad->start : start;
+		vad_end = vad->end < end ? vad->end : end;
+		/* VADs come in address order, so a gap before this is a hole */
+		if (vad_start != covered)
+			r = -1;
+		covered = vad_end;
+
+		switch (advice) {
+		case kVMAdviceNormal:
+		case kVMAdviceSequential:
+		case kVMAdviceRandom:
+			/* VADs aren't split, so this is for all of it */
+			vad->flags.advice = advice;
+			break;
+
+		case kVMAdviceWillNeed:
+			advise_willneed(vmps, vad, vad_start, vad_end);
+			break;
+
+		case kVMAdviceDontNeed:
+			vmp_wsl_remove_range(vmps, vad_start, vad_end);
+			vmp_md_unmap_range_and_do(vmps, vad_start, vad_end,
+			    deallocate_page_callback, vmps);
+			break;
+
+		case kVMAdviceCold:
+			advise_cold(vmps, vad_start, vad_end);
+			break;
+
+		default:
+			kfatal("Unknown advice %d\n", advice);
+		}
+	}
+	if (covered != end)
+		r = -1;
+
+	ke_mutex_release(&vmps->mutex);
+
+	return r;
+}
+
+struct destroy_context {
+	/*! pages and wires to credit to the process' account at the end */
+	size_t nalloced, nwires;
+};
+
+static void
+destroy_page_callback(void *context, pte_t *pte)
+{
+	struct destroy_context *ctx = context;
+	vm_page_t	       *page;
+
+	if (vmp_md_pte_is_outpaged(pte)) {
+		vmp_pagefile_slot_free(vmp_md_pte_drumslot(pte));
+		return;
+	} else if (vmp_md_pte_is_compressed(pte)) {
+		vmp_zcache_free(vmp_md_pte_zcache_handle(pte));
+		return;
+	}
+
+	page = vmp_md_pte_page(pte);
+	if (page == vmp_zero_page)
+		return;
+	if (page->use == kPageUseMerged) {
+		vmp_merge_page_release(page);
+		return;
+	}
+	kassert(page->use == kPageUseAnonPrivate);
+
+	ctx->nalloced++;
+	if (vmp_md_pte_is_valid(pte)) {
+		/* drop the working set's reference too */
+		ctx->nwires++;
+		vmp_page_delete_locked(page, NULL, true);
+	} else {
+		vmp_page_delete_locked(page, NULL, false);
+	}
+}
+
+static void
+vad_tree_free(vm_vad_t *vad)
+{
+	if (vad == NULL)
+		return;
+
+	vad_tree_free(RB_LEFT(vad, rbtree_entry));
+	vad_tree_free(RB_RIGHT(vad, rbtree_entry));
+	kmem_zonefree(&vad_zone, vad);
+}
+
+int
+vm_ps_destroy(vmp_procstate_t *vmps)
+{
+	struct destroy_context ctx = { 0 };
+	size_t		       ntables, nalloced;
+	ipl_t		       ipl;
+
+	vmp_prefetch_log_free(vmps);
+
+	/* nothing is rebalanced; the tree is simply forgotten */
+	vad_tree_free(RB_ROOT(&vmps->vad_queue));
+	RB_INIT(&vmps->vad_queue);
+	vmp_wsl_destroy(vmps);
+
+	ntables = vmp_md_ps_destroy(vmps, destroy_page_callback, &ctx);
+
+	ipl = vmp_acquire_pfn_lock();
+	vmp_account_add(&vmps->account, -(ctx.nalloced + ntables),
+	    -(ctx.nwires + ntables));
+	vm_account_get(&vmps->account, &nalloced, NULL);
+	kassert(nalloced == 0);
+	vmp_release_pfn_lock(ipl);
+
+	return 0;
+}
+
 int
 vm_ps_dump_vadtree(vmp_procstate_t *vmps)
 {
@@ -157,12 +372,15 @@ vm_ps_dump_vadtree(vmp_procstate_t *vmps)
 int
 vm_ps_init(vmp_procstate_t *vmps)
 {
-	vmps->mutex = (kmutex_t)KMUTEX_INITIALISER;
+	vmps->mutex = (kmutex_t)KMUTEX_NAMED_INITIALISER("vmps->mutex");
 	RB_INIT(&vmps->vad_queue);
 	TAILQ_INIT(&vmps->ws_queue);
 	RB_INIT(&vmps->ws_tree);
-	vmps->account.nalloced = 0;
-	vmps->account.nwires = 0;
+	vm_account_init(&vmps->account);
+	memset(&vmps->fault_stats, 0x0, sizeof(vmps->fault_stats));
+	vmps->prefetch_log = NULL;
+	vmps->merge_cursor = 0;
 	vmps->ws_current_count = 0;
-	vmp_md_ps_init(vmps);
+	vmps->ws_max_count = VMP_WS_DEFAULT_MAX;
+	return vmp_md_ps_init(vmps);
 }
@@ -1,8 +1,10 @@
 #ifndef KRX_VM_VMP_H
 #define KRX_VM_VMP_H
 
+#include "kdk/kmem.h"
 #include "kdk/tree.h"
 #include "kdk/vm.h"
+#include "kdk/vm_trace.h"
 
 #ifdef KRX_SOFT
 #include "soft/vmp_soft.h"
@@ -20,6 +22,30 @@ typedef enum vm_fault_return {
 	kVMFaultRetRetry = -3,
 } vm_fault_return_t;
 
+/*!
+ * Why a TLB shootdown was requested. Kept so that the port can attribute
+ * shootdown costs (and wasted shootdowns) to the VM path responsible.
+ */
+enum vmp_tlb_inval_reason {
+	/*! a page was evicted from a working set */
+	kVMTLBInvalEviction,
+	/*! a range was unmapped */
+	kVMTLBInvalUnmap,
+	/*! a whole address space was destroyed */
+	kVMTLBInvalDestroy,
+	/*! a zero page mapping was replaced by a private page */
+	kVMTLBInvalZeroPage,
+	/*! a page was write-protected or remapped by same-page merging */
+	kVMTLBInvalMerge,
+	/*! a leaf table was promoted to a large page, or a large page demoted */
+	kVMTLBInvalLarge,
+	/*! accessed bits were cleared by aging, or pages moved between tiers */
+	kVMTLBInvalTier,
+	/*! a page was moved to another frame by compaction */
+	kVMTLBInvalMigrate,
+	kVMTLBInvalMax,
+};
+
 /*!
  * Virtual Address Descriptor - a mapping of a section object. Note that
  * copy-on-write is done at the section object level, not here.
@@ -34,6 +60,8 @@ typedef struct vm_vad {
 		bool private : 1;
 		/*! (!private only) whether the mapping is copy-on-write */
 		bool cow : 1;
+		/*! advised access pattern: normal, sequential or random */
+		enum vm_advice advice : 3;
 		/*! if !private, page offset into section object (max 256tib) */
 		off_t offset : 36;
 	} flags;
@@ -45,6 +73,19 @@ typedef struct vm_vad {
 	void *section;
 } vm_vad_t;
 
+/*!
+ * Working set list entry; allocated from a slab zone.
+ */
+struct vmp_wsle {
+	TAILQ_ENTRY(vmp_wsle) queue_entry;
+	RB_ENTRY(vmp_wsle) rb_entry;
+	vaddr_t vaddr;
+	/* pages the entry stands for; more than one for a large page */
+	size_t npages;
+	/* aging passes since the page was last found accessed */
+	uint8_t age;
+};
+
 /*!
  * Per-process state.
  */
@@ -59,12 +100,23 @@ typedef struct vmp_procstate {
 	RB_HEAD(vm_vad_rbtree, vm_vad) vad_queue;
 	/*! Count of pages in working set list. */
 	size_t ws_current_count;
+	/*! Maximum size of the working set list. */
+	size_t ws_max_count;
 	/*! Account. */
 	vm_account_t account;
+	/*! Faults taken; mutex protects. */
+	struct vm_fault_stats fault_stats;
+	/*! Faults being recorded for prefetching, if any; mutex protects. */
+	struct vmp_prefetch_record *prefetch_log;
+	/*! Where same-page merging next scans; mutex protects. */
+	vaddr_t merge_cursor;
 	/*! Per-arch stuff. */
 	struct vmp_md_procstate md;
 } vmp_procstate_t;
 
+int vmp_vad_cmp(vm_vad_t *x, vm_vad_t *y);
+RB_PROTOTYPE(vm_vad_rbtree, vm_vad, rbtree_entry, vmp_vad_cmp);
+
 /*! roto-level shared anonymous table */
 struct vmp_amap_l3 {
 	struct vmp_amap_l2 *entries[512];
@@ -106,12 +158,80 @@ struct vm_section {
 	};
 };
 
+/*! How many pages to reclaim at once when the free queue runs dry. */
+#define VMP_RECLAIM_BATCH 32
+
+/*! Default bound on the number of empty pagetable pages kept for reuse. */
+#define VMP_PTCACHE_DEFAULT_MAX 32
+
+/*! Working set list size for new processes. */
+#define VMP_WS_DEFAULT_MAX 2
+
 /*! @brief Acquire the PFN database lock. */
 #define vmp_acquire_pfn_lock() ke_spinlock_acquire(&vmp_pfn_lock)
 
 /*! @brief Release the PFN database lock. */
 #define vmp_release_pfn_lock(IPL) ke_spinlock_release(&vmp_pfn_lock, IPL)
 
+/*!
+ * One CPU's deltas to the VM statistics, and the faults it took, on cache
+ * lines of its own.
+ */
+struct vmp_stat_cpu {
+	struct vm_stat	      stat;
+	struct vm_fault_stats faults;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+extern struct vmp_stat_cpu vmp_stat_cpus[KRX_MAX_CPUS];
+
+/*!
+ * @brief Add \p N to the current CPU's delta of vm_stat member \p FIELD.
+ *
+ * The update is atomic, as CPUs may share deltas, but relaxed: it orders
+ * nothing, and the delta's cache line is normally touched by this CPU alone.
+ */
+#define VMP_STAT_ADD(FIELD, N)                                    \
+	__atomic_fetch_add(&vmp_stat_cpus[ke_cpu_num()].stat.FIELD, \
+	    (size_t)(N), __ATOMIC_RELAXED)
+#define VMP_STAT_INC(FIELD) VMP_STAT_ADD(FIELD, 1)
+#define VMP_STAT_DEC(FIELD) VMP_STAT_ADD(FIELD, -1)
+
+#if KRX_VM_TRACE
+#define VMP_TRACING() __builtin_expect(vm_trace_enabled, 0)
+#else
+#define VMP_TRACING() false
+#endif
+
+/*!
+ * @brief Record a VM trace event, if tracing is compiled in and enabled.
+ *
+ * When compiled out, neither this nor the arguments cost anything; when
+ * compiled in but disabled, a predicted branch.
+ */
+#define VMP_TRACE(TYPE, PS, ADDR, ARG, DETAIL)                              \
+	do {                                                               \
+		if (VMP_TRACING())                                         \
+			vmp_trace_record(TYPE, PS, ADDR, ARG, DETAIL);     \
+	} while (0)
+
+/*! @brief Charge (or credit, if negative) an account; it may be NULL. */
+static inline void
+vmp_account_add(vm_account_t *account, intptr_t nalloced, intptr_t nwires)
+{
+	struct vm_account_cpu *cpu;
+
+	if (account == NULL)
+		return;
+
+	cpu = &account->cpu[ke_cpu_num()];
+	if (nalloced != 0)
+		__atomic_fetch_add(&cpu->nalloced, (size_t)nalloced,
+		    __ATOMIC_RELAXED);
+	if (nwires != 0)
+		__atomic_fetch_add(&cpu->nwires, (size_t)nwires,
+		    __ATOMIC_RELAXED);
+}
+
 /*!
  * @post If kVMFaultRetOK, reference held to each pagetable level and used PTE
  * count incremented on leaf table.
@@ -120,23 +240,380 @@ vm_fault_return_t vmp_md_wire_pte(vmp_procstate_t *vmps, vaddr_t vaddr,
     struct vmp_md_fault_state *state);
 void		  vmp_md_fault_state_release(vmp_procstate_t *vmps,
 		 struct vmp_md_fault_state		     *state);
+int vmp_mp_fetch_pte(vmp_procstate_t *vmps, vaddr_t vaddr, pte_t **pppte,
+    vm_page_t **ptablepage);
+/*!
+ * @brief Promote the leaf table wired by \p state to a large page if the port
+ * has them and the table is wholly populated with writeable private pages of
+ * \p vad.
+ *
+ * Called once a fault has made the PTE for \p vaddr writeable. Memory is
+ * compacted if there is no free run to copy the pages into. On promotion
+ * the state's wiring goes with the leaf table, and \p state is emptied so that
+ * vmp_md_fault_state_release() does nothing.
+ * @returns Whether the table was promoted.
+ * @pre Process mutex and PFN lock held.
+ */
+bool vmp_md_try_promote(vmp_procstate_t *vmps, vm_vad_t *vad, vaddr_t vaddr,
+    struct vmp_md_fault_state *state);
+/*!
+ * @brief Make [start, end) of the private anonymous \p vad resident in bulk,
+ * as writes would, or reads if \p vad isn't writeable.
+ *
+ * Each leaf table's worth is done under one hold of the PFN lock, with its
+ * pages entered in the working set in one batch; a wholly covered, empty
+ * table's worth is mapped as a large page if the port has them and memory
+ * allows. PTEs not empty are left as they are. Stops early if memory runs
+ * short, leaving the rest to be faulted in.
+ * @returns Number of pages made resident.
+ * @pre Process mutex held, PFN lock not held.
+ */
+size_t vmp_md_populate(vmp_procstate_t *vmps, vm_vad_t *vad, vaddr_t start,
+    vaddr_t end);
+/*!
+ * @brief Find the address a leaf PTE maps, from its place in its process'
+ * pagetable tree.
+ *
+ * @pre PFN lock held.
+ */
+vaddr_t vmp_md_pte_vaddr(pte_t *pte);
+/*!
+ * @brief Evict a large page, whose working set entry is at \p vaddr, whole:
+ * it is demoted, and each of its pages left in transition.
+ *
+ * @pre Process mutex and PFN lock held.
+ */
+void vmp_md_large_evict(vmp_procstate_t *vmps, vaddr_t vaddr);
+/*!
+ * @brief Empty every PTE in [vstart, vend), calling \p callback on each that
+ * was non-empty, then shoot down the range.
+ *
+ * @pre PFN lock not held.
+ */
+void vmp_md_unmap_range_and_do(vmp_procstate_t *vmps, vaddr_t vstart,
+    vaddr_t vend, void (*callback)(void *context, pte_t *saved_pte),
+    void *context);
+
+/*!
+ * @brief Invalidate translations of [start, end) in \p vmps on all CPUs.
+ *
+ * Must be called whenever a valid PTE is made invalid or has its permissions
+ * reduced. Upgrades need no invalidation; a stale entry only causes a spurious
+ * fault, which the walker resolves.
+ *
+ * @pre PFN lock held, and the PTEs concerned already updated.
+ */
+void vmp_md_tlb_invalidate(vmp_procstate_t *vmps, vaddr_t start, vaddr_t end,
+    enum vmp_tlb_inval_reason reason);
+
+int vmp_md_ps_init(vmp_procstate_t *vmps);
+/*!
+ * @brief Visit every non-empty leaf PTE of a process in ascending address
+ * order, changing nothing.
+ *
+ * @returns Number of pagetable pages in the process' tree.
+ * @pre PFN lock held.
+ */
+size_t vmp_md_ps_walk(vmp_procstate_t *vmps,
+    void (*callback)(void *context, vaddr_t vaddr, pte_t *pte), void *context);
+/*!
+ * @brief Free the whole pagetable tree of a process in one sweep.
+ *
+ * \p callback is called on every non-empty leaf PTE. No used PTE counts or
+ * pagetable references are maintained along the way, and pagetable pages are
+ * freed without crediting any account.
+ *
+ * @returns Number of pagetable pages freed.
+ * @pre No thread is running in the process. PFN lock not held.
+ */
+size_t vmp_md_ps_destroy(vmp_procstate_t *vmps,
+    void (*callback)(void *context, pte_t *saved_pte), void *context);
 
 int	   vmp_page_alloc_locked(vm_page_t **out, vm_account_t *account,
 	   enum vm_page_use use, bool must);
+/*!
+ * @brief Allocate a page from the free queue alone, never reclaiming; for use
+ * while reclaiming.
+ *
+ * @pre PFNDB lock held.
+ */
+int vmp_page_alloc_free_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use);
+/*!
+ * @brief Allocate \p npages physically contiguous pages, aligned to their
+ * number, from the free queue and pagetable cache alone, never reclaiming.
+ *
+ * \p npages must be a power of two. Each page is set up and charged as by
+ * vmp_page_alloc_locked(), but not zeroed. Returns the first page of the run;
+ * the rest follow it in the PFN database.
+ * @pre PFNDB lock held.
+ */
+int vmp_page_alloc_contig_locked(vm_page_t **out, size_t npages,
+    vm_account_t *account, enum vm_page_use use);
+/*!
+ * @brief Allocate a page of memory tier \p tier from its free queue alone,
+ * never reclaiming.
+ *
+ * The page is set up and charged as by vmp_page_alloc_locked(), but not
+ * zeroed.
+ * @pre PFNDB lock held.
+ */
+int vmp_page_alloc_tier_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use, enum vm_mem_tier tier);
 void	   vmp_page_free_locked(vm_page_t *page);
+/*!
+ * @brief Whether vmp_page_migrate_locked() can move a page: a private
+ * anonymous page, not busy, that is either mapped by its PTE alone and not as
+ * part of a large page, or on the standby or modified queue.
+ *
+ * @pre PFNDB lock held.
+ */
+bool vmp_page_is_movable(vm_page_t *page);
+/*!
+ * @brief Move a movable page to the free page \p to.
+ *
+ * The contents are copied and \p to takes over the page's state, references
+ * and charges, with the PTE referring to the page repointed at it; a valid PTE
+ * is invalidated in the TLB first. The old frame is freed.
+ * @returns 0, or -1 if the page isn't movable.
+ * @pre PFNDB lock held.
+ */
+int vmp_page_migrate_locked(vm_page_t *page, vm_page_t *to);
+/*! @brief Change the use of an allocated page. @pre PFNDB lock held. */
+void vmp_page_set_use_locked(vm_page_t *page, enum vm_page_use use);
 void	   vmp_page_delete_locked(vm_page_t *page, vm_account_t *account,
 	  bool release);
+/*!
+ * @brief Allocate a pagetable page, preferring an empty one from the cache.
+ *
+ * The page is zeroed either way. Charges \p account as vmp_page_alloc_locked()
+ * does.
+ * @pre PFNDB lock held.
+ */
+int vmp_pagetable_page_alloc_locked(vm_page_t **out, vm_account_t *account,
+    enum vm_page_use use);
+/*!
+ * @brief Free a pagetable page whose last used PTE has gone, keeping it in the
+ * pagetable cache if there is room.
+ *
+ * @pre PFNDB lock held. \p page has one reference, held by \p account, and
+ * all its entries are empty.
+ */
+void vmp_pagetable_page_free_locked(vm_page_t *page, vm_account_t *account);
+/*!
+ * @brief Free up to \p count pages by reclaiming standby pages, first writing
+ * out modified pages if needed.
+ *
+ * @returns Number of pages put on the free queue.
+ * @pre PFNDB lock held.
+ */
+size_t	   vmp_page_reclaim_locked(size_t count);
+/*!
+ * @brief Compact memory as vm_compact() does, for an allocation of contiguous
+ * pages that found none free.
+ *
+ * @pre PFNDB lock held.
+ */
+size_t vmp_compact_locked(size_t block_pages, size_t max_pages);
+/*!
+ * @brief Allocate an object from a zone with the PFNDB lock already held.
+ */
+void *vmp_kmem_zonealloc_locked(kmem_zone_t *zone);
+/*!
+ * @brief Give up to \p count empty slabs back to the VM.
+ *
+ * @param drain_magazines Whether to empty the per-CPU magazines into the
+ * slabs first, if there are too few empty slabs.
+ * @returns Number of pages freed.
+ * @pre PFNDB lock held.
+ */
+size_t vmp_kmem_reap_locked(size_t count, bool drain_magazines);
 vm_page_t *vmp_page_retain_locked(vm_page_t *page, vm_account_t *account);
 void	   vmp_page_release_locked(vm_page_t *page, vm_account_t *account);
+/*!
+ * @brief Move an inactive page to the head of its standby or modified queue,
+ * to be reclaimed before any other; does nothing if the page is active.
+ *
+ * @pre PFNDB lock held.
+ */
+void vmp_page_make_cold_locked(vm_page_t *page);
 
+/*!
+ * @brief Resolve a fault at \p vaddr within \p vad, the process mutex and
+ * PFN lock already held.
+ *
+ * A write fault on a page not mapped may only map it read-only, leaving
+ * \p made_writeable false; it is then to be faulted on again with the same
+ * \p state, which stays wired for the caller to release.
+ * @returns The kind of fault.
+ * @pre Process mutex and PFN lock held. \p vad allows the access.
+ */
+enum vm_fault_kind vmp_fault_locked(vmp_procstate_t *vmps, vm_vad_t *vad,
+    struct vmp_md_fault_state *state, vaddr_t vaddr, bool write,
+    bool *made_writeable, vm_account_t *out_account, vm_page_t **out);
 int vmp_fault(vaddr_t vaddr, bool write, vm_account_t *out_account,
     vm_page_t **out);
 
+/*! Most pages a hard fault or will-need advice reads in one cluster. */
+#define VMP_PAGEIN_CLUSTER_MAX 16
+
+/*!
+ * @brief Read in the outpaged page at \p vaddr together with those following
+ * it whose pagefile slots continue its own, up to \p max pages and \p end, in
+ * one pagefile read.
+ *
+ * If \p page is given, it is the page allocated for \p vaddr, which is left to
+ * the caller to map; every other page is left in transition, as if evicted.
+ * Those pages are taken from the free queue alone unless \p reclaim, and the
+ * run stops short where memory does.
+ * @returns Number of pages read, counting \p page; 0 if \p vaddr isn't
+ * outpaged, or no page could be had for it.
+ * @pre PFN lock held. \p max is at most VMP_PAGEIN_CLUSTER_MAX.
+ */
+size_t vmp_pagein_cluster_locked(vmp_procstate_t *vmps, vaddr_t vaddr,
+    vaddr_t end, size_t max, bool reclaim, vm_page_t *page);
+
+/*! @brief Allocate a pagefile slot; returns 0 if the pagefile is full. */
+uintptr_t vmp_pagefile_slot_alloc(void);
+/*! @brief Free a pagefile slot. */
+void vmp_pagefile_slot_free(uintptr_t slot);
+/*! @brief Copy a page's contents out to a pagefile slot. */
+void vmp_md_pagefile_write(uintptr_t slot, vm_page_t *page);
+/*! @brief Copy a pagefile slot's contents into a page. */
+void vmp_md_pagefile_read(uintptr_t slot, vm_page_t *page);
+/*!
+ * @brief Copy the contents of \p npages consecutive pagefile slots, starting
+ * at \p slot, into \p pages, as a single I/O.
+ */
+void vmp_md_pagefile_read_cluster(uintptr_t slot, vm_page_t **pages,
+    size_t npages);
+
+/*!
+ * @brief Compress a page into the compressed cache.
+ *
+ * @returns 0 with a handle to the compressed copy in \p handle, or -1 if the
+ * cache is disabled or full, or the page didn't compress well enough.
+ * @pre PFNDB lock held.
+ */
+int vmp_zcache_store(vm_page_t *page, uintptr_t *handle);
+/*!
+ * @brief Decompress a page out of the compressed cache into \p page, and free
+ * the compressed copy.
+ *
+ * @pre PFNDB lock held.
+ */
+void vmp_zcache_load(uintptr_t handle, vm_page_t *page);
+/*! @brief Free a compressed copy. @pre PFNDB lock held. */
+void vmp_zcache_free(uintptr_t handle);
+
+/*!
+ * @brief Drop a mapping's reference to a shared page of same-page merging,
+ * freeing the page if it was the last.
+ *
+ * @pre PFNDB lock held.
+ */
+void vmp_merge_page_release(vm_page_t *page);
+/*!
+ * @brief Drop a wire of a shared page of same-page merging, charged to
+ * \p account, freeing the page if nothing else refers to it.
+ *
+ * @pre PFNDB lock held.
+ */
+void vmp_merge_page_unwire(vm_page_t *page, vm_account_t *account);
+
 vm_vad_t *vmp_ps_vad_find(vmp_procstate_t *ps, vaddr_t vaddr);
 
+/*!
+ * @brief Note a fault of \p kind at \p vaddr in the process' prefetch log.
+ *
+ * @pre Process mutex held, PFN lock not held, and vmps->prefetch_log set.
+ */
+void vmp_prefetch_log(vmp_procstate_t *vmps, vaddr_t vaddr,
+    enum vm_fault_kind kind);
+/*! @brief Discard the prefetch log of a process, if any. */
+void vmp_prefetch_log_free(vmp_procstate_t *vmps);
+
+void vmp_trace_record(enum vm_trace_type type, vmp_procstate_t *ps,
+    uint64_t addr, uint64_t arg, uint32_t detail);
+
 void vmp_wsl_insert(vmp_procstate_t *ps, vaddr_t vaddr);
+/*!
+ * @brief Enter in the working set \p npages pages mapped together at \p vaddr,
+ * as by a large page. The entry counts as that many pages, and is evicted as
+ * one.
+ */
+void vmp_wsl_insert_pages(vmp_procstate_t *ps, vaddr_t vaddr, size_t npages);
+/*!
+ * @brief Enter in the working set \p n pages newly mapped at \p vaddrs at once.
+ *
+ * The working set is only trimmed back to size after, oldest first, with one
+ * TLB invalidation for all the pages evicted.
+ */
+void vmp_wsl_insert_batch(vmp_procstate_t *ps, const vaddr_t *vaddrs,
+    size_t n);
 void vmp_wsl_remove(vmp_procstate_t *ps, vaddr_t vaddr);
+/*! @brief Remove all working set entries within [start, end). */
+void vmp_wsl_remove_range(vmp_procstate_t *ps, vaddr_t start, vaddr_t end);
+/*!
+ * @brief Evict the single-page entries of a working set within [start, end)
+ * at once, with one TLB invalidation.
+ *
+ * @returns Number of pages evicted.
+ * @pre PFN lock held.
+ */
+size_t vmp_wsl_evict_range(vmp_procstate_t *ps, vaddr_t start, vaddr_t end);
+/*!
+ * @brief Move the working set entries within [start, end) to the head of the
+ * queue, to be evicted before any other.
+ */
+void vmp_wsl_make_cold(vmp_procstate_t *ps, vaddr_t start, vaddr_t end);
+/*! @brief Free every working set entry without touching the PTEs. */
+void vmp_wsl_destroy(vmp_procstate_t *ps);
+/*!
+ * Called by vmp_wsl_age() with a working set page's PTE and its age, the
+ * aging passes since it was last found accessed, both now and as of the pass
+ * before.
+ */
+typedef void (*vmp_wsl_age_fn_t)(void *context, vaddr_t vaddr, pte_t *pte,
+    unsigned age, unsigned last_age);
+/*!
+ * @brief Age each single-page entry of a working set by its PTE's accessed
+ * bit, clearing it, and call \p fn with each.
+ *
+ * The caller must invalidate the TLB over the pages found accessed, those
+ * passed with an age of 0, or they would go on being found unaccessed.
+ */
+void vmp_wsl_age(vmp_procstate_t *ps, vmp_wsl_age_fn_t fn, void *context);
 
 extern kspinlock_t vmp_pfn_lock;
+/*! Bound on the pagetable cache; 0 disables it. PFNDB lock protects. */
+extern size_t vmp_ptcache_max;
+/*!
+ * The shared zero page, mapped read-only by read faults on untouched private
+ * anonymous memory. Permanently wired; the PTEs mapping it hold no reference
+ * and aren't in any working set.
+ */
+extern vm_page_t *vmp_zero_page;
+/*! Whether read faults map the zero page. For benchmarking. */
+extern bool vmp_zero_page_enabled;
+/*! Pages of each memory tier, and of them free. PFNDB lock protects. */
+extern size_t vmp_tier_npages[kVMTierMax], vmp_tier_nfree[kVMTierMax];
+
+/*! A region of physical memory, with its part of the PFN database. */
+struct vmp_pregion {
+	/*! Linkage to vmp_pregion_queue. */
+	TAILQ_ENTRY(vmp_pregion) queue_entry;
+	/*! Base address of region. */
+	paddr_t base;
+	/*! Number of pages the region covers. */
+	size_t npages;
+	/*! Memory tier of the region. */
+	enum vm_mem_tier tier;
+	/*! PFN database part for region. */
+	vm_page_t pages[0];
+};
+
+/*! All regions of physical memory, in the order added. */
+extern TAILQ_HEAD(vmp_pregion_queue, vmp_pregion) vmp_pregion_queue;
 
 #endif /* KRX_VM_VMP_H */
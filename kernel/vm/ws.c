@@ -1,12 +1,6 @@
 #include "kdk/vm.h"
 #include "vmp.h"
 
-struct vmp_wsle {
-	TAILQ_ENTRY(vmp_wsle) queue_entry;
-	RB_ENTRY(vmp_wsle) rb_entry;
-	vaddr_t vaddr;
-};
-
 static inline intptr_t
 wsle_cmp(struct vmp_wsle *x, struct vmp_wsle *y)
 {
@@ -15,6 +9,9 @@ wsle_cmp(struct vmp_wsle *x, struct vmp_wsle *y)
 
 RB_GENERATE(vmp_wsle_tree, vmp_wsle, rb_entry, wsle_cmp);
 
+static kmem_zone_t wsle_zone = KMEM_ZONE_INITIALISER(wsle_zone, "vmp_wsle",
+    sizeof(struct vmp_wsle));
+
 static struct vmp_wsle *
 vmp_wsl_find(vmp_procstate_t *ps, vaddr_t vaddr)
 {
@@ -48,8 +45,13 @@ vm_page_evict(vmp_procstate_t *ps, pte_t *pte)
 	}
 }
 
-static void
-wsl_evict_one(vmp_procstate_t *ps)
+/*
+ * Evict the least recently added page; returns its now-unlinked entry. If
+ * \p span is given, invalidating a single page's translation is left to the
+ * caller, and [span[0], span[1]) widened to cover it.
+ */
+static struct vmp_wsle *
+wsl_evict_one(vmp_procstate_t *ps, vaddr_t *span)
 {
 	struct vmp_wsle *wsle = TAILQ_FIRST(&ps->ws_queue);
 	pte_t *pte;
@@ -58,40 +60,233 @@ wsl_evict_one(vmp_procstate_t *ps)
 	kassert(wsle != NULL);
 	TAILQ_REMOVE(&ps->ws_queue, wsle, queue_entry);
 	RB_REMOVE(vmp_wsle_tree, &ps->ws_tree , wsle);
+	ps->ws_current_count -= wsle->npages;
 
-	kprintf("Evicting 0x%zx\n", wsle->vaddr);
+	VMP_TRACE(kVMTraceWSEvict, ps, wsle->vaddr, 0, 0);
 	r = vmp_mp_fetch_pte(ps, wsle->vaddr, &pte, NULL);
-	kassert(r == 0);
+	if (r != 0) {
+		/* no leaf PTE, so a large page; it goes whole */
+		vmp_md_large_evict(ps, wsle->vaddr);
+		return wsle;
+	}
 	kassert(vmp_md_pte_is_valid(pte));
 
-	kmem_free(wsle, sizeof(*wsle));
 	vm_page_evict(ps, pte);
+	if (span == NULL) {
+		vmp_md_tlb_invalidate(ps, wsle->vaddr, wsle->vaddr + PGSIZE,
+		    kVMTLBInvalEviction);
+	} else {
+		if (wsle->vaddr < span[0])
+			span[0] = wsle->vaddr;
+		if (wsle->vaddr + PGSIZE > span[1])
+			span[1] = wsle->vaddr + PGSIZE;
+	}
+
+	return wsle;
 }
 
 void
 vmp_wsl_insert(vmp_procstate_t *ps, vaddr_t vaddr)
 {
-	struct vmp_wsle *wsle;
+	vmp_wsl_insert_pages(ps, vaddr, 1);
+}
+
+void
+vmp_wsl_insert_pages(vmp_procstate_t *ps, vaddr_t vaddr, size_t npages)
+{
+	struct vmp_wsle *wsle = NULL;
 
 	kassert(vmp_wsl_find(ps, vaddr) == NULL);
 
-	if ((ps->ws_current_count + 1) > 2)
-		wsl_evict_one(ps);
-	else
-		ps->ws_current_count++;
+	while (ps->ws_current_count + npages > ps->ws_max_count &&
+	    !TAILQ_EMPTY(&ps->ws_queue)) {
+		/* reuse an evicted page's entry */
+		if (wsle != NULL)
+			kmem_zonefree(&wsle_zone, wsle);
+		wsle = wsl_evict_one(ps, NULL);
+	}
 
-	wsle = kmem_alloc(sizeof(*wsle));
+	if (wsle == NULL &&
+	    (wsle = vmp_kmem_zonealloc_locked(&wsle_zone)) == NULL) {
+		/* no memory for another entry; trim the working set instead */
+		kassert(ps->ws_current_count > 0);
+		wsle = wsl_evict_one(ps, NULL);
+	}
+
+	ps->ws_current_count += npages;
 	wsle->vaddr = vaddr;
+	wsle->npages = npages;
+	wsle->age = 0;
 	TAILQ_INSERT_TAIL(&ps->ws_queue, wsle, queue_entry);
 	RB_INSERT(vmp_wsle_tree, &ps->ws_tree, wsle);
+	VMP_TRACE(kVMTraceWSInsert, ps, vaddr, 0, 0);
 }
 
-void vmp_wsl_remove(vmp_procstate_t*ps, vaddr_t vaddr)
+void
+vmp_wsl_insert_batch(vmp_procstate_t *ps, const vaddr_t *vaddrs, size_t n)
 {
 	struct vmp_wsle *wsle;
+	vaddr_t		 span[2] = { UINTPTR_MAX, 0 };
 
-	kassert(vmp_wsl_find(ps, vaddr) == NULL);
+	for (size_t i = 0; i < n; i++) {
+		kassert(vmp_wsl_find(ps, vaddrs[i]) == NULL);
+
+		wsle = vmp_kmem_zonealloc_locked(&wsle_zone);
+		if (wsle == NULL) {
+			kassert(ps->ws_current_count > 0);
+			wsle = wsl_evict_one(ps, NULL);
+		}
+
+		ps->ws_current_count++;
+		wsle->vaddr = vaddrs[i];
+		wsle->npages = 1;
+		wsle->age = 0;
+		TAILQ_INSERT_TAIL(&ps->ws_queue, wsle, queue_entry);
+		RB_INSERT(vmp_wsle_tree, &ps->ws_tree, wsle);
+		VMP_TRACE(kVMTraceWSInsert, ps, vaddrs[i], 0, 0);
+	}
+
+	/*
+	 * then trim back to size, oldest first, perhaps taking some of the
+	 * batch, with one invalidation for the lot. nothing evicted may be
+	 * reclaimed before its translations go, so they go before evicting a
+	 * large page, which allocates a leaf table.
+	 */
+	while (ps->ws_current_count > ps->ws_max_count) {
+		wsle = TAILQ_FIRST(&ps->ws_queue);
+		if (wsle->npages != 1 && span[1] != 0) {
+			vmp_md_tlb_invalidate(ps, span[0], span[1],
+			    kVMTLBInvalEviction);
+			span[0] = UINTPTR_MAX;
+			span[1] = 0;
+		}
+		kmem_zonefree(&wsle_zone, wsl_evict_one(ps, span));
+	}
+
+	if (span[1] != 0)
+		vmp_md_tlb_invalidate(ps, span[0], span[1],
+		    kVMTLBInvalEviction);
+}
+
+void
+vmp_wsl_remove(vmp_procstate_t *ps, vaddr_t vaddr)
+{
+	struct vmp_wsle *wsle;
+
+	wsle = vmp_wsl_find(ps, vaddr);
+	kassert(wsle != NULL);
+
+	TAILQ_REMOVE(&ps->ws_queue, wsle, queue_entry);
+	RB_REMOVE(vmp_wsle_tree, &ps->ws_tree, wsle);
+	ps->ws_current_count -= wsle->npages;
+	kmem_zonefree(&wsle_zone, wsle);
+}
 
-	kfatal("Implement this function\n");
+void
+vmp_wsl_remove_range(vmp_procstate_t *ps, vaddr_t start, vaddr_t end)
+{
+	struct vmp_wsle *wsle, *next, key;
+
+	key.vaddr = start;
+	for (wsle = RB_NFIND(vmp_wsle_tree, &ps->ws_tree, &key);
+	     wsle != NULL && wsle->vaddr < end; wsle = next) {
+		next = RB_NEXT(vmp_wsle_tree, &ps->ws_tree, wsle);
+		TAILQ_REMOVE(&ps->ws_queue, wsle, queue_entry);
+		RB_REMOVE(vmp_wsle_tree, &ps->ws_tree, wsle);
+		ps->ws_current_count -= wsle->npages;
+		kmem_zonefree(&wsle_zone, wsle);
+	}
+}
+
+size_t
+vmp_wsl_evict_range(vmp_procstate_t *ps, vaddr_t start, vaddr_t end)
+{
+	struct vmp_wsle *wsle, *next, key;
+	size_t		 n = 0;
+
+	key.vaddr = start;
+	for (wsle = RB_NFIND(vmp_wsle_tree, &ps->ws_tree, &key);
+	     wsle != NULL && wsle->vaddr < end; wsle = next) {
+		pte_t *pte;
+
+		next = RB_NEXT(vmp_wsle_tree, &ps->ws_tree, wsle);
+		/* large pages are left whole */
+		if (wsle->npages != 1)
+			continue;
+		if (vmp_mp_fetch_pte(ps, wsle->vaddr, &pte, NULL) != 0)
+			kfatal("working set entry without a PTE\n");
+
+		TAILQ_REMOVE(&ps->ws_queue, wsle, queue_entry);
+		RB_REMOVE(vmp_wsle_tree, &ps->ws_tree, wsle);
+		ps->ws_current_count--;
+		VMP_TRACE(kVMTraceWSEvict, ps, wsle->vaddr, 0, 0);
+		kmem_zonefree(&wsle_zone, wsle);
+
+		vm_page_evict(ps, pte);
+		n++;
+	}
+
+	/* the PFN lock keeps the pages from reuse until this is done */
+	if (n != 0)
+		vmp_md_tlb_invalidate(ps, start, end, kVMTLBInvalEviction);
+
+	return n;
+}
+
+void
+vmp_wsl_make_cold(vmp_procstate_t *ps, vaddr_t start, vaddr_t end)
+{
+	struct vmp_wsle *wsle, *prev = NULL, key;
 
+	/* to the head of the queue, in address order */
+	key.vaddr = start;
+	for (wsle = RB_NFIND(vmp_wsle_tree, &ps->ws_tree, &key);
+	     wsle != NULL && wsle->vaddr < end;
+	     wsle = RB_NEXT(vmp_wsle_tree, &ps->ws_tree, wsle)) {
+		TAILQ_REMOVE(&ps->ws_queue, wsle, queue_entry);
+		if (prev == NULL)
+			TAILQ_INSERT_HEAD(&ps->ws_queue, wsle, queue_entry);
+		else
+			TAILQ_INSERT_AFTER(&ps->ws_queue, prev, wsle,
+			    queue_entry);
+		prev = wsle;
+	}
+}
+
+void
+vmp_wsl_destroy(vmp_procstate_t *ps)
+{
+	struct vmp_wsle *wsle, *tmp;
+
+	TAILQ_FOREACH_SAFE (wsle, &ps->ws_queue, queue_entry, tmp)
+		kmem_zonefree(&wsle_zone, wsle);
+
+	TAILQ_INIT(&ps->ws_queue);
+	RB_INIT(&ps->ws_tree);
+	ps->ws_current_count = 0;
+}
+
+void
+vmp_wsl_age(vmp_procstate_t *ps, vmp_wsl_age_fn_t fn, void *context)
+{
+	struct vmp_wsle *wsle;
+
+	TAILQ_FOREACH (wsle, &ps->ws_queue, queue_entry) {
+		unsigned last_age = wsle->age;
+		pte_t	*pte;
+
+		if (wsle->npages != 1)
+			continue;
+		if (vmp_mp_fetch_pte(ps, wsle->vaddr, &pte, NULL) != 0)
+			kfatal("working set entry without a PTE\n");
+
+		if (vmp_md_pte_is_accessed(pte)) {
+			vmp_md_pte_clear_accessed(pte);
+			wsle->age = 0;
+		} else if (wsle->age < UINT8_MAX) {
+			wsle->age++;
+		}
+
+		fn(context, wsle->vaddr, pte, wsle->age, last_age);
+	}
 }
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2026 NetaScale Object Solutions.
+ * Created on Mon Oct 19 2026.
+ */
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ *  License, v. 2.0. If a copy of the MPL was not distributed with this
+ *  file, You can obtain one at https://mozilla.org/MPL/2.0/.
+ */
+
+/*!
+ * @file zcache.c
+ * @brief Compressed cache of modified anonymous pages.
+ *
+ * Reclaim compresses modified pages into a pool of wired pages rather than
+ * writing them to the pagefile, and their PTEs are made compressed PTEs
+ * holding a handle to the compressed copy; faulting one back in needs only a
+ * decompression.
+ *
+ * Each pool page is split into ZCACHE_CHUNKS chunks, and a compressed copy
+ * takes a run of them within one pool page, its first two bytes holding its
+ * length. A pool page's chunk bitmap lives in its used_ptes. The handle of a
+ * copy is the pool page's PFN times ZCACHE_CHUNKS, plus its first chunk.
+ *
+ * Pages are compressed with a small LZ77 compressor whose output is a series
+ * of sequences, as in LZ4: a token byte holding a literal count and a match
+ * length, each 15 meaning that more length bytes follow, then the literals,
+ * then a 16-bit offset back to the match. The last sequence has literals only.
+ *
+ * Everything is under the PFNDB lock.
+ */
+
+#include "kdk/libkern.h"
+#include "kdk/vm.h"
+#include "vmp.h"
+
+/*! Chunks of each pool page; one per bit of vm_page_t::used_ptes. */
+#define ZCACHE_CHUNKS 16
+#define ZCACHE_CHUNK_SIZE (PGSIZE / ZCACHE_CHUNKS)
+/*! Most chunks a copy may take; pages compressing worse are turned away. */
+#define ZCACHE_MAX_CHUNKS (ZCACHE_CHUNKS * 3 / 4)
+#define ZCACHE_MAX_LEN (ZCACHE_MAX_CHUNKS * ZCACHE_CHUNK_SIZE - 2)
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 10
+
+static TAILQ_HEAD(, vm_page) zcache_pool = TAILQ_HEAD_INITIALIZER(
+    zcache_pool);
+/*! Bound on the pool's pages; 0 while the cache is disabled. */
+static size_t	              zcache_max;
+static struct vm_zcache_stats zcache_stats;
+/*! Where pages are compressed to before a place is found for them. */
+static uint8_t	              zcache_buf[ZCACHE_MAX_LEN];
+/*! The compressor's hash table of positions. */
+static uint16_t	              lz_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t
+lz_load32(const uint8_t *p)
+{
+	uint32_t value;
+
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+/* append a length's continuation bytes */
+static void
+lz_put_length(uint8_t *out, size_t *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		out[(*op)++] = 255;
+	out[(*op)++] = len;
+}
+
+/* append a sequence; returns false if it doesn't fit in max bytes */
+static bool
+lz_put_sequence(uint8_t *out, size_t *op, size_t max, const uint8_t *literals,
+    size_t nliterals, size_t offset, size_t match_len)
+{
+	size_t	 need = 1 + nliterals / 255 + 1 + nliterals + 2 +
+	    match_len / 255 + 1;
+	uint8_t *token;
+
+	if (*op + need > max)
+		return false;
+
+	token = &out[(*op)++];
+	*token = (nliterals >= 15 ? 15 : nliterals) << 4;
+	if (nliterals >= 15)
+		lz_put_length(out, op, nliterals - 15);
+	memcpy(&out[*op], literals, nliterals);
+	*op += nliterals;
+
+	if (match_len != 0) {
+		match_len -= LZ_MIN_MATCH;
+		out[(*op)++] = offset & 0xff;
+		out[(*op)++] = offset >> 8;
+		*token |= match_len >= 15 ? 15 : match_len;
+		if (match_len >= 15)
+			lz_put_length(out, op, match_len - 15);
+	}
+
+	return true;
+}
+
+/* compress; returns the compressed length, or 0 if it exceeds max bytes */
+static size_t
+lz_compress(const uint8_t *in, size_t len, uint8_t *out, size_t max)
+{
+	size_t ip = 0, anchor = 0, op = 0;
+
+	/* entries are positions plus one, so that 0 means none */
+	memset(lz_table, 0x0, sizeof(lz_table));
+
+	while (ip + LZ_MIN_MATCH <= len) {
+		uint32_t seq = lz_load32(&in[ip]);
+		uint32_t hash = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		size_t	 ref = lz_table[hash], match_len;
+
+		lz_table[hash] = ip + 1;
+		if (ref-- == 0 || ip - ref > 0xffff ||
+		    lz_load32(&in[ref]) != seq) {
+			ip++;
+			continue;
+		}
+
+		for (match_len = LZ_MIN_MATCH; ip + match_len < len &&
+		     in[ref + match_len] == in[ip + match_len];
+		     match_len++)
+			;
+
+		if (!lz_put_sequence(out, &op, max, &in[anchor], ip - anchor,
+			ip - ref, match_len))
+			return 0;
+		ip += match_len;
+		anchor = ip;
+	}
+
+	if (!lz_put_sequence(out, &op, max, &in[anchor], len - anchor, 0, 0))
+		return 0;
+
+	return op;
+}
+
+/* read a length's continuation bytes; returns false if input runs out */
+static bool
+lz_get_length(const uint8_t *in, size_t len, size_t *ip, size_t *value)
+{
+	uint8_t byte;
+
+	do {
+		if (*ip == len)
+			return false;
+		byte = in[(*ip)++];
+		*value += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+/* decompress; returns whether exactly out_len bytes were produced */
+static bool
+lz_decompress(const uint8_t *in, size_t len, uint8_t *out, size_t out_len)
+{
+	size_t ip = 0, op = 0;
+
+	while (ip < len) {
+		uint8_t token = in[ip++];
+		size_t	nliterals = token >> 4, match_len = token & 15, offset;
+
+		if (nliterals == 15 && !lz_get_length(in, len, &ip, &nliterals))
+			return false;
+		if (nliterals > len - ip || nliterals > out_len - op)
+			return false;
+		memcpy(&out[op], &in[ip], nliterals);
+		ip += nliterals;
+		op += nliterals;
+
+		if (ip == len)
+			break;
+
+		if (len - ip < 2)
+			return false;
+		offset = in[ip] | in[ip + 1] << 8;
+		ip += 2;
+		if (match_len == 15 && !lz_get_length(in, len, &ip, &match_len))
+			return false;
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > op || match_len > out_len - op)
+			return false;
+
+		/* byte by byte, as the match may overlap what it produces */
+		for (size_t i = 0; i < match_len; i++, op++)
+			out[op] = out[op - offset];
+	}
+
+	return op == out_len;
+}
+
+static inline uint16_t
+chunk_mask(size_t chunk, size_t nchunks)
+{
+	return ((1u << nchunks) - 1) << chunk;
+}
+
+static inline size_t
+len_chunks(size_t len)
+{
+	return (2 + len + ZCACHE_CHUNK_SIZE - 1) / ZCACHE_CHUNK_SIZE;
+}
+
+/* find a run of nchunks free chunks; returns false if there is none */
+static bool
+pool_find(size_t nchunks, vm_page_t **out, size_t *chunk)
+{
+	vm_page_t *page;
+
+	TAILQ_FOREACH (page, &zcache_pool, queue_link) {
+		for (size_t i = 0; i + nchunks <= ZCACHE_CHUNKS; i++) {
+			if ((page->used_ptes & chunk_mask(i, nchunks)) == 0) {
+				*out = page;
+				*chunk = i;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static int
+pool_grow(vm_page_t **out)
+{
+	vm_page_t *page;
+	int	   r;
+
+	if (zcache_stats.npages >= zcache_max)
+		return -1;
+
+	r = vmp_page_alloc_free_locked(&page, NULL, kPageUseZCache);
+	if (r != 0)
+		return r;
+
+	TAILQ_INSERT_TAIL(&zcache_pool, page, queue_link);
+	zcache_stats.npages++;
+	*out = page;
+
+	return 0;
+}
+
+void
+vm_zcache_enable(size_t max_pages)
+{
+	vm_page_t *page;
+	ipl_t	   ipl;
+
+	kassert(max_pages > 0);
+
+	ipl = vmp_acquire_pfn_lock();
+	kassert(zcache_max == 0);
+	zcache_max = max_pages;
+	if (pool_grow(&page) != 0)
+		kfatal("No memory for the compressed cache\n");
+	vmp_release_pfn_lock(ipl);
+
+	kprintf("VM: Compressed cache of up to %zu KiB\n",
+	    max_pages * PGSIZE / 1024);
+}
+
+void
+vm_zcache_get_stats(struct vm_zcache_stats *stats)
+{
+	ipl_t ipl = vmp_acquire_pfn_lock();
+	*stats = zcache_stats;
+	vmp_release_pfn_lock(ipl);
+}
+
+int
+vmp_zcache_store(vm_page_t *page, uintptr_t *handle)
+{
+	vm_page_t *pool_page;
+	size_t	   len, nchunks, chunk;
+	uint8_t	  *obj;
+	uint16_t   len16;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	if (zcache_max == 0)
+		return -1;
+
+	len = lz_compress((uint8_t *)vm_page_direct_map_addr(page), PGSIZE,
+	    zcache_buf, sizeof(zcache_buf));
+	if (len == 0) {
+		zcache_stats.nincompressible++;
+		return -1;
+	}
+
+	nchunks = len_chunks(len);
+	if (!pool_find(nchunks, &pool_page, &chunk)) {
+		if (pool_grow(&pool_page) != 0) {
+			zcache_stats.nfull++;
+			return -1;
+		}
+		chunk = 0;
+	}
+
+	pool_page->used_ptes |= chunk_mask(chunk, nchunks);
+	obj = (uint8_t *)vm_page_direct_map_addr(pool_page) +
+	    chunk * ZCACHE_CHUNK_SIZE;
+	len16 = len;
+	memcpy(obj, &len16, sizeof(len16));
+	memcpy(obj + 2, zcache_buf, len);
+
+	zcache_stats.nstored++;
+	zcache_stats.nobjects++;
+	zcache_stats.bytes_in += PGSIZE;
+	zcache_stats.bytes_out += len;
+
+	*handle = pool_page->pfn * ZCACHE_CHUNKS + chunk;
+	return 0;
+}
+
+/* get a copy's pool page, chunk and length */
+static uint8_t *
+zcache_object(uintptr_t handle, vm_page_t **pool_page, size_t *chunk,
+    size_t *len)
+{
+	uint8_t *obj;
+	uint16_t len16;
+
+	*pool_page = vm_paddr_to_page(PFN_TO_PADDR(handle / ZCACHE_CHUNKS));
+	*chunk = handle % ZCACHE_CHUNKS;
+	kassert((*pool_page)->use == kPageUseZCache);
+
+	obj = (uint8_t *)vm_page_direct_map_addr(*pool_page) +
+	    *chunk * ZCACHE_CHUNK_SIZE;
+	memcpy(&len16, obj, sizeof(len16));
+	*len = len16;
+
+	return obj + 2;
+}
+
+static void
+zcache_object_free(vm_page_t *pool_page, size_t chunk, size_t len)
+{
+	uint16_t mask = chunk_mask(chunk, len_chunks(len));
+
+	kassert((pool_page->used_ptes & mask) == mask);
+	pool_page->used_ptes &= ~mask;
+	zcache_stats.nobjects--;
+
+	/* empty pool pages are given back, bar one to restart the pool with */
+	if (pool_page->used_ptes == 0 && zcache_stats.npages > 1) {
+		TAILQ_REMOVE(&zcache_pool, pool_page, queue_link);
+		zcache_stats.npages--;
+		vmp_page_delete_locked(pool_page, NULL, true);
+	}
+}
+
+void
+vmp_zcache_load(uintptr_t handle, vm_page_t *page)
+{
+	vm_page_t *pool_page;
+	size_t	   chunk, len;
+	uint8_t	  *data;
+	uint64_t   begin;
+	bool	   ok;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	data = zcache_object(handle, &pool_page, &chunk, &len);
+
+	begin = ke_nanotime();
+	ok = lz_decompress(data, len, (uint8_t *)vm_page_direct_map_addr(page),
+	    PGSIZE);
+	zcache_stats.decompress_ns += ke_nanotime() - begin;
+	kassert(ok);
+
+	zcache_stats.nloaded++;
+	zcache_object_free(pool_page, chunk, len);
+}
+
+void
+vmp_zcache_free(uintptr_t handle)
+{
+	vm_page_t *pool_page;
+	size_t	   chunk, len;
+
+	kassert(ke_spinlock_held(&vmp_pfn_lock));
+
+	zcache_object(handle, &pool_page, &chunk, &len);
+	zcache_stats.nfreed++;
+	zcache_object_free(pool_page, chunk, len);
+}